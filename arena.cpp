@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <unordered_map>
+#include "arena.h"
+
+namespace {
+    thread_local Arena* current_arena = nullptr;
+
+    // Counts the objects TryPromote would copy for value, up to limit, and gives limit if any
+    // of them can not be copied. Shared parts are counted every time they are reached, which
+    // only errs on the side of not copying.
+    size_t CountCopies(const Value& value, size_t limit) {
+        size_t count = 0;
+        std::vector<const Value*> pending{&value};
+        while (!pending.empty() && count < limit) {
+            const auto& next = *pending.back();
+            pending.pop_back();
+            if (!next.IsBorrowed() || Is<Symbol>(next) || Is<EmptyList>(next)) {
+                continue;
+            }
+            ++count;
+            if (auto cell = As<Cell>(next)) {
+                pending.push_back(&cell->GetFirst());
+                pending.push_back(&cell->GetSecond());
+            } else if (!Is<BigNumber>(next)) {
+                return limit;
+            }
+        }
+        return count;
+    }
+}  // namespace
+
+Arena::Scope::Scope(Arena* arena) : previous_(current_arena) {
+    current_arena = arena;
+}
+
+Arena::Scope::~Scope() {
+    current_arena = previous_;
+}
+
+Arena::~Arena() {
+    for (auto object : objects_) {
+        object->~Object();
+    }
+}
+
+Arena* Arena::Current() {
+    return current_arena;
+}
+
+size_t Arena::CountBytes() const {
+    return bytes_;
+}
+
+size_t Arena::CountObjects() const {
+    return objects_.size();
+}
+
+size_t Arena::Sweep() {
+    auto live = objects_.begin();
+    for (auto object : objects_) {
+        if (object->IsMarked()) {
+            *live++ = object;
+        } else {
+            object->~Object();
+        }
+    }
+    size_t swept = objects_.end() - live;
+    objects_.erase(live, objects_.end());
+    return swept;
+}
+
+bool Arena::CopyOut(Value* value) {
+    if (!pinned_) {
+        auto budget = objects_.size() / 4 - std::min(objects_.size() / 4, copied_objects_);
+        auto left = budget;
+        if (auto copy = TryPromote(*value, &left)) {
+            copied_objects_ += budget - left;
+            *value = std::move(*copy);
+            return true;
+        }
+    }
+    pinned_ = true;
+    return false;
+}
+
+std::optional<Value> TryPromote(const Value& value, size_t* budget) {
+    // Copies made so far by the original, so shared parts stay shared, and the cells whose
+    // elements are still to be copied.
+    if (budget && CountCopies(value, *budget + 1) > *budget) {
+        return std::nullopt;
+    }
+    std::unordered_map<const Object*, Value> copies;
+    std::vector<std::pair<const Cell*, Cell*>> pending;
+    bool promotable = true;
+    auto copy = [&](const Value& original) {
+        if (!original.IsBorrowed() || Is<Symbol>(original) || Is<EmptyList>(original)) {
+            return original;
+        }
+        auto& result = copies[original.Get()];
+        if (result) {
+            return result;
+        }
+        if (budget) {
+            if (*budget == 0) {
+                promotable = false;
+                return result;
+            }
+            --*budget;
+        }
+        if (auto number = As<BigNumber>(original)) {
+            auto copied = MakeRef<BigNumber>(number->GetValue());
+            copied->ShareAcrossThreads();
+            result = std::move(copied);
+        } else if (auto cell = As<Cell>(original)) {
+            auto copied = MakeRef<Cell>();
+            copied->ShareAcrossThreads();
+            pending.emplace_back(cell, copied.Get());
+            result = std::move(copied);
+        } else {
+            promotable = false;
+        }
+        return result;
+    };
+
+    auto result = copy(value);
+    while (promotable && !pending.empty()) {
+        auto [original, copied] = pending.back();
+        pending.pop_back();
+        copied->SetFirst(copy(original->GetFirst()));
+        copied->SetSecond(copy(original->GetSecond()));
+    }
+    if (!promotable) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+Value Promote(const Value& value) {
+    auto result = TryPromote(value);
+    if (!result) {
+        throw RuntimeError{"Can not promote object"};
+    }
+    return std::move(*result);
+}
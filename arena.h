@@ -0,0 +1,87 @@
+#pragma once
+
+#include <memory_resource>
+#include <optional>
+#include <vector>
+#include "object.h"
+
+// Region that owns every object allocated while it is current. Objects are handed out as
+// non-owning Values, so copying them costs no reference counting, and they are all destroyed
+// and freed together when the arena goes away, unless a Heap adopts the arena and collects
+// them one by one. Anything else that must outlive the arena has to be Promote()d first.
+class Arena {
+public:
+    class Scope {
+    public:
+        explicit Scope(Arena* arena);
+
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Arena* previous_;
+    };
+
+    Arena() = default;
+
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    static Arena* Current();
+
+    template <class T, class... Args>
+    Value Make(Args&&... args) {
+        void* memory = resource_.allocate(sizeof(T), alignof(T));
+        auto object = new (memory) T(std::forward<Args>(args)...);
+        objects_.push_back(object);
+        bytes_ += sizeof(T);
+        return Value::Borrow(object);
+    }
+
+    // Bytes of the objects made so far, including any destroyed by Sweep.
+    size_t CountBytes() const;
+
+    // Objects still alive.
+    size_t CountObjects() const;
+
+    // Destroys the objects that are not marked and returns how many there were. Their memory
+    // is only released with the arena.
+    size_t Sweep();
+
+    // Called when value, which may be borrowed from this arena, is about to be stored where
+    // something older than the arena can reach it. Replaces value with a heap copy while that
+    // is cheap next to keeping the arena alive: nothing stored before has pinned the arena, and
+    // the copies made so far come to at most a quarter of its objects. Otherwise pins the arena
+    // and gives false.
+    bool CopyOut(Value* value);
+
+private:
+    std::pmr::monotonic_buffer_resource resource_;
+    std::vector<Object*> objects_;
+    size_t bytes_ = 0;
+    size_t copied_objects_ = 0;
+    bool pinned_ = false;
+};
+
+// Allocates in the current arena, or on the heap when there is none.
+template <class T, class... Args>
+Value New(Args&&... args) {
+    RunBudget::ChargeBytes(sizeof(T));
+    if (auto arena = Arena::Current()) {
+        return arena->Make<T>(std::forward<Args>(args)...);
+    }
+    return MakeRef<T>(std::forward<Args>(args)...);
+}
+
+// Deep-copies the arena-owned parts of value onto the heap. Works without recursion. The copies
+// are shared across threads.
+Value Promote(const Value& value);
+
+// Like Promote, but gives nothing rather than throwing when value holds an arena-owned object
+// other than a cell or a big number, such as a vector. With a budget, it also gives nothing
+// rather than copy more than *budget objects, and takes what it copied off *budget.
+std::optional<Value> TryPromote(const Value& value, size_t* budget = nullptr);
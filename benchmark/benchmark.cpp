@@ -0,0 +1,689 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "arena.h"
+#include "object.h"
+#include "parser.h"
+#include "resolver.h"
+#include "scheme.h"
+#include "tokenizer.h"
+#include "vm.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Heap allocations of the whole process, counted by the replacements of operator new below.
+// Arenas take their memory in large blocks, so objects made in one show up only as those.
+std::atomic<size_t> allocations{0};
+std::atomic<size_t> allocated_bytes{0};
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (auto memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+    // Nested arithmetic with `width` operands per call and `depth` levels of nesting.
+    std::string MakeArithmetic(size_t width, size_t depth) {
+        if (depth == 0) {
+            return "1";
+        }
+        std::string expr = "(+";
+        for (size_t i = 0; i < width; ++i) {
+            expr += ' ';
+            expr += MakeArithmetic(width, depth - 1);
+        }
+        return expr + ')';
+    }
+
+    // Quoted list of `length` small sublists.
+    std::string MakeQuotedData(size_t length) {
+        std::string expr = "'(";
+        for (size_t i = 0; i < length; ++i) {
+            expr += "(" + std::to_string(i) + " x #t) ";
+        }
+        return expr + ')';
+    }
+
+    // (< 0 1 ... length-1), which holds, so every operand is compared.
+    std::string MakeComparisons(size_t length) {
+        std::string expr = "(<";
+        for (size_t i = 0; i < length; ++i) {
+            expr += ' ' + std::to_string(i);
+        }
+        return expr + ')';
+    }
+
+    // (list-tail (list 0 1 ... length-1) length/2) wrapped in car.
+    std::string MakeListWork(size_t length) {
+        std::string expr = "(car (list-tail (list";
+        for (size_t i = 0; i < length; ++i) {
+            expr += ' ' + std::to_string(i);
+        }
+        return expr + ") " + std::to_string(length / 2) + "))";
+    }
+
+    // A library of `rules` definitions, each a small function and a quoted table.
+    std::string MakeLibrary(size_t rules) {
+        std::string library;
+        for (size_t i = 0; i < rules; ++i) {
+            auto name = std::to_string(i);
+            library += "(define (rule-" + name + " x) (if (< x " + name + ") (+ x " + name +
+                       ") (* x 2)))\n(define table-" + name + " '(";
+            for (size_t j = 0; j < 20; ++j) {
+                library += "(" + std::to_string(i * j) + " limit-" + std::to_string(j) + " #t) ";
+            }
+            library += "))\n";
+        }
+        return library;
+    }
+
+    // (0 1 ... length-1), unquoted.
+    std::string MakeNumbers(size_t length) {
+        std::string list = "(";
+        for (size_t i = 0; i < length; ++i) {
+            list += std::to_string(i) + ' ';
+        }
+        return list + ')';
+    }
+
+    // Defines xs as the list (0 1 ... length-1) and xv as a vector of the same numbers.
+    std::string MakeSequences(size_t length) {
+        std::string list = "'(";
+        for (size_t i = 0; i < length; ++i) {
+            list += std::to_string(i) + ' ';
+        }
+        list += ')';
+        return "(define xs " + list + ") (define xv (list->vector " + list + "))";
+    }
+
+    // `open` repeated `depth` times around `leaf`, each closed by one bracket.
+    std::string MakeNested(const std::string& open, const std::string& leaf, size_t depth) {
+        std::string expr;
+        expr.reserve(depth * (open.size() + 1) + leaf.size());
+        for (size_t i = 0; i < depth; ++i) {
+            expr += open;
+        }
+        expr += leaf;
+        return expr.append(depth, ')');
+    }
+
+    size_t CountNodes(const Value& ast) {
+        auto cell = As<Cell>(ast);
+        if (!cell) {
+            return 1;
+        }
+        return CountNodes(cell->GetFirst()) + CountNodes(cell->GetSecond());
+    }
+
+    const char* GetModeName(ExecutionMode mode) {
+        return mode == ExecutionMode::BYTECODE ? "/bytecode" : "/tree";
+    }
+
+    // Time, heap allocations and allocated bytes of one benchmark, per operation. What an
+    // operation is (a node, a call, a token...) depends on the benchmark and is named by op.
+    struct Result {
+        std::string name;
+        std::string op;
+        size_t ops;
+        double ns_per_op;
+        double allocations_per_op;
+        double bytes_per_op;
+    };
+
+    // Runs the benchmarks whose names contain the filter, prints each result as it is ready
+    // and keeps them for the machine-readable report.
+    class Suite {
+    public:
+        explicit Suite(std::string filter) : filter_(std::move(filter)) {
+        }
+
+        // Benchmarks check this before their setup, which can take longer than the run.
+        bool Selects(const std::string& name) const {
+            return name.find(filter_) != std::string::npos;
+        }
+
+        // Times run, which performs `ops` operations of the kind named by op. The note goes to
+        // the printed line only.
+        template <class Run>
+        void Measure(const std::string& name, const std::string& op, size_t ops, Run&& run,
+                     const std::string& note = {}) {
+            auto allocations_before = allocations.load(std::memory_order_relaxed);
+            auto bytes_before = allocated_bytes.load(std::memory_order_relaxed);
+            auto start = std::chrono::steady_clock::now();
+            run();
+            std::chrono::duration<double, std::nano> elapsed =
+                    std::chrono::steady_clock::now() - start;
+            auto allocations_made = allocations.load(std::memory_order_relaxed) -
+                                    allocations_before;
+            auto bytes = allocated_bytes.load(std::memory_order_relaxed) - bytes_before;
+
+            ops = std::max<size_t>(ops, 1);
+            const auto& result = results_.emplace_back(Result{
+                    name, op, ops, elapsed.count() / ops,
+                    static_cast<double>(allocations_made) / ops, static_cast<double>(bytes) / ops});
+            std::cout << name << ": " << result.ns_per_op << " ns/op, "
+                      << result.allocations_per_op << " allocs/op, " << result.bytes_per_op
+                      << " bytes/op (op = " << op << ", " << ops << " ops"
+                      << (note.empty() ? "" : ", ") << note << ")" << std::endl;
+        }
+
+        // One JSON object with the results in the order they were measured.
+        void WriteJson(std::ostream* out) const {
+            *out << std::fixed << std::setprecision(3) << "{\n  \"time\": " << std::time(nullptr) << ",\n  \"threads\": "
+                 << std::thread::hardware_concurrency() << ",\n  \"benchmarks\": [";
+            for (size_t i = 0; i < results_.size(); ++i) {
+                const auto& result = results_[i];
+                // Names and ops are plain ASCII without quotes or backslashes.
+                *out << (i ? "," : "") << "\n    {\"name\": \"" << result.name
+                     << "\", \"op\": \"" << result.op << "\", \"ops\": " << result.ops
+                     << ", \"ns_per_op\": " << result.ns_per_op
+                     << ", \"allocs_per_op\": " << result.allocations_per_op
+                     << ", \"bytes_per_op\": " << result.bytes_per_op << "}";
+            }
+            *out << "\n  ]\n}\n";
+        }
+
+    private:
+        std::string filter_;
+        std::vector<Result> results_;
+    };
+
+    void BenchmarkEvaluate(Suite* suite, const std::string& name, const std::string& source,
+                           size_t iterations, ExecutionMode mode) {
+        auto full_name = name + GetModeName(mode);
+        if (!suite->Selects(full_name)) {
+            return;
+        }
+        Arena arena;
+        Arena::Scope scope{&arena};
+        std::stringstream ss{source};
+        Tokenizer tokenizer{&ss};
+        auto ast = Read(&tokenizer);
+        size_t nodes = CountNodes(ast);
+        GlobalEnvironment globals;
+        auto resolved = Resolve(ast, &globals);
+        auto program = Compile(ast, &globals);
+        VirtualMachine vm;
+
+        suite->Measure(full_name, "node", iterations * nodes, [&] {
+            for (size_t i = 0; i < iterations; ++i) {
+                if (mode == ExecutionMode::BYTECODE) {
+                    vm.Execute(*program);
+                } else {
+                    Evaluate(resolved);
+                }
+            }
+        });
+    }
+
+    // Applies the builtin `name` to already evaluated arguments, leaving out the evaluator.
+    void BenchmarkBuiltin(Suite* suite, const std::string& name, size_t width,
+                          size_t iterations) {
+        auto full_name = "builtin/" + name + "/" + std::to_string(width);
+        if (!suite->Selects(full_name)) {
+            return;
+        }
+        std::vector<Value> args;
+        for (size_t i = 0; i < width; ++i) {
+            args.push_back(Value::FromNumber(name == "=" ? 7 : i * 7919 % 100003));
+        }
+        auto function = FindBuiltin(InternSymbol(name))->function;
+
+        suite->Measure(full_name, "operand", iterations * width, [&] {
+            for (size_t i = 0; i < iterations; ++i) {
+                function->Apply(args);
+            }
+        });
+    }
+
+    // Prints the datum read from source into a reused string and into a stream.
+    void BenchmarkSerialize(Suite* suite, const std::string& name, const std::string& source,
+                            size_t iterations) {
+        if (!suite->Selects(name)) {
+            return;
+        }
+        Arena arena;
+        Arena::Scope scope{&arena};
+        Tokenizer tokenizer{std::string_view(source)};
+        auto datum = Read(&tokenizer);
+        std::string buffer;
+        std::ostringstream stream;
+
+        for (bool use_stream : {false, true}) {
+            suite->Measure(name + (use_stream ? "/stream" : "/string"), "serialize", iterations,
+                           [&] {
+                               for (size_t i = 0; i < iterations; ++i) {
+                                   if (use_stream) {
+                                       stream.str({});
+                                       SerializeTo(datum, &stream);
+                                   } else {
+                                       buffer.clear();
+                                       SerializeTo(datum, &buffer);
+                                   }
+                               }
+                           },
+                           std::to_string(source.size()) + " bytes");
+        }
+    }
+
+    // Reads the datum in source, or with read_list, the rest of the list it opens.
+    void BenchmarkRead(Suite* suite, const std::string& name, const std::string& source,
+                       size_t iterations, bool use_arena, bool read_list = false) {
+        if (!suite->Selects(name)) {
+            return;
+        }
+        suite->Measure(name, "read", iterations,
+                       [&] {
+                           for (size_t i = 0; i < iterations; ++i) {
+                               Arena arena;
+                               Arena::Scope scope{use_arena ? &arena : nullptr};
+                               Tokenizer tokenizer{std::string_view(source)};
+                               if (read_list) {
+                                   tokenizer.Next();
+                                   ReadList(&tokenizer);
+                               } else {
+                                   Read(&tokenizer);
+                               }
+                           }
+                       },
+                       std::to_string(source.size()) + " bytes");
+    }
+
+    void BenchmarkTokenize(Suite* suite, const std::string& name, const std::string& source,
+                           size_t iterations, bool use_stream) {
+        if (!suite->Selects(name)) {
+            return;
+        }
+        size_t tokens = 0;
+        for (Tokenizer tokenizer{std::string_view(source)}; !tokenizer.IsEnd();
+             tokenizer.Next()) {
+            ++tokens;
+        }
+
+        suite->Measure(name, "token", iterations * tokens,
+                       [&] {
+                           for (size_t i = 0; i < iterations; ++i) {
+                               std::stringstream ss{source};
+                               auto tokenizer = use_stream ? Tokenizer{&ss}
+                                                           : Tokenizer{std::string_view(source)};
+                               for (; !tokenizer.IsEnd(); tokenizer.Next()) {
+                               }
+                           }
+                       },
+                       std::to_string(source.size()) + " bytes");
+    }
+
+    // Runs `call` after evaluating the definitions in `setup`.
+    void BenchmarkCall(Suite* suite, const std::string& name, const std::string& setup,
+                       const std::string& call, size_t iterations, ExecutionMode mode) {
+        auto full_name = name + GetModeName(mode);
+        if (!suite->Selects(full_name)) {
+            return;
+        }
+        Interpreter interpreter{mode};
+        std::stringstream ss{setup};
+        interpreter.RunStream(&ss, [](const std::string&) {});
+
+        suite->Measure(full_name, "call", iterations, [&] {
+            for (size_t i = 0; i < iterations; ++i) {
+                interpreter.Run(call);
+            }
+        });
+    }
+
+    // Runs source, nested `depth` levels deep, through the whole interpreter.
+    void BenchmarkDepth(Suite* suite, const std::string& name, const std::string& source,
+                        size_t depth, ExecutionMode mode) {
+        auto full_name = name + "/" + std::to_string(depth) + GetModeName(mode);
+        if (!suite->Selects(full_name)) {
+            return;
+        }
+        Interpreter interpreter{mode};
+        interpreter.SetMaxDepth(depth + 1);
+        size_t iterations = std::max<size_t>(1, 1000000 / depth);
+
+        suite->Measure(full_name, "level", iterations * depth, [&] {
+            for (size_t i = 0; i < iterations; ++i) {
+                interpreter.Run(source);
+            }
+        });
+    }
+
+    // Runs source over and over with the memo cache holding `capacity` results.
+    void BenchmarkMemo(Suite* suite, const std::string& name, const std::string& source,
+                       size_t iterations, size_t capacity) {
+        auto full_name = name + (capacity ? "/on" : "/off");
+        if (!suite->Selects(full_name)) {
+            return;
+        }
+        Interpreter interpreter;
+        interpreter.SetMemoCapacity(capacity);
+
+        suite->Measure(full_name, "run", iterations, [&] {
+            for (size_t i = 0; i < iterations; ++i) {
+                interpreter.Run(source);
+            }
+        });
+    }
+
+    // Runs call over and over with the interpreter's stats on or off, which is what counting
+    // every evaluation step, builtin call and object costs.
+    void BenchmarkStats(Suite* suite, const std::string& name, const std::string& setup,
+                        const std::string& call, size_t iterations, bool enabled) {
+        auto full_name = name + (enabled ? "/on" : "/off");
+        if (!suite->Selects(full_name)) {
+            return;
+        }
+        Interpreter interpreter;
+        interpreter.SetStatsEnabled(enabled);
+        std::stringstream ss{setup};
+        interpreter.RunStream(&ss, [](const std::string&) {});
+
+        suite->Measure(full_name, "call", iterations, [&] {
+            for (size_t i = 0; i < iterations; ++i) {
+                interpreter.Run(call);
+            }
+        });
+    }
+
+    // Runs call over and over with or without generous run limits and a cancellation token,
+    // which is what their accounting costs.
+    void BenchmarkLimits(Suite* suite, const std::string& name, const std::string& setup,
+                         const std::string& call, size_t iterations, bool enabled) {
+        auto full_name = name + (enabled ? "/on" : "/off");
+        if (!suite->Selects(full_name)) {
+            return;
+        }
+        Interpreter interpreter;
+        if (enabled) {
+            RunLimits limits;
+            limits.max_steps = UINT64_MAX / 2;
+            limits.max_bytes = UINT64_MAX / 2;
+            limits.timeout = std::chrono::hours{1};
+            interpreter.SetRunLimits(limits);
+            interpreter.SetCancellationToken(std::make_shared<CancellationToken>());
+        }
+        std::stringstream ss{setup};
+        interpreter.RunStream(&ss, [](const std::string&) {});
+
+        suite->Measure(full_name, "call", iterations, [&] {
+            for (size_t i = 0; i < iterations; ++i) {
+                interpreter.Run(call);
+            }
+        });
+    }
+
+    // Runs call over and over after setup, each time through the interpreter, which allocates
+    // in arenas and collects those a definition kept alive once nothing refers to them, or, for
+    // comparison, outside any arena, where every object is reference counted.
+    void BenchmarkGarbage(Suite* suite, const std::string& name, const std::string& setup,
+                          const std::string& call, size_t iterations, bool refcount) {
+        auto full_name = name + (refcount ? "/refcount" : "/collect");
+        if (!suite->Selects(full_name)) {
+            return;
+        }
+        if (refcount) {
+            GlobalEnvironment globals;
+            // The definitions of setup borrow from its forms.
+            std::vector<Value> forms;
+            std::stringstream ss{setup};
+            Tokenizer tokenizer{&ss};
+            while (!tokenizer.IsEnd()) {
+                forms.push_back(Read(&tokenizer));
+                forms.push_back(Resolve(forms.back(), &globals));
+                Evaluate(forms.back());
+            }
+            suite->Measure(full_name, "call", iterations, [&] {
+                for (size_t i = 0; i < iterations; ++i) {
+                    std::stringstream ss{call};
+                    Tokenizer tokenizer{&ss};
+                    Evaluate(Resolve(Read(&tokenizer), &globals));
+                }
+            });
+            return;
+        }
+        Interpreter interpreter;
+        std::stringstream ss{setup};
+        interpreter.RunStream(&ss, [](const std::string&) {});
+
+        suite->Measure(full_name, "call", iterations, [&] {
+            for (size_t i = 0; i < iterations; ++i) {
+                interpreter.Run(call);
+            }
+        });
+        auto heap = interpreter.GetHeapStats();
+        std::cout << "  heap: " << heap.bytes << " bytes in " << heap.arenas << " arenas, "
+                  << heap.collections << " collections, max pause "
+                  << heap.max_pause_nanoseconds / 1000 << " us" << std::endl;
+    }
+
+    // Starts a fresh interpreter and loads `library` into it, from the script and from its image.
+    void BenchmarkStartup(Suite* suite, const std::string& name, const std::string& library,
+                          size_t iterations) {
+        if (!suite->Selects(name)) {
+            return;
+        }
+        auto directory = std::filesystem::temp_directory_path();
+        auto script = (directory / "scheme-benchmark.scm").string();
+        auto image = (directory / "scheme-benchmark.img").string();
+        std::ofstream{script} << library;
+        Interpreter{}.SaveImage(script, image);
+
+        for (bool from_image : {false, true}) {
+            auto size = std::filesystem::file_size(from_image ? image : script);
+            suite->Measure(name + (from_image ? "/image" : "/source"), "start", iterations,
+                           [&] {
+                               for (size_t i = 0; i < iterations; ++i) {
+                                   Interpreter interpreter;
+                                   auto ignore = [](const std::string&) {};
+                                   if (from_image) {
+                                       interpreter.RunImage(image, ignore);
+                                   } else {
+                                       interpreter.RunFileStream(script, ignore);
+                                   }
+                               }
+                           },
+                           std::to_string(size) + " bytes");
+        }
+        std::remove(script.c_str());
+        std::remove(image.c_str());
+    }
+
+    void BenchmarkBatch(Suite* suite, const std::string& name, size_t expressions,
+                        size_t threads) {
+        auto full_name = name + "/" + std::to_string(threads);
+        if (!suite->Selects(full_name)) {
+            return;
+        }
+        std::vector<std::string> sources;
+        for (size_t i = 0; i < expressions; ++i) {
+            sources.push_back("(+ " + std::to_string(i) + " (* 2 3) (max 1 2 3) (car '(1 2)))");
+        }
+        Interpreter interpreter;
+
+        suite->Measure(full_name, "expression", expressions,
+                       [&] { interpreter.RunBatch(sources, threads); });
+    }
+}  // namespace
+
+// Usage: SchemeBenchmark [--filter SUBSTRING] [--json PATH]
+// Runs the benchmarks whose names contain SUBSTRING, all of them by default, and with --json
+// also writes their results to PATH ("-" for standard output) to compare runs over time.
+int main(int argc, char** argv) {
+    std::string filter;
+    std::string json_path;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if ((arg == "--filter" || arg == "--json") && i + 1 < argc) {
+            (arg == "--filter" ? filter : json_path) = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--filter SUBSTRING] [--json PATH]\n";
+            return 2;
+        }
+    }
+    Suite suite{filter};
+    std::cout << std::fixed << std::setprecision(1);
+
+    for (auto mode : {ExecutionMode::TREE_WALK, ExecutionMode::BYTECODE}) {
+        BenchmarkEvaluate(&suite, "evaluate/flat", MakeArithmetic(1000, 1), 2000, mode);
+        BenchmarkEvaluate(&suite, "evaluate/nested", MakeArithmetic(4, 7), 200, mode);
+        BenchmarkEvaluate(&suite, "evaluate/list", MakeListWork(1000), 200, mode);
+        BenchmarkEvaluate(&suite, "evaluate/two-args", MakeArithmetic(2, 12), 20, mode);
+        BenchmarkEvaluate(&suite, "evaluate/compare", MakeComparisons(1000), 2000, mode);
+        BenchmarkCall(&suite, "call/fib",
+                      "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))",
+                      "(fib 20)", 20, mode);
+        BenchmarkCall(&suite, "call/closure",
+                      "(define (count-down n) (let ((step (lambda (k) (- k 1))))"
+                      " (if (= n 0) 0 (count-down (step n)))))",
+                      "(count-down 1000)", 200, mode);
+        BenchmarkCall(&suite, "call/factorial",
+                      "(define (fact n) (if (= n 0) 1 (* n (fact (- n 1)))))", "(fact 1000)", 20,
+                      mode);
+        BenchmarkCall(&suite, "call/bignum-multiply", "(define a " + std::string(5000, '7') + ")",
+                      "(< (* a a) 0)", 20, mode);
+        BenchmarkCall(&suite, "call/list-ref",
+                      MakeSequences(1000) +
+                              " (define (walk i acc) (if (= i 1000) acc"
+                              " (walk (+ i 1) (+ acc (list-ref xs i)))))",
+                      "(walk 0 0)", 20, mode);
+        BenchmarkCall(&suite, "call/list-tail",
+                      MakeSequences(1000) +
+                              " (define (walk i acc) (if (= i 1000) acc"
+                              " (walk (+ i 1) (+ acc (car (list-tail xs i))))))",
+                      "(walk 0 0)", 20, mode);
+        BenchmarkCall(&suite, "call/constant-subtrees",
+                      "(define (sum n acc) (if (= n 0) acc"
+                      " (sum (- n (- (* 2 3) 5)) (+ acc (max 5 7) (+ 1 2 (* 3 4))))))",
+                      "(sum 1000 0)", 200, mode);
+        BenchmarkCall(&suite, "call/short-circuit",
+                      "(define (slow n) (if (= n 0) #f (slow (- n 1))))"
+                      " (define (walk i) (if (= i 0) 0"
+                      " (if (and (< i 0) (slow 100)) 1 (walk (- i 1)))))",
+                      "(walk 1000)", 200, mode);
+        BenchmarkCall(&suite, "call/cons-chain",
+                      "(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))",
+                      "(car (build 10000 '()))", 20, mode);
+        BenchmarkCall(&suite, "call/car-cdr",
+                      MakeSequences(1000) +
+                              " (define (walk xs acc) (if (null? xs) acc"
+                              " (walk (cdr xs) (+ acc (car xs)))))",
+                      "(walk xs 0)", 20, mode);
+        BenchmarkCall(&suite, "call/vector-ref",
+                      MakeSequences(1000) +
+                              " (define (walk i acc) (if (= i 1000) acc"
+                              " (walk (+ i 1) (+ acc (vector-ref xv i)))))",
+                      "(walk 0 0)", 20, mode);
+        BenchmarkCall(&suite, "call/vector-sum", "(define v (make-vector 1000000 3))",
+                      "(vector-sum v)", 20, mode);
+        BenchmarkCall(&suite, "call/vector-map", "(define v (make-vector 100000 3))",
+                      "(vector-length (vector-map abs v))", 20, mode);
+    }
+    for (size_t capacity : {0, 1000}) {
+        BenchmarkMemo(&suite, "memo/bignum",
+                      "(< (* " + std::string(3000, '7') + " " + std::string(3000, '7') + ") 0)",
+                      100, capacity);
+        BenchmarkMemo(&suite, "memo/table", "(list-tail '" + MakeNumbers(1000) + " 999)", 1000,
+                      capacity);
+    }
+    for (bool enabled : {false, true}) {
+        BenchmarkStats(&suite, "stats/fib",
+                       "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))",
+                       "(fib 20)", 20, enabled);
+        BenchmarkLimits(&suite, "limits/fib",
+                        "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))",
+                        "(fib 20)", 20, enabled);
+        BenchmarkLimits(&suite, "limits/cons-chain",
+                        "(define (chain n acc) (if (= n 0) acc (chain (- n 1) (cons n acc))))",
+                        "(null? (chain 100000 '()))", 20, enabled);
+    }
+    for (bool refcount : {true, false}) {
+        BenchmarkGarbage(&suite, "garbage/redefine",
+                         "(define (chain n acc) (if (= n 0) acc (chain (- n 1) (cons n acc))))",
+                         "(define xs (chain 10000 '()))", 200, refcount);
+        BenchmarkGarbage(&suite, "garbage/temporary",
+                         "(define (chain n acc) (if (= n 0) acc (chain (- n 1) (cons n acc))))",
+                         "(car (chain 10000 '()))", 200, refcount);
+    }
+    for (size_t depth = 1000; depth <= 1000000; depth *= 10) {
+        for (auto mode : {ExecutionMode::TREE_WALK, ExecutionMode::BYTECODE}) {
+            BenchmarkDepth(&suite, "depth/arithmetic", MakeNested("(+ 1 ", "0", depth), depth,
+                           mode);
+            BenchmarkDepth(&suite, "depth/tail-call",
+                           "((lambda (loop) (loop loop " + std::to_string(depth) +
+                                   ")) (lambda (self n) (if (= n 0) n (self self (- n 1)))))",
+                           depth, mode);
+        }
+        BenchmarkDepth(&suite, "depth/quoted", "'" + MakeNested("(", "1", depth), depth,
+                       ExecutionMode::TREE_WALK);
+    }
+    for (const auto* name : {"+", "-", "*", "/", "max", "min", "=", "<", ">", "<=", ">="}) {
+        BenchmarkBuiltin(&suite, name, 2, 10000000);
+        BenchmarkBuiltin(&suite, name, 10000, 2000);
+    }
+    BenchmarkTokenize(&suite, "tokenize/stream", MakeQuotedData(10000), 50, true);
+    BenchmarkTokenize(&suite, "tokenize/view", MakeQuotedData(10000), 50, false);
+    BenchmarkTokenize(&suite, "tokenize/numbers", MakeNumbers(100000), 50, false);
+    BenchmarkSerialize(&suite, "serialize/list", MakeNumbers(1000000), 10);
+    BenchmarkSerialize(&suite, "serialize/nested", MakeNested("(", "1", 100000), 10);
+    BenchmarkSerialize(&suite, "serialize/quoted-data", MakeQuotedData(100000), 10);
+    BenchmarkRead(&suite, "read/heap", MakeQuotedData(10000), 50, false);
+    BenchmarkRead(&suite, "read/arena", MakeQuotedData(10000), 50, true);
+    BenchmarkRead(&suite, "read/list", MakeNumbers(100000), 50, true, true);
+    BenchmarkRead(&suite, "read/deep", MakeNested("(", "1", 100000), 50, true, true);
+    BenchmarkStartup(&suite, "startup", MakeLibrary(2000), 20);
+    for (size_t threads = 1; threads <= std::max(1u, std::thread::hardware_concurrency());
+         threads *= 2) {
+        BenchmarkBatch(&suite, "batch", 100000, threads);
+    }
+
+    if (json_path == "-") {
+        suite.WriteJson(&std::cout);
+    } else if (!json_path.empty()) {
+        std::ofstream out{json_path};
+        suite.WriteJson(&out);
+        if (!out) {
+            std::cerr << "Can not write " << json_path << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,362 @@
+#include <algorithm>
+#include "bigint.h"
+#include "error.h"
+
+namespace {
+    using Digits = std::vector<uint32_t>;
+
+    // Operands shorter than this, in digits, are multiplied the schoolbook way.
+    constexpr size_t kKaratsubaThreshold = 32;
+
+    constexpr uint32_t kDecimalBase = 1000000000;
+    constexpr size_t kDecimalDigits = 9;
+
+    void Trim(Digits* digits) {
+        while (!digits->empty() && digits->back() == 0) {
+            digits->pop_back();
+        }
+    }
+
+    int CompareMagnitudes(const Digits& lhs, const Digits& rhs) {
+        if (lhs.size() != rhs.size()) {
+            return lhs.size() < rhs.size() ? -1 : 1;
+        }
+        for (size_t i = lhs.size(); i-- > 0;) {
+            if (lhs[i] != rhs[i]) {
+                return lhs[i] < rhs[i] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    Digits AddMagnitudes(const Digits& lhs, const Digits& rhs) {
+        const Digits& longer = lhs.size() >= rhs.size() ? lhs : rhs;
+        const Digits& shorter = lhs.size() >= rhs.size() ? rhs : lhs;
+        Digits sum(longer.size() + 1);
+        uint64_t carry = 0;
+        for (size_t i = 0; i < longer.size(); ++i) {
+            carry += longer[i];
+            if (i < shorter.size()) {
+                carry += shorter[i];
+            }
+            sum[i] = static_cast<uint32_t>(carry);
+            carry >>= 32;
+        }
+        sum.back() = static_cast<uint32_t>(carry);
+        Trim(&sum);
+        return sum;
+    }
+
+    // lhs must not be smaller than rhs.
+    Digits SubtractMagnitudes(const Digits& lhs, const Digits& rhs) {
+        Digits difference(lhs.size());
+        int64_t borrow = 0;
+        for (size_t i = 0; i < lhs.size(); ++i) {
+            int64_t digit = static_cast<int64_t>(lhs[i]) - borrow;
+            if (i < rhs.size()) {
+                digit -= rhs[i];
+            }
+            borrow = digit < 0;
+            difference[i] = static_cast<uint32_t>(digit);
+        }
+        Trim(&difference);
+        return difference;
+    }
+
+    // Adds addend shifted left by `shift` digits to *sum, which must be long enough.
+    void AddShifted(Digits* sum, const Digits& addend, size_t shift) {
+        uint64_t carry = 0;
+        size_t i = 0;
+        for (; i < addend.size() || carry; ++i) {
+            carry += (*sum)[shift + i];
+            if (i < addend.size()) {
+                carry += addend[i];
+            }
+            (*sum)[shift + i] = static_cast<uint32_t>(carry);
+            carry >>= 32;
+        }
+    }
+
+    Digits MultiplySchoolbook(const Digits& lhs, const Digits& rhs) {
+        if (lhs.empty() || rhs.empty()) {
+            return {};
+        }
+        Digits product(lhs.size() + rhs.size());
+        for (size_t i = 0; i < lhs.size(); ++i) {
+            uint64_t carry = 0;
+            for (size_t j = 0; j < rhs.size(); ++j) {
+                carry += static_cast<uint64_t>(lhs[i]) * rhs[j] + product[i + j];
+                product[i + j] = static_cast<uint32_t>(carry);
+                carry >>= 32;
+            }
+            product[i + rhs.size()] = static_cast<uint32_t>(carry);
+        }
+        Trim(&product);
+        return product;
+    }
+
+    Digits Slice(const Digits& digits, size_t begin, size_t end) {
+        begin = std::min(begin, digits.size());
+        end = std::min(end, digits.size());
+        Digits slice(digits.begin() + begin, digits.begin() + end);
+        Trim(&slice);
+        return slice;
+    }
+
+    // With x = x1 * B + x0 and y = y1 * B + y0, x * y is
+    // x1 * y1 * B^2 + ((x0 + x1) * (y0 + y1) - x0 * y0 - x1 * y1) * B + x0 * y0,
+    // which takes three half-size products instead of four.
+    Digits MultiplyMagnitudes(const Digits& lhs, const Digits& rhs) {
+        if (std::min(lhs.size(), rhs.size()) < kKaratsubaThreshold) {
+            return MultiplySchoolbook(lhs, rhs);
+        }
+        size_t half = std::max(lhs.size(), rhs.size()) / 2;
+        auto lhs_low = Slice(lhs, 0, half);
+        auto lhs_high = Slice(lhs, half, lhs.size());
+        auto rhs_low = Slice(rhs, 0, half);
+        auto rhs_high = Slice(rhs, half, rhs.size());
+
+        auto low = MultiplyMagnitudes(lhs_low, rhs_low);
+        auto high = MultiplyMagnitudes(lhs_high, rhs_high);
+        auto middle = MultiplyMagnitudes(AddMagnitudes(lhs_low, lhs_high),
+                                         AddMagnitudes(rhs_low, rhs_high));
+        middle = SubtractMagnitudes(SubtractMagnitudes(middle, low), high);
+
+        Digits product(lhs.size() + rhs.size() + 1);
+        AddShifted(&product, low, 0);
+        AddShifted(&product, middle, half);
+        AddShifted(&product, high, 2 * half);
+        Trim(&product);
+        return product;
+    }
+
+    Digits DivideBySmall(const Digits& dividend, uint32_t divisor, uint32_t* remainder) {
+        Digits quotient(dividend.size());
+        uint64_t rest = 0;
+        for (size_t i = dividend.size(); i-- > 0;) {
+            rest = (rest << 32) | dividend[i];
+            quotient[i] = static_cast<uint32_t>(rest / divisor);
+            rest %= divisor;
+        }
+        Trim(&quotient);
+        if (remainder) {
+            *remainder = static_cast<uint32_t>(rest);
+        }
+        return quotient;
+    }
+
+    Digits ShiftLeft(const Digits& digits, int shift, size_t extra) {
+        Digits shifted(digits.size() + extra);
+        uint32_t carry = 0;
+        for (size_t i = 0; i < digits.size(); ++i) {
+            shifted[i] = (digits[i] << shift) | carry;
+            carry = shift ? digits[i] >> (32 - shift) : 0;
+        }
+        if (extra) {
+            shifted[digits.size()] = carry;
+        }
+        return shifted;
+    }
+
+    // Long division, Knuth's algorithm D.
+    Digits DivideMagnitudes(const Digits& dividend, const Digits& divisor) {
+        if (CompareMagnitudes(dividend, divisor) < 0) {
+            return {};
+        }
+        if (divisor.size() == 1) {
+            return DivideBySmall(dividend, divisor[0], nullptr);
+        }
+        // Normalizing makes the top digit of the divisor at least 2^31, so the estimated
+        // quotient digits are off by at most two.
+        int shift = __builtin_clz(divisor.back());
+        auto v = ShiftLeft(divisor, shift, 0);
+        auto u = ShiftLeft(dividend, shift, 1);
+        size_t n = v.size();
+        size_t m = dividend.size() - n;
+        Digits quotient(m + 1);
+        for (size_t j = m + 1; j-- > 0;) {
+            uint64_t numerator = (static_cast<uint64_t>(u[j + n]) << 32) | u[j + n - 1];
+            uint64_t estimate = numerator / v[n - 1];
+            uint64_t rest = numerator % v[n - 1];
+            while (estimate >> 32 || estimate * v[n - 2] > ((rest << 32) | u[j + n - 2])) {
+                --estimate;
+                rest += v[n - 1];
+                if (rest >> 32) {
+                    break;
+                }
+            }
+
+            int64_t borrow = 0;
+            uint64_t carry = 0;
+            for (size_t i = 0; i < n; ++i) {
+                uint64_t product = estimate * v[i] + carry;
+                carry = product >> 32;
+                int64_t digit = static_cast<int64_t>(u[i + j]) -
+                                static_cast<uint32_t>(product) - borrow;
+                u[i + j] = static_cast<uint32_t>(digit);
+                borrow = digit < 0;
+            }
+            int64_t top = static_cast<int64_t>(u[j + n]) - static_cast<int64_t>(carry) - borrow;
+            u[j + n] = static_cast<uint32_t>(top);
+            if (top < 0) {
+                // The estimate was one too large: add the divisor back.
+                --estimate;
+                uint64_t sum = 0;
+                for (size_t i = 0; i < n; ++i) {
+                    sum += static_cast<uint64_t>(u[i + j]) + v[i];
+                    u[i + j] = static_cast<uint32_t>(sum);
+                    sum >>= 32;
+                }
+                u[j + n] += static_cast<uint32_t>(sum);
+            }
+            quotient[j] = static_cast<uint32_t>(estimate);
+        }
+        Trim(&quotient);
+        return quotient;
+    }
+}  // namespace
+
+BigInt::BigInt(int64_t value) : negative_(value < 0) {
+    uint64_t magnitude = negative_ ? 0 - static_cast<uint64_t>(value) : value;
+    while (magnitude) {
+        magnitude_.push_back(static_cast<uint32_t>(magnitude));
+        magnitude >>= 32;
+    }
+}
+
+BigInt BigInt::Parse(std::string_view text) {
+    BigInt result;
+    bool negative = false;
+    if (!text.empty() && (text.front() == '+' || text.front() == '-')) {
+        negative = text.front() == '-';
+        text.remove_prefix(1);
+    }
+    if (text.empty()) {
+        throw SyntaxError{"Invalid Number"};
+    }
+    // Nine decimal digits at a time: multiply by 10^9 (or less for the first chunk) and add.
+    size_t chunk = text.size() % kDecimalDigits ? text.size() % kDecimalDigits : kDecimalDigits;
+    for (size_t begin = 0; begin < text.size(); begin += chunk, chunk = kDecimalDigits) {
+        uint32_t value = 0;
+        uint32_t scale = 1;
+        for (size_t i = begin; i < begin + chunk; ++i) {
+            if (text[i] < '0' || text[i] > '9') {
+                throw SyntaxError{"Invalid Number"};
+            }
+            value = value * 10 + (text[i] - '0');
+            scale *= 10;
+        }
+        uint64_t carry = value;
+        for (auto& digit : result.magnitude_) {
+            carry += static_cast<uint64_t>(digit) * scale;
+            digit = static_cast<uint32_t>(carry);
+            carry >>= 32;
+        }
+        if (carry) {
+            result.magnitude_.push_back(static_cast<uint32_t>(carry));
+        }
+    }
+    Trim(&result.magnitude_);
+    result.negative_ = negative && !result.magnitude_.empty();
+    return result;
+}
+
+bool BigInt::FitsInt64() const {
+    if (magnitude_.size() <= 1) {
+        return true;
+    }
+    if (magnitude_.size() > 2) {
+        return false;
+    }
+    uint64_t magnitude = (static_cast<uint64_t>(magnitude_[1]) << 32) | magnitude_[0];
+    return magnitude <= static_cast<uint64_t>(INT64_MAX) + negative_;
+}
+
+int64_t BigInt::ToInt64() const {
+    uint64_t magnitude = 0;
+    for (size_t i = magnitude_.size(); i-- > 0;) {
+        magnitude = (magnitude << 32) | magnitude_[i];
+    }
+    return static_cast<int64_t>(negative_ ? 0 - magnitude : magnitude);
+}
+
+size_t BigInt::Hash() const {
+    size_t hash = negative_;
+    for (auto digit : magnitude_) {
+        hash = hash * 0x100000001b3 ^ digit;
+    }
+    return hash;
+}
+
+std::string BigInt::ToString() const {
+    if (magnitude_.empty()) {
+        return "0";
+    }
+    // Peel off nine decimal digits at a time, least significant first.
+    std::vector<uint32_t> chunks;
+    auto rest = magnitude_;
+    while (!rest.empty()) {
+        uint32_t chunk;
+        rest = DivideBySmall(rest, kDecimalBase, &chunk);
+        chunks.push_back(chunk);
+    }
+    std::string text = negative_ ? "-" : "";
+    text += std::to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+        auto digits = std::to_string(chunks[i]);
+        text.append(kDecimalDigits - digits.size(), '0');
+        text += digits;
+    }
+    return text;
+}
+
+BigInt BigInt::operator-() const {
+    BigInt result = *this;
+    result.negative_ = !negative_ && !magnitude_.empty();
+    return result;
+}
+
+BigInt operator+(const BigInt& lhs, const BigInt& rhs) {
+    BigInt result;
+    if (lhs.negative_ == rhs.negative_) {
+        result.magnitude_ = AddMagnitudes(lhs.magnitude_, rhs.magnitude_);
+        result.negative_ = lhs.negative_;
+    } else if (CompareMagnitudes(lhs.magnitude_, rhs.magnitude_) >= 0) {
+        result.magnitude_ = SubtractMagnitudes(lhs.magnitude_, rhs.magnitude_);
+        result.negative_ = lhs.negative_;
+    } else {
+        result.magnitude_ = SubtractMagnitudes(rhs.magnitude_, lhs.magnitude_);
+        result.negative_ = rhs.negative_;
+    }
+    result.negative_ = result.negative_ && !result.magnitude_.empty();
+    return result;
+}
+
+BigInt operator-(const BigInt& lhs, const BigInt& rhs) {
+    return lhs + -rhs;
+}
+
+BigInt operator*(const BigInt& lhs, const BigInt& rhs) {
+    BigInt result;
+    result.magnitude_ = MultiplyMagnitudes(lhs.magnitude_, rhs.magnitude_);
+    result.negative_ = lhs.negative_ != rhs.negative_ && !result.magnitude_.empty();
+    return result;
+}
+
+BigInt operator/(const BigInt& lhs, const BigInt& rhs) {
+    if (rhs.magnitude_.empty()) {
+        throw RuntimeError{"Division by zero"};
+    }
+    BigInt result;
+    result.magnitude_ = DivideMagnitudes(lhs.magnitude_, rhs.magnitude_);
+    result.negative_ = lhs.negative_ != rhs.negative_ && !result.magnitude_.empty();
+    return result;
+}
+
+int Compare(const BigInt& lhs, const BigInt& rhs) {
+    if (lhs.negative_ != rhs.negative_) {
+        return lhs.negative_ ? -1 : 1;
+    }
+    int order = CompareMagnitudes(lhs.magnitude_, rhs.magnitude_);
+    return lhs.negative_ ? -order : order;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Arbitrary-precision integer. Only used once a result no longer fits in a fixnum, so it
+// favours simplicity over speed except for multiplication of long operands, which switches to
+// Karatsuba's algorithm.
+class BigInt {
+public:
+    BigInt() = default;
+
+    explicit BigInt(int64_t value);
+
+    // Optionally signed decimal digits. Throws SyntaxError on anything else.
+    static BigInt Parse(std::string_view text);
+
+    bool IsNegative() const {
+        return negative_;
+    }
+
+    bool FitsInt64() const;
+
+    // Memory taken by the digits.
+    size_t CountBytes() const {
+        return magnitude_.size() * sizeof(uint32_t);
+    }
+
+    // Only valid if FitsInt64().
+    int64_t ToInt64() const;
+
+    std::string ToString() const;
+
+    // Equal values hash equally.
+    size_t Hash() const;
+
+    BigInt operator-() const;
+
+    friend BigInt operator+(const BigInt& lhs, const BigInt& rhs);
+
+    friend BigInt operator-(const BigInt& lhs, const BigInt& rhs);
+
+    friend BigInt operator*(const BigInt& lhs, const BigInt& rhs);
+
+    // Truncates towards zero, like integer division in C++. Throws RuntimeError on zero.
+    friend BigInt operator/(const BigInt& lhs, const BigInt& rhs);
+
+    // Negative, zero or positive as lhs is less than, equal to or greater than rhs.
+    friend int Compare(const BigInt& lhs, const BigInt& rhs);
+
+private:
+    // Little-endian base 2^32 digits without leading zeros; zero has none and is never
+    // negative.
+    std::vector<uint32_t> magnitude_;
+    bool negative_ = false;
+};
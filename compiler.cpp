@@ -0,0 +1,429 @@
+#include "compiler.h"
+#include "arena.h"
+#include "resolver.h"
+
+namespace {
+    class Compiler {
+    public:
+        Compiler(std::shared_ptr<Program> program, GlobalEnvironment* globals)
+            : program_(std::move(program)) {
+            program_->globals = globals;
+        }
+
+        // Compiles the resolved expression, then the body of every lambda met on the way.
+        void Run(const Value& resolved) {
+            CompileAll({Work::Kind::EXPRESSION, resolved});
+            Emit(OpCode::HALT);
+            while (!lambdas_.empty()) {
+                auto lambda = lambdas_.back();
+                lambdas_.pop_back();
+                lambda->SetCode(program_, program_->code.size());
+                CompileAll({Work::Kind::BODY, Value::Borrow(lambda), true});
+            }
+        }
+
+    private:
+        // Pending compilation steps, run from the back. Nested expressions push their steps
+        // here instead of recursing, so deep nesting does not exhaust the native stack.
+        struct Work {
+            enum class Kind { EXPRESSION, ARGUMENT, LITERAL, BODY, EMIT, JUMP, BIND };
+
+            Kind kind;
+            // The node to compile, the value to push, or the lambda or let whose body to
+            // compile.
+            Value ast;
+            // Whether the code returns from the running closure once it is done with ast, or,
+            // for BIND, once jumped to.
+            bool tail = false;
+            // What EMIT and JUMP emit. A jump has its target first, then the operands.
+            OpCode op = OpCode::HALT;
+            uint32_t operands[2] = {0, 0};
+            uint32_t operand_count = 0;
+            // The label a jump goes to, or the one BIND places.
+            uint32_t label = 0;
+        };
+
+        void CompileAll(Work work) {
+            work_.push_back(std::move(work));
+            while (!work_.empty()) {
+                auto work = std::move(work_.back());
+                work_.pop_back();
+                Step(work);
+                // Steps list what follows them in order; it runs from the back.
+                work_.insert(work_.end(), std::make_move_iterator(next_.rbegin()),
+                             std::make_move_iterator(next_.rend()));
+                next_.clear();
+            }
+        }
+
+        void Step(const Work& work) {
+            switch (work.kind) {
+                case Work::Kind::EXPRESSION:
+                    StartExpression(work.ast, work.tail);
+                    return;
+                case Work::Kind::ARGUMENT:
+                    // Mirrors how Evaluate collects arguments: only code is evaluated.
+                    if (NeedsEvaluation(work.ast)) {
+                        StartExpression(work.ast, false);
+                    } else {
+                        Emit(OpCode::PUSH, AddConstant(work.ast));
+                    }
+                    return;
+                case Work::Kind::LITERAL:
+                    Emit(OpCode::PUSH, AddConstant(work.ast));
+                    EmitReturnIf(work.tail);
+                    return;
+                case Work::Kind::BODY:
+                    StartBody(work.ast, work.tail);
+                    return;
+                case Work::Kind::EMIT:
+                    Emit(work.op);
+                    for (uint32_t i = 0; i < work.operand_count; ++i) {
+                        program_->code.push_back(work.operands[i]);
+                    }
+                    return;
+                case Work::Kind::JUMP:
+                    Emit(work.op);
+                    labels_[work.label].push_back(program_->code.size());
+                    program_->code.push_back(0);
+                    for (uint32_t i = 0; i < work.operand_count; ++i) {
+                        program_->code.push_back(work.operands[i]);
+                    }
+                    return;
+                case Work::Kind::BIND: {
+                    const auto& jumps = labels_[work.label];
+                    for (auto position : jumps) {
+                        program_->code[position] = program_->code.size();
+                    }
+                    EmitReturnIf(work.tail && !jumps.empty());
+                    return;
+                }
+            }
+        }
+
+        // Mirrors Schedule.
+        void StartExpression(const Value& ast, bool tail) {
+            if (!ast) {
+                Emit(OpCode::RAISE_NOTHING);
+                return;
+            }
+            if (!NeedsEvaluation(ast)) {
+                if (Is<EmptyList>(ast)) {
+                    Emit(OpCode::RAISE_WRONG_TYPE);
+                    return;
+                }
+                Emit(OpCode::PUSH, AddConstant(ast));
+                EmitReturnIf(tail);
+                return;
+            }
+            auto node = ast.Get();
+            switch (node->GetType()) {
+                case ObjectType::VARIABLE:
+                    EmitLoad(*static_cast<const Variable*>(node));
+                    EmitReturnIf(tail);
+                    return;
+                case ObjectType::LAMBDA:
+                    lambdas_.push_back(static_cast<Lambda*>(node));
+                    Emit(OpCode::MAKE_CLOSURE, AddConstant(ast));
+                    EmitReturnIf(tail);
+                    return;
+                case ObjectType::CALL:
+                    StartCall(*static_cast<const Call*>(node), tail);
+                    return;
+                case ObjectType::APPLICATION:
+                    StartApplication(*static_cast<const Application*>(node), tail);
+                    return;
+                case ObjectType::FORM:
+                    StartForm(*static_cast<const Form*>(node), tail);
+                    return;
+                case ObjectType::DEFINE:
+                    StartDefine(*static_cast<const Define*>(node), tail);
+                    return;
+                case ObjectType::LET: {
+                    auto let = static_cast<const Let*>(node);
+                    uint32_t slot = let->GetFirstSlot();
+                    for (const auto& init : let->GetInits()) {
+                        Then({Work::Kind::EXPRESSION, init});
+                        ThenEmit(OpCode::STORE_FRAME, slot++);
+                    }
+                    Then({Work::Kind::BODY, ast, tail});
+                    return;
+                }
+                case ObjectType::CELL: {
+                    // Resolve only leaves quoted lists.
+                    auto cell = static_cast<Cell*>(node);
+                    auto head = As<Symbol>(cell->GetFirst());
+                    if (head && head->GetId() == kQuoteSymbol) {
+                        Emit(OpCode::PUSH, AddConstant(QuoteOperands(cell->GetSecond())));
+                        EmitReturnIf(tail);
+                        return;
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+            Emit(OpCode::EVALUATE, AddConstant(ast));
+            EmitReturnIf(tail);
+        }
+
+        void EmitLoad(const Variable& variable) {
+            const auto& address = variable.GetAddress();
+            if (auto global = variable.GetGlobal()) {
+                program_->global_slots.push_back(global);
+                Emit(OpCode::LOAD_GLOBAL, program_->global_slots.size() - 1, variable.GetName());
+            } else if (address.boxed) {
+                Emit(OpCode::LOAD_BOXED, AddAddress(address), variable.GetName());
+            } else if (address.scope == Address::Scope::FRAME) {
+                Emit(OpCode::LOAD_FRAME, address.index, variable.GetName());
+            } else {
+                Emit(OpCode::LOAD_CLOSURE, address.index, variable.GetName());
+            }
+        }
+
+        // The forms of a lambda or let body, the last one in tail position if the body is.
+        void StartBody(const Value& ast, bool tail) {
+            const auto& body = Is<Lambda>(ast) ? As<Lambda>(ast)->GetBody()
+                                               : As<Let>(ast)->GetBody();
+            if (body.environment_size) {
+                Emit(OpCode::MAKE_ENVIRONMENT, body.environment_slot, body.environment_size);
+            }
+            ThenSequence(body.forms, 0, body.forms.size(), tail);
+        }
+
+        void StartCall(const Call& call, bool tail) {
+            const auto& args = call.GetArgs();
+            auto builtin = call.GetBuiltin();
+            if (!call.IsArityValid()) {
+                // Applying the name checks the count and reports it.
+                Emit(OpCode::PUSH, AddConstant(Symbol::Intern(builtin->name)));
+            }
+            for (const auto& arg : args) {
+                Then({Work::Kind::ARGUMENT, arg});
+            }
+            if (call.IsArityValid()) {
+                program_->functions.push_back(builtin);
+                ThenEmit(OpCode::CALL_BUILTIN, program_->functions.size() - 1, args.size());
+            } else {
+                ThenEmit(OpCode::CALL, args.size());
+            }
+            ThenReturnIf(tail);
+        }
+
+        // The operator is only known at run time and may still turn out to be quote, unless it
+        // is a lambda.
+        void StartApplication(const Application& application, bool tail) {
+            const auto& op = application.GetOperator();
+            const auto& args = application.GetArgs();
+            bool may_be_quote = !Is<Lambda>(op);
+            auto quoted = NewLabel();
+            Then({Work::Kind::EXPRESSION, op});
+            if (may_be_quote) {
+                ThenJump(OpCode::QUOTE_BRANCH, quoted,
+                         AddConstant(QuoteOperands(application.GetOperands())));
+            }
+            for (const auto& arg : args) {
+                Then({Work::Kind::ARGUMENT, arg});
+            }
+            ThenEmit(tail ? OpCode::TAIL_CALL : OpCode::CALL, args.size());
+            if (may_be_quote) {
+                Then(Bind(quoted, tail));
+            }
+        }
+
+        // Mirrors the next function of each special form.
+        void StartForm(const Form& form, bool tail) {
+            const auto& operands = form.GetOperands();
+            auto end = NewLabel();
+            switch (form.GetSpecialForm()->name) {
+                case kIfSymbol: {
+                    auto alternative = NewLabel();
+                    Then({Work::Kind::EXPRESSION, operands[0]});
+                    ThenJump(OpCode::JUMP_IF_FALSE, alternative);
+                    Then({Work::Kind::EXPRESSION, operands[1], tail});
+                    ThenJumpUnless(tail, end);
+                    Then(Bind(alternative));
+                    if (operands.size() == 3) {
+                        Then({Work::Kind::EXPRESSION, operands[2], tail});
+                    } else {
+                        Then({Work::Kind::LITERAL, EmptyList::Get(), tail});
+                    }
+                    break;
+                }
+                case kAndSymbol:
+                    if (operands.empty()) {
+                        Then({Work::Kind::LITERAL, Value::FromBoolean(true), tail});
+                        break;
+                    }
+                    for (size_t i = 0; i + 1 < operands.size(); ++i) {
+                        Then({Work::Kind::EXPRESSION, operands[i]});
+                        ThenJump(OpCode::JUMP_IF_FALSE_OR_POP, end);
+                    }
+                    Then({Work::Kind::EXPRESSION, operands.back(), tail});
+                    break;
+                case kOrSymbol:
+                    for (const auto& operand : operands) {
+                        Then({Work::Kind::EXPRESSION, operand});
+                        ThenJump(OpCode::JUMP_IF_TRUE_OR_POP, end, 1);
+                    }
+                    Then({Work::Kind::LITERAL, Value::FromBoolean(false), tail});
+                    break;
+                case kWhenSymbol: {
+                    auto skip = NewLabel();
+                    Then({Work::Kind::EXPRESSION, operands[0]});
+                    ThenJump(OpCode::JUMP_IF_FALSE, skip);
+                    ThenSequence(operands, 1, operands.size(), tail);
+                    ThenJumpUnless(tail, end);
+                    Then(Bind(skip));
+                    Then({Work::Kind::LITERAL, EmptyList::Get(), tail});
+                    break;
+                }
+                case kCondSymbol: {
+                    const auto& clauses = form.GetClauses();
+                    for (size_t i = 0; i < clauses.size(); ++i) {
+                        size_t first = clauses[i] + 1;
+                        size_t last = i + 1 < clauses.size() ? clauses[i + 1] : operands.size();
+                        Then({Work::Kind::EXPRESSION, operands[clauses[i]]});
+                        if (first == last) {
+                            // A clause with a test only evaluates to the value of the test.
+                            ThenJump(OpCode::JUMP_IF_TRUE_OR_POP, end, 0);
+                            continue;
+                        }
+                        auto next = NewLabel();
+                        ThenJump(OpCode::JUMP_IF_FALSE, next);
+                        ThenSequence(operands, first, last, tail);
+                        ThenJumpUnless(tail, end);
+                        Then(Bind(next));
+                    }
+                    Then({Work::Kind::LITERAL, EmptyList::Get(), tail});
+                    break;
+                }
+            }
+            // The jumps to end carry the value of the form.
+            Then(Bind(end, tail));
+        }
+
+        void StartDefine(const Define& define, bool tail) {
+            Then({Work::Kind::EXPRESSION, define.GetValue()});
+            auto symbol = AddConstant(Symbol::Intern(define.GetName()));
+            if (define.GetGlobals()) {
+                ThenEmit(OpCode::DEFINE_GLOBAL, define.GetName(), symbol);
+            } else {
+                ThenEmit(OpCode::DEFINE_BOXED, AddAddress(define.GetAddress()), symbol);
+            }
+            ThenReturnIf(tail);
+        }
+
+        // Expressions begin to end of forms, whose values are dropped except for the last one.
+        void ThenSequence(const std::vector<Value>& forms, size_t begin, size_t end, bool tail) {
+            for (size_t i = begin; i + 1 < end; ++i) {
+                Then({Work::Kind::EXPRESSION, forms[i]});
+                ThenEmit(OpCode::POP);
+            }
+            Then({Work::Kind::EXPRESSION, forms[end - 1], tail});
+        }
+
+        // What Evaluate returns for (quote . operands).
+        static Value QuoteOperands(const Value& operands) {
+            if (!operands) {
+                return EmptyList::Get();
+            }
+            auto quoted_cell = As<Cell>(operands);
+            if (quoted_cell && !quoted_cell->GetFirst() && !quoted_cell->GetSecond()) {
+                return New<Cell>(EmptyList::Get(), nullptr);
+            }
+            return operands;
+        }
+
+        void Then(Work work) {
+            next_.push_back(std::move(work));
+        }
+
+        void ThenEmit(OpCode op) {
+            Then({Work::Kind::EMIT, nullptr, false, op});
+        }
+
+        void ThenEmit(OpCode op, uint32_t operand) {
+            Then({Work::Kind::EMIT, nullptr, false, op, {operand}, 1});
+        }
+
+        void ThenEmit(OpCode op, uint32_t first, uint32_t second) {
+            Then({Work::Kind::EMIT, nullptr, false, op, {first, second}, 2});
+        }
+
+        void ThenReturnIf(bool tail) {
+            if (tail) {
+                ThenEmit(OpCode::RETURN);
+            }
+        }
+
+        void ThenJump(OpCode op, uint32_t label) {
+            Then({Work::Kind::JUMP, nullptr, false, op, {}, 0, label});
+        }
+
+        void ThenJump(OpCode op, uint32_t label, uint32_t operand) {
+            Then({Work::Kind::JUMP, nullptr, false, op, {operand}, 1, label});
+        }
+
+        // Code in tail position returns by itself; anything else goes on at label.
+        void ThenJumpUnless(bool tail, uint32_t label) {
+            if (!tail) {
+                ThenJump(OpCode::JUMP, label);
+            }
+        }
+
+        // Places label here. In tail position, what jumps to it returns from here.
+        static Work Bind(uint32_t label, bool tail = false) {
+            return {Work::Kind::BIND, nullptr, tail, OpCode::HALT, {}, 0, label};
+        }
+
+        uint32_t NewLabel() {
+            labels_.emplace_back();
+            return labels_.size() - 1;
+        }
+
+        uint32_t AddConstant(const Value& value) {
+            program_->constants.push_back(value);
+            return program_->constants.size() - 1;
+        }
+
+        uint32_t AddAddress(const Address& address) {
+            program_->addresses.push_back(address);
+            return program_->addresses.size() - 1;
+        }
+
+        void EmitReturnIf(bool tail) {
+            if (tail) {
+                Emit(OpCode::RETURN);
+            }
+        }
+
+        void Emit(OpCode op) {
+            program_->code.push_back(static_cast<uint32_t>(op));
+        }
+
+        void Emit(OpCode op, uint32_t operand) {
+            Emit(op);
+            program_->code.push_back(operand);
+        }
+
+        void Emit(OpCode op, uint32_t first, uint32_t second) {
+            Emit(op, first);
+            program_->code.push_back(second);
+        }
+
+        std::shared_ptr<Program> program_;
+        std::vector<Work> work_;
+        // Steps the current one adds, in the order they run.
+        std::vector<Work> next_;
+        // Where each label is jumped to from.
+        std::vector<std::vector<uint32_t>> labels_;
+        std::vector<Lambda*> lambdas_;
+    };
+}  // namespace
+
+std::shared_ptr<const Program> Compile(const Value& ast, GlobalEnvironment* globals) {
+    auto program = std::make_shared<Program>();
+    Compiler{program, globals}.Run(Resolve(ast, globals));
+    return program;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "object.h"
+
+// Operands named name are the SymbolId of the variable, for the error raised when it is unbound.
+// Jump targets are positions in the code of the program.
+enum class OpCode : uint32_t {
+    // PUSH constant: pushes constants[constant].
+    PUSH,
+    // POP: drops the top.
+    POP,
+    // LOAD_FRAME slot name / LOAD_CLOSURE index name / LOAD_GLOBAL global name: push the value
+    // in a slot of the current frame, in a slot of the running closure or in
+    // global_slots[global].
+    LOAD_FRAME,
+    LOAD_CLOSURE,
+    LOAD_GLOBAL,
+    // LOAD_BOXED address name: pushes the boxed variable at addresses[address].
+    LOAD_BOXED,
+    // STORE_FRAME slot: pops the top into a slot of the current frame.
+    STORE_FRAME,
+    // DEFINE_GLOBAL name constant / DEFINE_BOXED address constant: pop the top into the global
+    // variable name or the boxed variable at addresses[address], then push constants[constant],
+    // the symbol defined.
+    DEFINE_GLOBAL,
+    DEFINE_BOXED,
+    // MAKE_ENVIRONMENT slot size: puts a new Environment of size variables into a slot of the
+    // current frame.
+    MAKE_ENVIRONMENT,
+    // MAKE_CLOSURE constant: pushes a closure of the Lambda constants[constant], capturing from
+    // the current frame and closure.
+    MAKE_CLOSURE,
+    // CALL_BUILTIN function argc: applies functions[function], which accepts argc arguments, to
+    // the top argc values.
+    CALL_BUILTIN,
+    // CALL argc: applies the value below the top argc values to them. A compiled closure runs
+    // in a new frame made of its arguments and the slots after them.
+    CALL,
+    // TAIL_CALL argc: like CALL followed by RETURN, but a compiled closure takes over the frame
+    // of the running one.
+    TAIL_CALL,
+    // RETURN: ends the running closure with the top as its value.
+    RETURN,
+    // JUMP target.
+    JUMP,
+    // JUMP_IF_FALSE target: pops the top and jumps if it was #f.
+    JUMP_IF_FALSE,
+    // JUMP_IF_FALSE_OR_POP target: jumps, keeping the top, if it is #f; pops it otherwise.
+    JUMP_IF_FALSE_OR_POP,
+    // JUMP_IF_TRUE_OR_POP target empty: jumps, keeping the top, unless it is #f, or () when
+    // empty is 1; pops it otherwise.
+    JUMP_IF_TRUE_OR_POP,
+    // QUOTE_BRANCH target constant: if the top is the quote symbol, replaces it with
+    // constants[constant] and jumps.
+    QUOTE_BRANCH,
+    // EVALUATE constant: pushes Evaluate(constants[constant]). Only used for nodes that refer
+    // to no local variable, such as Memo nodes.
+    EVALUATE,
+    // RAISE_NOTHING / RAISE_WRONG_TYPE: fail the way Evaluate does on a malformed node.
+    RAISE_NOTHING,
+    RAISE_WRONG_TYPE,
+    // HALT: the top of the stack is the result.
+    HALT
+};
+
+// Flat instruction stream: every opcode is followed by its operands. The top-level expression
+// starts at position 0 and ends with HALT; the bodies of the lambdas in it follow, each one
+// starting where its Lambda says.
+struct Program {
+    std::vector<uint32_t> code;
+    std::vector<Value> constants;
+    std::vector<const Builtin*> functions;
+    std::vector<Value*> global_slots;
+    std::vector<Address> addresses;
+    GlobalEnvironment* globals = nullptr;
+};
+
+// Resolves a parsed expression and lowers it into bytecode with the same semantics as
+// Evaluate. Every lambda in it gets its body compiled into the program, which it keeps alive,
+// so closures made from it can be called from later programs. The program borrows from ast.
+std::shared_ptr<const Program> Compile(const Value& ast, GlobalEnvironment* globals);
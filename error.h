@@ -16,4 +16,9 @@ struct RuntimeError : public std::runtime_error {
 
 struct NameError : public std::runtime_error {
     using std::runtime_error::runtime_error;
-};
\ No newline at end of file
+};
+
+// A run used up one of its RunLimits or was cancelled.
+struct LimitError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <chrono>
+#include "gc.h"
+#include "arena.h"
+
+namespace {
+    // Adopted bytes below which collecting is not worth it.
+    constexpr size_t kMinCollectionBytes = 4 << 20;
+
+    // Objects every interpreter shares, which no single one may mark.
+    bool IsShared(ObjectType type) {
+        return type == ObjectType::SYMBOL || type == ObjectType::EMPTY_LIST ||
+               type == ObjectType::FUNCTION;
+    }
+}  // namespace
+
+Tracer::~Tracer() {
+    for (auto object : marked_) {
+        object->marked_ = false;
+    }
+}
+
+void Tracer::Mark(const Value& value) {
+    Mark(value.Get());
+}
+
+void Tracer::Mark(const Object* object) {
+    if (!object || object->marked_ || IsShared(object->GetType())) {
+        return;
+    }
+    object->marked_ = true;
+    marked_.push_back(object);
+    pending_.push_back(object);
+}
+
+void Tracer::Drain() {
+    while (!pending_.empty()) {
+        auto object = pending_.back();
+        pending_.pop_back();
+        object->Trace(this);
+    }
+}
+
+Heap::RunScope::RunScope(Heap* heap) : heap_(heap) {
+    heap_->run_mutex_.lock_shared();
+}
+
+Heap::RunScope::~RunScope() {
+    heap_->run_mutex_.unlock_shared();
+    if (!heap_->IsCollectionDue()) {
+        return;
+    }
+    // Some other run is still going on if this fails; the last one to end collects.
+    std::unique_lock lock{heap_->run_mutex_, std::try_to_lock};
+    if (lock.owns_lock()) {
+        try {
+            heap_->CollectLocked();
+        } catch (...) {
+            // Only running out of memory for the mark stack gets here. The garbage is left for
+            // the next collection.
+        }
+    }
+}
+
+size_t Heap::AddRoots(Roots roots) {
+    std::lock_guard lock{mutex_};
+    roots_.emplace_back(next_roots_id_, std::move(roots));
+    return next_roots_id_++;
+}
+
+void Heap::RemoveRoots(size_t id) {
+    std::lock_guard lock{mutex_};
+    roots_.erase(std::remove_if(roots_.begin(), roots_.end(),
+                                [id](const auto& roots) { return roots.first == id; }),
+                 roots_.end());
+}
+
+void Heap::Adopt(std::unique_ptr<Arena> arena) {
+    std::lock_guard lock{mutex_};
+    bytes_ += arena->CountBytes();
+    arenas_.push_back(std::move(arena));
+}
+
+void Heap::Collect() {
+    std::unique_lock lock{run_mutex_};
+    CollectLocked();
+}
+
+HeapStats Heap::GetStats() const {
+    std::lock_guard lock{mutex_};
+    auto stats = stats_;
+    stats.arenas = arenas_.size();
+    stats.bytes = bytes_;
+    for (const auto& arena : arenas_) {
+        stats.objects += arena->CountObjects();
+    }
+    return stats;
+}
+
+bool Heap::IsCollectionDue() const {
+    std::lock_guard lock{mutex_};
+    return bytes_ >= std::max(kMinCollectionBytes, next_collection_bytes_);
+}
+
+void Heap::CollectLocked() {
+    // Runs are shut out, so only GetStats waits on this meanwhile.
+    std::lock_guard lock{mutex_};
+    auto start = std::chrono::steady_clock::now();
+    {
+        Tracer tracer;
+        for (const auto& [id, roots] : roots_) {
+            roots(&tracer);
+            tracer.Drain();
+        }
+        size_t bytes = 0;
+        auto live = arenas_.begin();
+        for (auto& arena : arenas_) {
+            stats_.freed_objects += arena->Sweep();
+            if (arena->CountObjects() == 0) {
+                ++stats_.freed_arenas;
+                arena.reset();
+            } else {
+                bytes += arena->CountBytes();
+                *live++ = std::move(arena);
+            }
+        }
+        arenas_.erase(live, arenas_.end());
+        bytes_ = bytes;
+        next_collection_bytes_ = 2 * bytes;
+    }
+    uint64_t pause = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    ++stats_.collections;
+    stats_.last_pause_nanoseconds = pause;
+    stats_.max_pause_nanoseconds = std::max(stats_.max_pause_nanoseconds, pause);
+    stats_.total_pause_nanoseconds += pause;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include "object.h"
+#include "stats.h"
+
+class Arena;
+
+// Marks the objects reachable from the values and objects given to it. Marking works off an
+// explicit stack, so long lists and deep code do not use native stack. Interned symbols, the
+// empty list and builtins are shared by every interpreter and are never marked or collected.
+class Tracer {
+public:
+    Tracer() = default;
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    // Clears the marks it set.
+    ~Tracer();
+
+    void Mark(const Value& value);
+
+    void Mark(const Object* object);
+
+    // Traces everything marked so far, and what it refers to, until nothing is left.
+    void Drain();
+
+private:
+    std::vector<const Object*> pending_;
+    std::vector<const Object*> marked_;
+};
+
+// Old generation of an interpreter's objects. Each run allocates in an arena of its own with a
+// bump pointer, and its objects die with it unless a definition or a store left something
+// pointing into it; the arena is then adopted here. A few cells and big numbers are copied out
+// of the arena when defined or stored instead, so they do not keep a large arena alive.
+// Collecting marks everything reachable from the roots, destroys the adopted objects that were
+// not reached and frees the arenas that have none left. It happens once the adopted arenas
+// have doubled in size since the last collection, and only while no run is going on, so the
+// roots need not include anything on the native stack or in the evaluator.
+class Heap {
+public:
+    // Passes values and objects that must survive collection to the tracer.
+    using Roots = std::function<void(Tracer*)>;
+
+    // Held by every run that may use or adopt objects of the heap. When the last one ends, it
+    // collects garbage if enough has been adopted.
+    class RunScope {
+    public:
+        explicit RunScope(Heap* heap);
+
+        ~RunScope();
+
+        RunScope(const RunScope&) = delete;
+        RunScope& operator=(const RunScope&) = delete;
+
+    private:
+        Heap* heap_;
+    };
+
+    Heap() = default;
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    // Returns an id for RemoveRoots.
+    size_t AddRoots(Roots roots);
+
+    void RemoveRoots(size_t id);
+
+    // Safe to call from several runs at once.
+    void Adopt(std::unique_ptr<Arena> arena);
+
+    // Collects now, once no run is going on.
+    void Collect();
+
+    HeapStats GetStats() const;
+
+private:
+    bool IsCollectionDue() const;
+
+    // The caller holds run_mutex_ exclusively.
+    void CollectLocked();
+
+    // Shared by runs, exclusive while collecting.
+    std::shared_mutex run_mutex_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Arena>> arenas_;
+    std::vector<std::pair<size_t, Roots>> roots_;
+    size_t next_roots_id_ = 0;
+    size_t bytes_ = 0;
+    size_t next_collection_bytes_ = 0;
+    HeapStats stats_;
+};
@@ -0,0 +1,384 @@
+#include <cstring>
+#include <optional>
+#include <unordered_map>
+#include "image.h"
+#include "arena.h"
+
+namespace {
+    // An image is the header followed by five tables: atoms, cells, symbols, forms and text.
+    // Every field is stored in the byte order of the machine that wrote it.
+    constexpr char kImageMagic[8] = {'S', 'C', 'M', 'I', 'M', 'A', 'G', 'E'};
+    constexpr uint32_t kByteOrderMark = 0x01020304;
+
+    struct ImageHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t size;
+        // Of everything after the header.
+        uint64_t checksum;
+        uint32_t atom_count;
+        uint32_t cell_count;
+        uint32_t symbol_count;
+        uint32_t form_count;
+        uint32_t text_size;
+        // Zero in version 1.
+        uint32_t reserved;
+    };
+
+    // A datum is referred to by a 32-bit word whose low two bits tell what the rest is: the
+    // index of an earlier cell, a small number itself, or an index in the symbol or atom table.
+    enum RefTag : uint32_t { kCellRef, kNumberRef, kSymbolRef, kAtomRef };
+
+    constexpr uint32_t kMaxRefIndex = UINT32_MAX >> 2;
+    constexpr int64_t kMaxRefNumber = INT32_MAX >> 2;
+    constexpr int64_t kMinRefNumber = INT32_MIN >> 2;
+
+    // The data that do not fit in a reference.
+    enum class AtomKind : uint32_t { NIL, EMPTY_LIST, BOOLEAN, NUMBER, BIG_NUMBER };
+
+    // NUMBER and BOOLEAN: value is the value. BIG_NUMBER: length is the number of decimal
+    // digits and value their offset in the text.
+    struct ImageAtom {
+        AtomKind kind;
+        uint32_t length;
+        int64_t value;
+    };
+
+    struct ImageCell {
+        uint32_t first;
+        uint32_t second;
+    };
+
+    // Where a name or the digits of a big number are in the text.
+    struct TextRange {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    static_assert(sizeof(ImageHeader) == 56 && sizeof(ImageAtom) == 16 &&
+                  sizeof(ImageCell) == 8 && sizeof(TextRange) == 8);
+
+    uint32_t MakeRef(RefTag tag, uint32_t index) {
+        return index << 2 | tag;
+    }
+
+    // FNV-1a over 8-byte words, which is cheap next to rebuilding the cells.
+    uint64_t Checksum(std::string_view data) {
+        uint64_t hash = 0xcbf29ce484222325;
+        size_t i = 0;
+        for (; i + 8 <= data.size(); i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data.data() + i, 8);
+            hash = (hash ^ word) * 0x100000001b3;
+        }
+        for (; i < data.size(); ++i) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x100000001b3;
+        }
+        return hash;
+    }
+
+    class ImageWriter {
+    public:
+        // Returns the reference to value, writing it and everything it refers to that is not
+        // written yet.
+        uint32_t Add(const Value& value) {
+            if (auto ref = Find(value)) {
+                return *ref;
+            }
+            // Cells whose elements are still to be written, innermost last.
+            std::vector<const Cell*> pending{As<Cell>(value)};
+            while (true) {
+                auto cell = pending.back();
+                auto first = Find(cell->GetFirst());
+                if (!first) {
+                    pending.push_back(As<Cell>(cell->GetFirst()));
+                    continue;
+                }
+                auto second = Find(cell->GetSecond());
+                if (!second) {
+                    pending.push_back(As<Cell>(cell->GetSecond()));
+                    continue;
+                }
+                pending.pop_back();
+                auto ref = MakeRef(kCellRef, CheckIndex(cells_.size()));
+                cells_.push_back({*first, *second});
+                refs_.emplace(cell, ref);
+                if (pending.empty()) {
+                    return ref;
+                }
+            }
+        }
+
+        std::string Finish(const std::vector<uint32_t>& forms) const {
+            ImageHeader header{};
+            std::memcpy(header.magic, kImageMagic, sizeof kImageMagic);
+            header.version = kImageVersion;
+            header.byte_order = kByteOrderMark;
+            header.atom_count = atoms_.size();
+            header.cell_count = cells_.size();
+            header.symbol_count = symbols_.size();
+            header.form_count = forms.size();
+            header.text_size = text_.size();
+
+            std::string image(sizeof header, '\0');
+            auto append = [&image](const auto& table) {
+                image.append(reinterpret_cast<const char*>(table.data()),
+                             table.size() * sizeof(table[0]));
+            };
+            append(atoms_);
+            append(cells_);
+            append(symbols_);
+            append(forms);
+            image += text_;
+
+            header.size = image.size();
+            header.checksum = Checksum(std::string_view{image}.substr(sizeof header));
+            std::memcpy(image.data(), &header, sizeof header);
+            return image;
+        }
+
+    private:
+        // The reference to value if it is written already or is an atom, which gets written
+        // now.
+        std::optional<uint32_t> Find(const Value& value) {
+            if (value.IsNumber()) {
+                auto number = value.GetNumber();
+                if (number >= kMinRefNumber && number <= kMaxRefNumber) {
+                    return MakeRef(kNumberRef, static_cast<uint32_t>(number));
+                }
+                auto [it, inserted] = numbers_.emplace(number, 0);
+                if (inserted) {
+                    it->second = AddAtom({AtomKind::NUMBER, 0, number});
+                }
+                return it->second;
+            }
+            if (value.IsBoolean()) {
+                auto& ref = booleans_[value.GetBoolean()];
+                if (!ref) {
+                    ref = AddAtom({AtomKind::BOOLEAN, 0, value.GetBoolean()});
+                }
+                return ref;
+            }
+            if (!value) {
+                if (!nil_) {
+                    nil_ = AddAtom({AtomKind::NIL, 0, 0});
+                }
+                return nil_;
+            }
+            auto object = value.Get();
+            if (auto it = refs_.find(object); it != refs_.end()) {
+                return it->second;
+            }
+            std::optional<uint32_t> ref;
+            if (Is<EmptyList>(value)) {
+                ref = AddAtom({AtomKind::EMPTY_LIST, 0, 0});
+            } else if (auto symbol = As<Symbol>(value)) {
+                ref = MakeRef(kSymbolRef, CheckIndex(symbols_.size()));
+                symbols_.push_back(AddText(symbol->GetName()));
+            } else if (auto number = As<BigNumber>(value)) {
+                auto digits = AddText(number->GetValue().ToString());
+                ref = AddAtom({AtomKind::BIG_NUMBER, digits.length, digits.offset});
+            } else if (!Is<Cell>(value)) {
+                throw RuntimeError{"Can not write object to an image"};
+            }
+            if (ref) {
+                refs_.emplace(object, *ref);
+            }
+            return ref;
+        }
+
+        uint32_t AddAtom(const ImageAtom& atom) {
+            auto ref = MakeRef(kAtomRef, CheckIndex(atoms_.size()));
+            atoms_.push_back(atom);
+            return ref;
+        }
+
+        TextRange AddText(const std::string& text) {
+            if (text_.size() + text.size() > UINT32_MAX) {
+                throw RuntimeError{"Program is too large for an image"};
+            }
+            TextRange range{static_cast<uint32_t>(text_.size()),
+                            static_cast<uint32_t>(text.size())};
+            text_ += text;
+            return range;
+        }
+
+        static uint32_t CheckIndex(size_t index) {
+            if (index > kMaxRefIndex) {
+                throw RuntimeError{"Program is too large for an image"};
+            }
+            return index;
+        }
+
+        std::vector<ImageAtom> atoms_;
+        std::vector<ImageCell> cells_;
+        std::vector<TextRange> symbols_;
+        std::string text_;
+        std::unordered_map<const Object*, uint32_t> refs_;
+        std::unordered_map<int64_t, uint32_t> numbers_;
+        std::optional<uint32_t> nil_;
+        std::optional<uint32_t> booleans_[2];
+    };
+
+    [[noreturn]] void ThrowInvalid(const std::string& reason) {
+        throw RuntimeError{"Invalid image: " + reason};
+    }
+
+    // Reads entry index of a table starting at data, which need not be aligned.
+    template <class T>
+    T ReadEntry(const char* data, size_t index) {
+        T entry;
+        std::memcpy(&entry, data + index * sizeof(T), sizeof(T));
+        return entry;
+    }
+
+    // Throws unless ref refers to one of the first cell_count cells or to an entry of the
+    // symbol or atom table.
+    void CheckRef(uint32_t ref, size_t cell_count, size_t symbol_count, size_t atom_count) {
+        auto index = ref >> 2;
+        switch (ref & 3) {
+            case kCellRef:
+                if (index >= cell_count) {
+                    ThrowInvalid("reference to a later cell");
+                }
+                break;
+            case kNumberRef:
+                break;
+            case kSymbolRef:
+                if (index >= symbol_count) {
+                    ThrowInvalid("symbol out of range");
+                }
+                break;
+            default:
+                if (index >= atom_count) {
+                    ThrowInvalid("atom out of range");
+                }
+        }
+    }
+}  // namespace
+
+std::string MakeImage(const std::vector<Value>& forms) {
+    ImageWriter writer;
+    std::vector<uint32_t> refs;
+    refs.reserve(forms.size());
+    for (const auto& form : forms) {
+        refs.push_back(writer.Add(form));
+    }
+    return writer.Finish(refs);
+}
+
+Image::Image(std::string_view image) {
+    ImageHeader header;
+    if (image.size() < sizeof header) {
+        ThrowInvalid("truncated");
+    }
+    std::memcpy(&header, image.data(), sizeof header);
+    if (std::memcmp(header.magic, kImageMagic, sizeof kImageMagic) != 0) {
+        ThrowInvalid("not a program image");
+    }
+    if (header.byte_order != kByteOrderMark) {
+        ThrowInvalid("written on a machine of another byte order");
+    }
+    if (header.version != kImageVersion) {
+        ThrowInvalid("version " + std::to_string(header.version) + " instead of " +
+                     std::to_string(kImageVersion));
+    }
+    if (header.reserved != 0) {
+        ThrowInvalid("reserved field is set");
+    }
+    uint64_t size = sizeof header + uint64_t{header.atom_count} * sizeof(ImageAtom) +
+                    uint64_t{header.cell_count} * sizeof(ImageCell) +
+                    uint64_t{header.symbol_count} * sizeof(TextRange) +
+                    uint64_t{header.form_count} * sizeof(uint32_t) + header.text_size;
+    if (header.size != image.size() || size != image.size()) {
+        ThrowInvalid("truncated");
+    }
+    if (Checksum(image.substr(sizeof header)) != header.checksum) {
+        ThrowInvalid("checksum mismatch");
+    }
+
+    auto atom_table = image.data() + sizeof header;
+    cell_table_ = atom_table + header.atom_count * sizeof(ImageAtom);
+    auto symbol_table = cell_table_ + header.cell_count * sizeof(ImageCell);
+    form_table_ = symbol_table + header.symbol_count * sizeof(TextRange);
+    form_count_ = header.form_count;
+    auto text = image.substr(image.size() - header.text_size);
+    auto get_text = [text](uint64_t offset, uint64_t length) {
+        if (offset > text.size() || length > text.size() - offset) {
+            ThrowInvalid("text out of range");
+        }
+        return text.substr(offset, length);
+    };
+
+    // Cells refer only to cells before them, and forms to any cell, which Get relies on.
+    for (size_t i = 0; i < header.cell_count; ++i) {
+        auto cell = ReadEntry<ImageCell>(cell_table_, i);
+        CheckRef(cell.first, i, header.symbol_count, header.atom_count);
+        CheckRef(cell.second, i, header.symbol_count, header.atom_count);
+    }
+    for (size_t i = 0; i < form_count_; ++i) {
+        CheckRef(ReadEntry<uint32_t>(form_table_, i), header.cell_count, header.symbol_count,
+                 header.atom_count);
+    }
+
+    symbols_.reserve(header.symbol_count);
+    for (size_t i = 0; i < header.symbol_count; ++i) {
+        auto range = ReadEntry<TextRange>(symbol_table, i);
+        symbols_.push_back(Symbol::Intern(get_text(range.offset, range.length)));
+    }
+    atoms_.resize(header.atom_count);
+    for (size_t i = 0; i < header.atom_count; ++i) {
+        auto atom = ReadEntry<ImageAtom>(atom_table, i);
+        switch (atom.kind) {
+            case AtomKind::NIL:
+                break;
+            case AtomKind::EMPTY_LIST:
+                atoms_[i] = EmptyList::Get();
+                break;
+            case AtomKind::BOOLEAN:
+                atoms_[i] = Value::FromBoolean(atom.value != 0);
+                break;
+            case AtomKind::NUMBER:
+                atoms_[i] = Value::FromNumber(atom.value);
+                break;
+            case AtomKind::BIG_NUMBER:
+                if (atom.value < 0) {
+                    ThrowInvalid("text out of range");
+                }
+                atoms_[i] = New<BigNumber>(BigInt::Parse(get_text(atom.value, atom.length)));
+                break;
+            default:
+                ThrowInvalid("unknown atom kind");
+        }
+    }
+    cells_.resize(header.cell_count);
+}
+
+size_t Image::CountForms() const {
+    return form_count_;
+}
+
+Value Image::GetForm(size_t index) {
+    return Get(ReadEntry<uint32_t>(form_table_, index));
+}
+
+Value Image::Get(uint32_t ref) {
+    auto index = ref >> 2;
+    switch (ref & 3) {
+        case kNumberRef:
+            return Value::FromNumber(static_cast<int32_t>(ref) >> 2);
+        case kSymbolRef:
+            return symbols_[index];
+        case kAtomRef:
+            return atoms_[index];
+    }
+    // Cells refer only to cells before them, so building in order up to the one asked for
+    // builds everything it refers to first. MakeImage writes the cells of each form after those
+    // of the forms before it, so this builds little more than that form.
+    for (; built_ <= index; ++built_) {
+        auto cell = ReadEntry<ImageCell>(cell_table_, built_);
+        cells_[built_] = New<Cell>(Get(cell.first), Get(cell.second));
+    }
+    return cells_[index];
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "object.h"
+
+// Version of the program image format. Bumped whenever the layout or the meaning of a field
+// changes; Image rejects images of any other version.
+constexpr uint32_t kImageVersion = 1;
+
+// Writes parsed forms as a program image: their data as flat tables of cells, each referring
+// only to cells before it, and of the atoms and symbols they hold, which Image turns back into
+// objects without tokenizing or parsing. Small numbers take no table entry, and subtrees shared
+// between or within forms are written once.
+std::string MakeImage(const std::vector<Value>& forms);
+
+// Forms of an image made by MakeImage, read in place from memory that must outlive this. The
+// whole image is checked up front, so a corrupt one is rejected before any form is used, but
+// the cells of a form are only built, in the current arena, when the form is first asked for,
+// together with any cells written before them that are not built yet.
+class Image {
+public:
+    // Throws RuntimeError if the image is truncated or corrupt, of another version, or written
+    // on a machine of the other byte order.
+    explicit Image(std::string_view image);
+
+    Image(const Image&) = delete;
+    Image& operator=(const Image&) = delete;
+
+    size_t CountForms() const;
+
+    Value GetForm(size_t index);
+
+private:
+    // What a checked reference refers to, building its cell if it is not built yet.
+    Value Get(uint32_t ref);
+
+    // The tables point into the image. Entries are read from them one at a time, since they
+    // need not be aligned.
+    const char* cell_table_;
+    const char* form_table_;
+    size_t form_count_;
+    std::vector<Value> atoms_;
+    std::vector<Value> symbols_;
+    // Only the first built_ are built yet.
+    std::vector<Value> cells_;
+    size_t built_ = 0;
+};
@@ -0,0 +1,60 @@
+#include "error.h"
+#include "mapped_file.h"
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw RuntimeError{"Can not open file: " + path};
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw RuntimeError{"Can not stat file: " + path};
+    }
+    size_ = info.st_size;
+    if (size_ != 0) {
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            throw RuntimeError{"Can not map file: " + path};
+        }
+        data_ = static_cast<const char*>(data);
+        madvise(data, size_, MADV_SEQUENTIAL);
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+std::string_view MappedFile::View() const {
+    return {data_, size_};
+}
+
+#else
+#include <fstream>
+#include <iterator>
+
+MappedFile::MappedFile(const std::string& path) {
+    std::ifstream in{path, std::ios::binary};
+    if (!in) {
+        throw RuntimeError{"Can not open file: " + path};
+    }
+    contents_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+MappedFile::~MappedFile() = default;
+
+std::string_view MappedFile::View() const {
+    return contents_;
+}
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Read-only view of a whole file. Uses mmap where available and falls back to reading the
+// file into memory elsewhere.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view View() const;
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    std::string contents_;
+};
@@ -0,0 +1,219 @@
+#include <functional>
+#include "memo.h"
+
+namespace {
+    size_t Mix(uint64_t value) {
+        // Finalizer of splitmix64.
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+        return value ^ (value >> 31);
+    }
+
+    bool IsEmpty(const Value& value) {
+        if (!value || Is<EmptyList>(value)) {
+            return true;
+        }
+        auto cell = As<Cell>(value);
+        return cell && !cell->GetFirst() && !cell->GetSecond();
+    }
+
+    // A list with at least one element.
+    const Cell* AsList(const Value& value) {
+        auto cell = As<Cell>(value);
+        return cell && (cell->GetFirst() || cell->GetSecond()) ? cell : nullptr;
+    }
+
+    size_t HashAtom(const Value& atom) {
+        if (atom.IsNumber()) {
+            return Mix(atom.GetNumber());
+        }
+        if (atom.IsBoolean()) {
+            return Mix(atom.GetBoolean() ? 0x7423 : 0x6623);
+        }
+        if (IsEmpty(atom)) {
+            return Mix(0x2829);
+        }
+        if (auto symbol = As<Symbol>(atom)) {
+            return Mix(symbol->GetId() ^ 0x73796d00000000);
+        }
+        if (auto number = As<BigNumber>(atom)) {
+            return number->GetValue().Hash();
+        }
+        return std::hash<const Object*>{}(atom.Get());
+    }
+
+    bool EqualAtoms(const Value& lhs, const Value& rhs) {
+        if (lhs.IsNumber() || rhs.IsNumber()) {
+            return lhs.IsNumber() && rhs.IsNumber() && lhs.GetNumber() == rhs.GetNumber();
+        }
+        if (lhs.IsBoolean() || rhs.IsBoolean()) {
+            return lhs.IsBoolean() && rhs.IsBoolean() && lhs.GetBoolean() == rhs.GetBoolean();
+        }
+        if (IsEmpty(lhs) || IsEmpty(rhs)) {
+            return IsEmpty(lhs) && IsEmpty(rhs);
+        }
+        auto lhs_number = As<BigNumber>(lhs);
+        auto rhs_number = As<BigNumber>(rhs);
+        if (lhs_number && rhs_number) {
+            return Compare(lhs_number->GetValue(), rhs_number->GetValue()) == 0;
+        }
+        return lhs.Get() == rhs.Get();
+    }
+}  // namespace
+
+void ListHash::Add(size_t element_hash) {
+    hash_ = Mix(hash_ + element_hash);
+}
+
+size_t ListHash::Finish(size_t tail_hash) const {
+    return Mix(hash_ ^ (tail_hash * 0x9e3779b97f4a7c15));
+}
+
+size_t HashDatum(const Value& datum) {
+    if (!AsList(datum)) {
+        return HashAtom(datum);
+    }
+    // Lists whose elements are being hashed, innermost last.
+    struct Open {
+        ListHash hash;
+        const Cell* cell;
+    };
+    std::vector<Open> open;
+    const Value* next = &datum;
+    while (true) {
+        if (auto cell = AsList(*next)) {
+            open.push_back({ListHash{}, cell});
+            next = &cell->GetFirst();
+            continue;
+        }
+        auto hash = HashAtom(*next);
+        // Hand the hash to the lists it completes.
+        while (true) {
+            if (open.empty()) {
+                return hash;
+            }
+            auto& top = open.back();
+            top.hash.Add(hash);
+            const auto& rest = top.cell->GetSecond();
+            if (auto cell = AsList(rest)) {
+                top.cell = cell;
+                next = &cell->GetFirst();
+                break;
+            }
+            hash = top.hash.Finish(HashAtom(rest));
+            open.pop_back();
+        }
+    }
+}
+
+bool EqualData(const Value& lhs, const Value& rhs) {
+    std::vector<std::pair<const Value*, const Value*>> pending{{&lhs, &rhs}};
+    while (!pending.empty()) {
+        auto [left, right] = pending.back();
+        pending.pop_back();
+        if (left->Get() && left->Get() == right->Get()) {
+            continue;
+        }
+        auto left_cell = AsList(*left);
+        auto right_cell = AsList(*right);
+        if (!left_cell || !right_cell) {
+            if (left_cell || right_cell || !EqualAtoms(*left, *right)) {
+                return false;
+            }
+            continue;
+        }
+        pending.emplace_back(&left_cell->GetSecond(), &right_cell->GetSecond());
+        pending.emplace_back(&left_cell->GetFirst(), &right_cell->GetFirst());
+    }
+    return true;
+}
+
+void DatumHashes::Add(const Value& list, size_t hash) {
+    hashes_.emplace(list.Get(), hash);
+}
+
+std::optional<size_t> DatumHashes::Find(const Value& list) const {
+    auto it = hashes_.find(list.Get());
+    if (it == hashes_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+MemoCache::MemoCache(size_t capacity) : capacity_(capacity) {
+}
+
+bool MemoCache::Find(const Value& key, size_t hash, Value* result) {
+    std::lock_guard lock{mutex_};
+    if (capacity_ == 0) {
+        return false;
+    }
+    auto [begin, end] = index_.equal_range(hash);
+    for (auto it = begin; it != end; ++it) {
+        if (EqualData(it->second->key, key)) {
+            entries_.splice(entries_.begin(), entries_, it->second);
+            *result = it->second->result;
+            ++hits_;
+            return true;
+        }
+    }
+    ++misses_;
+    return false;
+}
+
+void MemoCache::Store(const Value& key, size_t hash, Value result) {
+    std::lock_guard lock{mutex_};
+    if (capacity_ == 0) {
+        return;
+    }
+    auto [begin, end] = index_.equal_range(hash);
+    for (auto it = begin; it != end; ++it) {
+        if (EqualData(it->second->key, key)) {
+            // Another thread got here first.
+            return;
+        }
+    }
+    entries_.push_front({key, hash, std::move(result)});
+    index_.emplace(hash, entries_.begin());
+    Evict();
+}
+
+void MemoCache::SetCapacity(size_t capacity) {
+    std::lock_guard lock{mutex_};
+    capacity_ = capacity;
+    Evict();
+}
+
+size_t MemoCache::GetCapacity() const {
+    std::lock_guard lock{mutex_};
+    return capacity_;
+}
+
+size_t MemoCache::GetSize() const {
+    std::lock_guard lock{mutex_};
+    return entries_.size();
+}
+
+size_t MemoCache::CountHits() const {
+    std::lock_guard lock{mutex_};
+    return hits_;
+}
+
+size_t MemoCache::CountMisses() const {
+    std::lock_guard lock{mutex_};
+    return misses_;
+}
+
+void MemoCache::Evict() {
+    while (entries_.size() > capacity_) {
+        auto last = std::prev(entries_.end());
+        auto [begin, end] = index_.equal_range(last->hash);
+        for (auto it = begin; it != end; ++it) {
+            if (it->second == last) {
+                index_.erase(it);
+                break;
+            }
+        }
+        entries_.pop_back();
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include "object.h"
+
+// Structural hash of a datum: lists hash by their elements, numbers, booleans and symbols by
+// their value, and every spelling of () alike. Other objects hash by identity. Works without
+// recursion, so it takes data of any depth.
+size_t HashDatum(const Value& datum);
+
+// Whether lhs and rhs are the same datum in the sense of HashDatum.
+bool EqualData(const Value& lhs, const Value& rhs);
+
+// Hashes a list from the hashes of its elements, the same way HashDatum does.
+class ListHash {
+public:
+    void Add(size_t element_hash);
+
+    // tail_hash is the hash of what ends the list: HashDatum(nullptr) for a proper list.
+    size_t Finish(size_t tail_hash) const;
+
+private:
+    size_t hash_ = 0x6c697374;
+};
+
+// HashDatum of the lists read while sharing subtrees, by their object, so whoever keys on them
+// need not walk them again.
+class DatumHashes {
+public:
+    void Add(const Value& list, size_t hash);
+
+    // The hash of list, if it was added.
+    std::optional<size_t> Find(const Value& list) const;
+
+private:
+    std::unordered_map<const Object*, size_t> hashes_;
+};
+
+// Results of pure expressions by the datum they were read from. Keeps at most capacity of them and
+// evicts the least recently used one first. Safe to use from several threads.
+class MemoCache {
+public:
+    explicit MemoCache(size_t capacity);
+
+    // Sets *result and returns true if the result for key, whose HashDatum is hash, is
+    // cached.
+    bool Find(const Value& key, size_t hash, Value* result);
+
+    // Neither key nor result may point into an arena.
+    void Store(const Value& key, size_t hash, Value result);
+
+    // Evicts entries until no more than capacity are left.
+    void SetCapacity(size_t capacity);
+
+    size_t GetCapacity() const;
+
+    size_t GetSize() const;
+
+    size_t CountHits() const;
+
+    size_t CountMisses() const;
+
+private:
+    struct Entry {
+        Value key;
+        size_t hash;
+        Value result;
+    };
+
+    void Evict();
+
+    mutable std::mutex mutex_;
+    size_t capacity_;
+    // Most recently used first.
+    std::list<Entry> entries_;
+    std::unordered_multimap<size_t, std::list<Entry>::iterator> index_;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+};
@@ -1,463 +1,2319 @@
-#include <unordered_map>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
 #include <numeric>
+#include <ostream>
 #include <functional>
 #include "object.h"
+#include "arena.h"
+#include "compiler.h"
+#include "gc.h"
+#include "memo.h"
+#include "run_limits.h"
 
 namespace {
-    std::unordered_map<std::string, std::shared_ptr<Object>> string_to_function = {
-            {"number?", std::make_shared<IsNumberFunction>()},
-            {"=", std::make_shared<IsEqualFunction>()},
-            {">", std::make_shared<IsGreaterFunction>()},
-            {"<", std::make_shared<IsLessFunction>()},
-            {">=", std::make_shared<IsGreaterEqualFunction>()},
-            {"<=", std::make_shared<IsLessEqualFunction>()},
-            {"+", std::make_shared<AdditionFunction>()},
-            {"-", std::make_shared<SubtractionFunction>()},
-            {"*", std::make_shared<MultiplicationFunction>()},
-            {"/", std::make_shared<DivisionFunction>()},
-            {"max", std::make_shared<MaxFunction>()},
-            {"min", std::make_shared<MinFunction>()},
-            {"abs", std::make_shared<AbsFunction>()},
-            {"boolean?", std::make_shared<IsBooleanFunction>()},
-            {"not", std::make_shared<NotFunction>()},
-            {"and", std::make_shared<AndFunction>()},
-            {"or", std::make_shared<OrFunction>()},
-            {"pair?", std::make_shared<IsPairFunction>()},
-            {"null?", std::make_shared<IsNullFunction>()},
-            {"list?", std::make_shared<IsListFunction>()},
-            {"cons", std::make_shared<ConsFunction>()},
-            {"car", std::make_shared<CarFunction>()},
-            {"cdr", std::make_shared<CdrFunction>()},
-            {"list", std::make_shared<ListFunction>()},
-            {"list-ref", std::make_shared<ListRefFunction>()},
-            {"list-tail", std::make_shared<ListTailFunction>()}};
-
-    std::shared_ptr<Object> ArithmeticOp(const std::vector<std::shared_ptr<Object>>& numbers,
-                                         size_t start_pos, std::shared_ptr<Object> init,
-                                         std::function<int64_t(int64_t lhs, int64_t rhs)> op) {
-    if (!Is<Number>(init)) {
-    throw RuntimeError{"Incorrect Type for :" + std::string(__PRETTY_FUNCTION__)};
-}
-return std::make_shared<Number>(std::accumulate(
-        numbers.begin() + start_pos, numbers.end(), As<Number>(init)->GetValue(),
-        [&op](int64_t lhs, std::shared_ptr<Object> rhs) {
-            if (!Is<Number>(rhs)) {
+    std::vector<Builtin> MakeBuiltins(
+            std::initializer_list<std::pair<std::string_view, Builtin>> functions) {
+        std::vector<Builtin> table;
+        for (const auto& [name, builtin] : functions) {
+            auto id = InternSymbol(name);
+            if (table.size() <= id) {
+                table.resize(id + 1);
+            }
+            table[id] = builtin;
+            table[id].name = id;
+            // Every interpreter on every thread calls them.
+            table[id].function->ShareAcrossThreads();
+        }
+        return table;
+    }
+
+    // Indexed by SymbolId.
+    const std::vector<Builtin> builtins = MakeBuiltins({
+            {"number?", {MakeRef<IsNumberFunction>(), 1, 1}},
+            {"=", {MakeRef<IsEqualFunction>(), 0, kVariadic}},
+            {">", {MakeRef<IsGreaterFunction>(), 0, kVariadic}},
+            {"<", {MakeRef<IsLessFunction>(), 0, kVariadic}},
+            {">=", {MakeRef<IsGreaterEqualFunction>(), 0, kVariadic}},
+            {"<=", {MakeRef<IsLessEqualFunction>(), 0, kVariadic}},
+            {"+", {MakeRef<AdditionFunction>(), 0, kVariadic}},
+            {"-", {MakeRef<SubtractionFunction>(), 1, kVariadic}},
+            {"*", {MakeRef<MultiplicationFunction>(), 0, kVariadic}},
+            {"/", {MakeRef<DivisionFunction>(), 1, kVariadic}},
+            {"max", {MakeRef<MaxFunction>(), 1, kVariadic}},
+            {"min", {MakeRef<MinFunction>(), 1, kVariadic}},
+            {"abs", {MakeRef<AbsFunction>(), 1, 1}},
+            {"boolean?", {MakeRef<IsBooleanFunction>(), 1, 1}},
+            {"not", {MakeRef<NotFunction>(), 1, 1}},
+            {"and", {MakeRef<AndFunction>(), 0, kVariadic}},
+            {"or", {MakeRef<OrFunction>(), 0, kVariadic}},
+            {"pair?", {MakeRef<IsPairFunction>(), 1, 1}},
+            {"null?", {MakeRef<IsNullFunction>(), 1, 1}},
+            {"list?", {MakeRef<IsListFunction>(), 1, 1}},
+            {"cons", {MakeRef<ConsFunction>(), 2, 2}},
+            {"car", {MakeRef<CarFunction>(), 1, 1}},
+            {"cdr", {MakeRef<CdrFunction>(), 1, 1}},
+            {"list", {MakeRef<ListFunction>(), 0, kVariadic}},
+            {"list-ref", {MakeRef<ListRefFunction>(), 2, 2}},
+            {"list-tail", {MakeRef<ListTailFunction>(), 2, 2}},
+            // Vectors are mutable, so whatever makes or reads them is not pure.
+            {"vector?", {MakeRef<IsVectorFunction>(), 1, 1}},
+            {"make-vector", {MakeRef<MakeVectorFunction>(), 1, 2, false}},
+            {"vector", {MakeRef<VectorFunction>(), 0, kVariadic, false}},
+            {"vector-ref", {MakeRef<VectorRefFunction>(), 2, 2, false}},
+            {"vector-set!", {MakeRef<VectorSetFunction>(), 3, 3, false}},
+            {"vector-length", {MakeRef<VectorLengthFunction>(), 1, 1, false}},
+            {"list->vector", {MakeRef<ListToVectorFunction>(), 1, 1, false}},
+            {"vector-sum", {MakeRef<VectorSumFunction>(), 1, 1, false}},
+            {"vector-map", {MakeRef<VectorMapFunction>(), 2, 2, false}},
+            {"interpreter-stats", {MakeRef<InterpreterStatsFunction>(), 0, 0, false}}});
+
+    bool IsInteger(const Value& value) {
+        return Is<Number>(value) || Is<BigNumber>(value);
+    }
+
+    BigInt ToBigInt(const Value& value) {
+        return Is<Number>(value) ? BigInt{value.GetNumber()} : As<BigNumber>(value)->GetValue();
+    }
+
+    // Negative, zero or positive as lhs is less than, equal to or greater than rhs.
+    int CompareIntegers(const Value& lhs, const Value& rhs) {
+        if (Is<Number>(lhs) && Is<Number>(rhs)) {
+            return (lhs.GetNumber() > rhs.GetNumber()) - (lhs.GetNumber() < rhs.GetNumber());
+        }
+        return Compare(ToBigInt(lhs), ToBigInt(rhs));
+    }
+
+    // Calls with at least this many operands unbox them into a buffer and reduce it in a
+    // loop the compiler can vectorize.
+    constexpr size_t kWideCall = 8;
+
+    // Copies the numbers from begin on into a buffer of int64_t. Fails if any of them is not
+    // an inline number. The buffer is reused by the next call on this thread.
+    const std::vector<int64_t>* Unbox(const std::vector<Value>& numbers, size_t begin) {
+        thread_local std::vector<int64_t> buffer;
+        buffer.resize(numbers.size() - begin);
+        bool all_numbers = true;
+        for (size_t i = begin; i < numbers.size(); ++i) {
+            bool is_number = numbers[i].IsNumber();
+            all_numbers &= is_number;
+            buffer[i - begin] = is_number ? numbers[i].GetNumber() : 0;
+        }
+        return all_numbers ? &buffer : nullptr;
+    }
+
+    struct Range {
+        int64_t min;
+        int64_t max;
+    };
+
+    // Branch-free so it vectorizes.
+    Range FindRange(const std::vector<int64_t>& values) {
+        Range range{INT64_MAX, INT64_MIN};
+        for (auto value : values) {
+            range.min = value < range.min ? value : range.min;
+            range.max = value > range.max ? value : range.max;
+        }
+        return range;
+    }
+
+    // Kernels for ArithmeticOp. Fixnum returns true if the result does not fit, like
+    // __builtin_add_overflow.
+    struct Addition {
+        static bool Fixnum(int64_t lhs, int64_t rhs, int64_t* result) {
+            return __builtin_add_overflow(lhs, rhs, result);
+        }
+
+        static BigInt Big(const BigInt& lhs, const BigInt& rhs) {
+            return lhs + rhs;
+        }
+    };
+
+    struct Subtraction {
+        static bool Fixnum(int64_t lhs, int64_t rhs, int64_t* result) {
+            return __builtin_sub_overflow(lhs, rhs, result);
+        }
+
+        static BigInt Big(const BigInt& lhs, const BigInt& rhs) {
+            return lhs - rhs;
+        }
+    };
+
+    struct Multiplication {
+        static bool Fixnum(int64_t lhs, int64_t rhs, int64_t* result) {
+            return __builtin_mul_overflow(lhs, rhs, result);
+        }
+
+        static BigInt Big(const BigInt& lhs, const BigInt& rhs) {
+            return lhs * rhs;
+        }
+    };
+
+    struct Division {
+        static bool Fixnum(int64_t lhs, int64_t rhs, int64_t* result) {
+            if (rhs == 0) {
+                throw RuntimeError{"Division by zero"};
+            }
+            // The only quotient that does not fit.
+            if (lhs == INT64_MIN && rhs == -1) {
+                return true;
+            }
+            *result = lhs / rhs;
+            return false;
+        }
+
+        static BigInt Big(const BigInt& lhs, const BigInt& rhs) {
+            return lhs / rhs;
+        }
+    };
+
+    // Folds the numbers from start_pos on into init. Works on 64-bit numbers while the kernel
+    // reports no overflow, and on BigInts from the first overflow or big operand on.
+    template <class Kernel>
+    Value ArithmeticOp(const std::vector<Value>& numbers, size_t start_pos, const Value& init) {
+        int64_t result;
+        // Either init is the identity or it is numbers[0] and start_pos is 1, so a call with two
+        // numbers is a single step.
+        if (numbers.size() == 2 && numbers[0].IsNumber() && numbers[1].IsNumber() &&
+            !Kernel::Fixnum(numbers[0].GetNumber(), numbers[1].GetNumber(), &result)) {
+            return Value::FromNumber(result);
+        }
+        if (!IsInteger(init)) {
+            throw RuntimeError{"Incorrect Type for :" + std::string(__PRETTY_FUNCTION__)};
+        }
+        size_t pos = start_pos;
+        BigInt accumulator;
+        if (Is<Number>(init)) {
+            int64_t fixnum = init.GetNumber();
+            for (; pos < numbers.size() && numbers[pos].IsNumber(); ++pos) {
+                if (Kernel::Fixnum(fixnum, numbers[pos].GetNumber(), &result)) {
+                    break;
+                }
+                fixnum = result;
+            }
+            if (pos == numbers.size()) {
+                return Value::FromNumber(fixnum);
+            }
+            accumulator = BigInt{fixnum};
+        } else {
+            accumulator = As<BigNumber>(init)->GetValue();
+        }
+        for (; pos < numbers.size(); ++pos) {
+            if (!IsInteger(numbers[pos])) {
                 throw RuntimeError{"Incorrect Type for :" + std::string(__PRETTY_FUNCTION__)};
             }
-            return op(lhs, As<Number>(rhs)->GetValue());
-        }));
+            accumulator = Kernel::Big(accumulator, ToBigInt(numbers[pos]));
+        }
+        return BigNumber::Make(std::move(accumulator));
+    }
+
+    // Kernels for CompareOp: whether lhs and rhs, or their order, satisfy the comparison.
+    struct Equal {
+        static bool Holds(int64_t lhs, int64_t rhs) {
+            return lhs == rhs;
+        }
+
+        static bool Holds(int order) {
+            return order == 0;
+        }
+    };
+
+    struct Greater {
+        static bool Holds(int64_t lhs, int64_t rhs) {
+            return lhs > rhs;
+        }
+
+        static bool Holds(int order) {
+            return order > 0;
+        }
+    };
+
+    struct Less {
+        static bool Holds(int64_t lhs, int64_t rhs) {
+            return lhs < rhs;
+        }
+
+        static bool Holds(int order) {
+            return order < 0;
+        }
+    };
+
+    struct GreaterEqual {
+        static bool Holds(int64_t lhs, int64_t rhs) {
+            return lhs >= rhs;
+        }
+
+        static bool Holds(int order) {
+            return order >= 0;
+        }
+    };
+
+    struct LessEqual {
+        static bool Holds(int64_t lhs, int64_t rhs) {
+            return lhs <= rhs;
+        }
+
+        static bool Holds(int order) {
+            return order <= 0;
+        }
+    };
+
+    // Whether numbers[0] compares as Kernel says with every number from start_pos on.
+    template <class Kernel>
+    Value CompareOp(const std::vector<Value>& numbers, size_t start_pos) {
+        if (numbers.empty()) {
+            return Value::FromBoolean(true);
+        }
+        // Comparing numbers[0] with itself holds whenever start_pos is 0.
+        if (numbers.size() == 2 && numbers[0].IsNumber() && numbers[1].IsNumber()) {
+            return Value::FromBoolean(
+                    Kernel::Holds(numbers[0].GetNumber(), numbers[1].GetNumber()));
+        }
+        if (!IsInteger(numbers[0])) {
+            throw RuntimeError{"Not IntType" + std::string(__PRETTY_FUNCTION__)};
+        }
+        // Each of the comparisons holds against every number iff it holds against the
+        // smallest and the largest one.
+        if (numbers[0].IsNumber() && numbers.size() - start_pos >= kWideCall) {
+            if (auto unboxed = Unbox(numbers, start_pos)) {
+                auto range = FindRange(*unboxed);
+                auto first = numbers[0].GetNumber();
+                return Value::FromBoolean(Kernel::Holds(first, range.min) &&
+                                          Kernel::Holds(first, range.max));
+            }
+        }
+        return Value::FromBoolean(
+                std::all_of(numbers.begin() + start_pos, numbers.end(), [&](const Value& arg) {
+                    if (!IsInteger(arg)) {
+                        throw RuntimeError{"Not IntType" + std::string(__PRETTY_FUNCTION__)};
+                    }
+                    return Kernel::Holds(CompareIntegers(numbers[0], arg));
+                }));
+    }
+
+    // The largest number for Greater, the smallest for Less.
+    template <class Kernel>
+    Value ExtremumOp(const std::vector<Value>& numbers) {
+        if (numbers.size() == 2 && numbers[0].IsNumber() && numbers[1].IsNumber()) {
+            return Kernel::Holds(numbers[1].GetNumber(), numbers[0].GetNumber()) ? numbers[1]
+                                                                                : numbers[0];
+        }
+        if (numbers.size() >= kWideCall) {
+            if (auto unboxed = Unbox(numbers, 0)) {
+                auto range = FindRange(*unboxed);
+                return Value::FromNumber(Kernel::Holds(range.max, range.min) ? range.max
+                                                                             : range.min);
+            }
+        }
+        if (!std::all_of(numbers.begin(), numbers.end(),
+                         [](const Value& object) { return IsInteger(object); })) {
+            throw RuntimeError{"Incorrect Type for :" + std::string(__PRETTY_FUNCTION__)};
+        }
+        const Value* extremum = &numbers[0];
+        for (const auto& number : numbers) {
+            if (Kernel::Holds(CompareIntegers(number, *extremum))) {
+                extremum = &number;
+            }
+        }
+        return *extremum;
+    }
+
+    // The sum of values, unless adding them up overflows. Keeps kLanes independent partial
+    // sums, each with its own overflow flag, so the loop vectorizes.
+    bool SumWithoutOverflow(const std::vector<int64_t>& values, int64_t* sum) {
+        constexpr size_t kLanes = 4;
+        uint64_t totals[kLanes] = {};
+        uint64_t overflows[kLanes] = {};
+        size_t i = 0;
+        for (; i + kLanes <= values.size(); i += kLanes) {
+            for (size_t lane = 0; lane < kLanes; ++lane) {
+                auto value = static_cast<uint64_t>(values[i + lane]);
+                auto next = totals[lane] + value;
+                // Both operands have the sign the result lacks.
+                overflows[lane] |= (totals[lane] ^ next) & (value ^ next);
+                totals[lane] = next;
+            }
+        }
+        int64_t total = 0;
+        for (size_t lane = 0; lane < kLanes; ++lane) {
+            if (static_cast<int64_t>(overflows[lane]) < 0 ||
+                __builtin_add_overflow(total, static_cast<int64_t>(totals[lane]), &total)) {
+                return false;
+            }
+        }
+        for (; i < values.size(); ++i) {
+            if (__builtin_add_overflow(total, values[i], &total)) {
+                return false;
+            }
+        }
+        *sum = total;
+        return true;
+    }
+
+    // Calls a closure or a builtin named by a symbol from inside a builtin.
+    Value ApplyProcedure(const Value& procedure, const std::vector<Value>& args) {
+        if (auto closure = As<Closure>(procedure)) {
+            return closure->Apply(args);
+        }
+        auto symbol = As<Symbol>(procedure);
+        auto builtin = symbol ? FindBuiltin(symbol->GetId()) : nullptr;
+        if (!builtin) {
+            throw RuntimeError{"Evaluating Wrong Type"};
+        }
+        return builtin->Apply(args);
+    }
+
+    Vector* GetVector(const Value& value) {
+        auto vector = As<Vector>(value);
+        if (!vector) {
+            throw RuntimeError{"Incorrect Type for :" + std::string(__PRETTY_FUNCTION__)};
+        }
+        return vector;
+    }
+
+    size_t GetIndex(const Value& index, size_t size) {
+        if (!Is<Number>(index) || index.GetNumber() < 0 ||
+            static_cast<uint64_t>(index.GetNumber()) >= size) {
+            throw RuntimeError{"Incorrect Value for index in :" + std::string(__PRETTY_FUNCTION__)};
+        }
+        return index.GetNumber();
+    }
+
+    thread_local size_t stores = 0;
+
+    // Called for a value about to be stored somewhere older than the current run. Gives true if
+    // the store leaves nothing pointing into the run's arena, copying value out of it if need be
+    // (see Arena::CopyOut).
+    bool CopyOutOfArena(Value* value) {
+        if (!value->IsBorrowed()) {
+            return true;
+        }
+        auto arena = Arena::Current();
+        return arena && arena->CopyOut(value);
+    }
+
+    // Appends printed values to a buffer in one pass. Lists and vectors are walked with an
+    // explicit stack, so nesting costs heap rather than native stack, and nothing is modified
+    // on the way. With a stream, the buffer is written out whenever it grows past kFlushSize.
+    class Printer {
+    public:
+        Printer(std::string* buffer, std::ostream* stream) : buffer_(buffer), stream_(stream) {
+        }
+
+        void Print(const Value& value) {
+            // An improper tail has been printed; close its list next.
+            static const Value kClosed;
+            const Value* next = &value;
+            while (true) {
+                while (next) {
+                    next = PrintValue(*next);
+                }
+                if (open_.empty()) {
+                    Flush(0);
+                    return;
+                }
+                auto& top = open_.back();
+                if (top.vector) {
+                    const auto& elements = top.vector->GetElements();
+                    if (top.index == elements.size()) {
+                        *buffer_ += ')';
+                        open_.pop_back();
+                    } else {
+                        if (top.index > 0) {
+                            *buffer_ += ' ';
+                        }
+                        next = &elements[top.index++];
+                    }
+                    continue;
+                }
+                // Print plain elements in a tight loop until one needs opening.
+                const Value* tail = top.tail;
+                auto cell = As<Cell>(*tail);
+                for (; cell; cell = As<Cell>(*tail)) {
+                    *buffer_ += ' ';
+                    tail = &cell->GetSecond();
+                    const auto& first = cell->GetFirst();
+                    if (!first.IsNumber()) {
+                        next = &first;
+                        break;
+                    }
+                    PrintNumber(first.GetNumber());
+                    Flush(kFlushSize);
+                }
+                top.tail = tail;
+                if (cell) {
+                    continue;
+                }
+                if (!*tail || Is<EmptyList>(*tail)) {
+                    *buffer_ += ')';
+                    open_.pop_back();
+                } else {
+                    *buffer_ += " . ";
+                    top.tail = &kClosed;
+                    next = tail;
+                }
+            }
+        }
+
+    private:
+        static constexpr size_t kFlushSize = 1 << 16;
+
+        // A list or vector whose elements are still being printed.
+        struct Open {
+            const Vector* vector;
+            size_t index;
+            const Value* tail;
+        };
+
+        // Prints value, or opens it if it is a list or a boxed vector. Returns the first element
+        // of an opened list, which is printed next.
+        const Value* PrintValue(const Value& value) {
+            Flush(kFlushSize);
+            if (value.IsNumber()) {
+                PrintNumber(value.GetNumber());
+            } else if (value.IsBoolean()) {
+                *buffer_ += value.GetBoolean() ? "#t" : "#f";
+            } else if (auto cell = As<Cell>(value)) {
+                if (!cell->GetFirst() && !cell->GetSecond()) {
+                    *buffer_ += "()";
+                    return nullptr;
+                }
+                *buffer_ += '(';
+                open_.push_back({nullptr, 0, &cell->GetSecond()});
+                CheckDepth(open_.size());
+                return &cell->GetFirst();
+            } else if (auto vector = As<Vector>(value)) {
+                *buffer_ += "#(";
+                if (auto numbers = vector->GetNumbers()) {
+                    for (size_t i = 0; i < numbers->size(); ++i) {
+                        if (i > 0) {
+                            *buffer_ += ' ';
+                        }
+                        PrintNumber((*numbers)[i]);
+                    }
+                    *buffer_ += ')';
+                    return nullptr;
+                }
+                open_.push_back({vector, 0, nullptr});
+                CheckDepth(open_.size());
+            } else if (auto symbol = As<Symbol>(value)) {
+                *buffer_ += symbol->GetName();
+            } else if (value) {
+                *buffer_ += value.Get()->Serialize();
+            }
+            return nullptr;
+        }
+
+        void PrintNumber(int64_t number) {
+            char digits[24];
+            auto end = std::to_chars(digits, digits + sizeof(digits), number).ptr;
+            buffer_->append(digits, end);
+        }
+
+        // Writes the buffer to the stream once it holds at least size bytes.
+        void Flush(size_t size) {
+            if (stream_ && buffer_->size() >= size) {
+                stream_->write(buffer_->data(), buffer_->size());
+                buffer_->clear();
+            }
+        }
+
+        std::string* buffer_;
+        std::ostream* stream_;
+        std::vector<Open> open_;
+    };
+
+    // Frames of the closure calls in progress on this thread, innermost last. A frame is found
+    // by its base index, since deeper calls may reallocate the vector.
+    thread_local std::vector<Value> frames;
+    thread_local size_t frame_base = 0;
+    thread_local const Closure* current_closure = nullptr;
+
+    class Frame {
+    public:
+        Frame(const Closure* closure, size_t size)
+            : previous_base_(frame_base), previous_closure_(current_closure) {
+            frame_base = frames.size();
+            frames.resize(frame_base + size);
+            current_closure = closure;
+        }
+
+        ~Frame() {
+            frames.resize(frame_base);
+            frame_base = previous_base_;
+            current_closure = previous_closure_;
+        }
+
+        Frame(const Frame&) = delete;
+        Frame& operator=(const Frame&) = delete;
+
+    private:
+        size_t previous_base_;
+        const Closure* previous_closure_;
+    };
+
+    // The slot at address, without following a box.
+    const Value& LoadSlot(const Address& address) {
+        if (address.scope == Address::Scope::FRAME) {
+            return frames[frame_base + address.index];
+        }
+        return current_closure->GetCaptured(address.index);
+    }
+
+    Value& LoadBoxed(const Address& address) {
+        return static_cast<Environment*>(LoadSlot(address).Get())->At(address.offset);
+    }
+
+    bool IsTrue(const Value& value) {
+        return !Is<Boolean>(value) || value.GetBoolean();
+    }
+
+    // What (quote . operands) evaluates to.
+    Value QuoteOperands(const Value& operands) {
+        if (!operands) {
+            return EmptyList::Get();
+        }
+        auto quoted_cell = As<Cell>(operands);
+        if (quoted_cell && !quoted_cell->GetFirst() && !quoted_cell->GetSecond()) {
+            return New<Cell>(EmptyList::Get(), nullptr);
+        }
+        return operands;
+    }
+
+    Value LoadVariable(const Variable* variable) {
+        const auto& address = variable->GetAddress();
+        const auto& value = variable->GetGlobal() ? *variable->GetGlobal()
+                            : address.boxed        ? LoadBoxed(address)
+                                                   : LoadSlot(address);
+        if (!value) {
+            throw NameError{"Unbound variable: " + GetSymbolName(variable->GetName())};
+        }
+        return value;
+    }
+
+    Value MakeClosure(const Lambda* lambda) {
+        std::vector<Value> captured;
+        captured.reserve(lambda->GetCaptures().size());
+        for (const auto& address : lambda->GetCaptures()) {
+            captured.push_back(LoadSlot(address));
+        }
+        return New<Closure>(lambda, std::move(captured));
+    }
+
+    void CheckArity(const Lambda* lambda, size_t count) {
+        size_t required = lambda->GetRequiredArgs();
+        if (count < required || (!lambda->IsVariadic() && count > required)) {
+            throw RuntimeError{"Invalid Number of Arguments for : #<procedure>"};
+        }
+    }
+
+    // Fills the parameters in the current frame, which must already have the frame size of
+    // lambda. A variadic lambda gets the extra arguments as a list.
+    template <class Iterator>
+    void BindArguments(const Lambda* lambda, Iterator args, size_t count) {
+        size_t required = lambda->GetRequiredArgs();
+        std::copy(args, args + required, frames.begin() + frame_base);
+        if (lambda->IsVariadic()) {
+            Value rest;
+            for (size_t i = count; i > required; --i) {
+                rest = New<Cell>(args[i - 1], std::move(rest));
+            }
+            frames[frame_base + required] = rest ? std::move(rest) : EmptyList::Get();
+        }
+    }
+
+    // Evaluation keeps its pending work on explicit stacks instead of recursing, so the depth
+    // of the code it runs is bounded by memory and the depth limit only.
+    enum class TaskKind : uint8_t {
+        CALL,
+        FORM,
+        DEFINE,
+        LET,
+        BODY,
+        APPLICATION,
+        LIST,
+        MEMO,
+        RETURN
+    };
+
+    // A node whose evaluation is under way. step counts its progress and base is where the
+    // values it has collected start on the value stack. A RETURN task ends a closure call:
+    // node is the calling closure, step the calling frame base and base the position of the
+    // callee, which stays on the value stack while it runs.
+    struct Task {
+        TaskKind kind;
+        const Object* node;
+        size_t step;
+        size_t base;
+    };
+
+    thread_local std::vector<Task> tasks;
+    thread_local std::vector<Value> values;
+
+    void PushTask(TaskKind kind, const Object* node) {
+        tasks.push_back({kind, node, 0, values.size()});
+        CheckDepth(tasks.size());
+        if (auto stats = StatsCollector::Current()) {
+            stats->CountDepth(tasks.size());
+        }
+    }
+
+    // Replaces the top task by its result.
+    void Finish(Value result) {
+        auto base = tasks.back().base;
+        tasks.pop_back();
+        values.resize(base);
+        values.push_back(std::move(result));
+    }
+
+    // Argument vectors of finished builtin calls. Reusing them saves an allocation per call;
+    // a builtin that evaluates code takes a vector of its own from here.
+    constexpr size_t kMaxSpareArgs = 16;
+    thread_local std::vector<std::vector<Value>> spare_args;
+
+    // Moves the values from base on into an argument vector.
+    std::vector<Value> PopArgs(size_t base) {
+        std::vector<Value> args;
+        if (!spare_args.empty()) {
+            args = std::move(spare_args.back());
+            spare_args.pop_back();
+        }
+        args.assign(std::make_move_iterator(values.begin() + base),
+                    std::make_move_iterator(values.end()));
+        values.resize(base);
+        return args;
+    }
+
+    void RecycleArgs(std::vector<Value> args) {
+        if (spare_args.size() < kMaxSpareArgs) {
+            args.clear();
+            spare_args.push_back(std::move(args));
+        }
+    }
+
+    // Starts evaluating ast. Pushes its value right away if that takes no further steps,
+    // otherwise pushes the task for it and returns true.
+    bool Schedule(const Value& ast) {
+        if (!ast) {
+            throw RuntimeError{"Evaluating Nothing"};
+        }
+        RunBudget::ChargeStep();
+        if (auto stats = StatsCollector::Current()) {
+            stats->CountEvaluation();
+        }
+        auto node = ast.Get();
+        if (!node) {
+            values.push_back(ast);
+            return false;
+        }
+        switch (node->GetType()) {
+            case ObjectType::EMPTY_LIST:
+                throw RuntimeError{"Evaluating Wrong Type"};
+            case ObjectType::CALL:
+                PushTask(TaskKind::CALL, node);
+                return true;
+            case ObjectType::VARIABLE:
+                values.push_back(LoadVariable(static_cast<Variable*>(node)));
+                return false;
+            case ObjectType::LAMBDA:
+                values.push_back(MakeClosure(static_cast<Lambda*>(node)));
+                return false;
+            case ObjectType::FORM:
+                PushTask(TaskKind::FORM, node);
+                return true;
+            case ObjectType::DEFINE:
+                PushTask(TaskKind::DEFINE, node);
+                return true;
+            case ObjectType::LET:
+                PushTask(TaskKind::LET, node);
+                return true;
+            case ObjectType::APPLICATION:
+                PushTask(TaskKind::APPLICATION, node);
+                return true;
+            case ObjectType::CELL:
+                PushTask(TaskKind::LIST, node);
+                return true;
+            case ObjectType::MEMO:
+                PushTask(TaskKind::MEMO, node);
+                return true;
+            default:
+                values.push_back(ast);
+                return false;
+        }
+    }
+
+    // Evaluates the remaining arguments of a builtin call that do not need a task of their own
+    // and applies it once all are there. Returns true while it waits for an argument.
+    bool ContinueCall(Task& task) {
+        auto call = static_cast<const Call*>(task.node);
+        const auto& args = call->GetArgs();
+        while (task.step < args.size()) {
+            const auto& arg = args[task.step++];
+            if (!NeedsEvaluation(arg)) {
+                values.push_back(arg);
+            } else if (Schedule(arg)) {
+                return true;
+            }
+        }
+        auto collected = PopArgs(task.base);
+        auto result = call->IsArityValid() ? call->GetBuiltin()->ApplyUnchecked(collected)
+                                           : call->GetBuiltin()->Apply(collected);
+        RecycleArgs(std::move(collected));
+        Finish(std::move(result));
+        return false;
+    }
+
+    // Asks a special form what to do until it waits for an operand, is replaced by one or has
+    // its result. step is 1 + the operand whose value is on top of the value stack, or 0.
+    void ContinueForm(Task& task) {
+        auto form = static_cast<const Form*>(task.node);
+        auto next = form->GetSpecialForm()->next;
+        while (true) {
+            auto action = next(*form, task.step, task.step > 0 ? &values.back() : nullptr);
+            if (task.step > 0) {
+                values.pop_back();
+            }
+            switch (action.action) {
+                case FormStep::Action::EVALUATE:
+                    task.step = action.operand + 1;
+                    if (Schedule(form->GetOperands()[action.operand])) {
+                        return;
+                    }
+                    break;
+                case FormStep::Action::TAIL:
+                    tasks.pop_back();
+                    Schedule(form->GetOperands()[action.operand]);
+                    return;
+                case FormStep::Action::RESULT:
+                    Finish(std::move(action.result));
+                    return;
+            }
+        }
+    }
+
+    const Body& GetBody(const Object* node) {
+        if (node->GetType() == ObjectType::LAMBDA) {
+            return static_cast<const Lambda*>(node)->GetBody();
+        }
+        return static_cast<const Let*>(node)->GetBody();
+    }
+
+    // One run of the evaluation loop, from the tasks it is started with until they are done.
+    // Whatever it leaves on the shared stacks is dropped when it ends, also by an exception.
+    class Evaluation {
+    public:
+        Evaluation()
+            : task_base_(tasks.size()),
+              value_base_(values.size()),
+              frames_size_(frames.size()),
+              frame_base_(frame_base),
+              closure_(current_closure) {
+        }
+
+        ~Evaluation() {
+            tasks.resize(task_base_);
+            values.resize(value_base_);
+            frames.resize(frames_size_);
+            frame_base = frame_base_;
+            current_closure = closure_;
+        }
+
+        Evaluation(const Evaluation&) = delete;
+        Evaluation& operator=(const Evaluation&) = delete;
+
+        Value Run() {
+            while (tasks.size() > task_base_) {
+                Step();
+            }
+            return std::move(values.back());
+        }
+
+    private:
+        void Step() {
+            auto& task = tasks.back();
+            switch (task.kind) {
+                case TaskKind::CALL:
+                    ContinueCall(task);
+                    return;
+                case TaskKind::FORM:
+                    ContinueForm(task);
+                    return;
+                case TaskKind::DEFINE: {
+                    auto define = static_cast<const Define*>(task.node);
+                    if (task.step == 0) {
+                        task.step = 1;
+                        if (Schedule(define->GetValue())) {
+                            return;
+                        }
+                    }
+                    if (auto globals = define->GetGlobals()) {
+                        globals->Define(define->GetName(), std::move(values.back()));
+                    } else {
+                        LoadBoxed(define->GetAddress()) = std::move(values.back());
+                    }
+                    Finish(Symbol::Intern(define->GetName()));
+                    return;
+                }
+                case TaskKind::LET: {
+                    auto let = static_cast<const Let*>(task.node);
+                    const auto& inits = let->GetInits();
+                    while (true) {
+                        if (task.step > 0) {
+                            frames[frame_base + let->GetFirstSlot() + task.step - 1] =
+                                    std::move(values.back());
+                            values.pop_back();
+                        }
+                        if (task.step == inits.size()) {
+                            break;
+                        }
+                        if (Schedule(inits[task.step++])) {
+                            return;
+                        }
+                    }
+                    task = {TaskKind::BODY, let, 0, values.size()};
+                    return;
+                }
+                case TaskKind::BODY: {
+                    const auto& body = GetBody(task.node);
+                    if (task.step == 0 && body.environment_size) {
+                        frames[frame_base + body.environment_slot] =
+                                New<Environment>(body.environment_size);
+                    }
+                    if (task.step > 0) {
+                        values.pop_back();
+                    }
+                    while (task.step + 1 < body.forms.size()) {
+                        if (Schedule(body.forms[task.step++])) {
+                            return;
+                        }
+                        values.pop_back();
+                    }
+                    // The last form takes the place of the body: it is in tail position.
+                    tasks.pop_back();
+                    Schedule(body.forms.back());
+                    return;
+                }
+                case TaskKind::APPLICATION: {
+                    auto application = static_cast<const Application*>(task.node);
+                    if (task.step == 0) {
+                        task.step = 1;
+                        if (Schedule(application->GetOperator())) {
+                            return;
+                        }
+                    }
+                    if (task.step == 1) {
+                        auto symbol = As<Symbol>(values[task.base]);
+                        if (symbol && symbol->GetId() == kQuoteSymbol) {
+                            Finish(QuoteOperands(application->GetOperands()));
+                            return;
+                        }
+                    }
+                    const auto& args = application->GetArgs();
+                    while (task.step <= args.size()) {
+                        const auto& arg = args[task.step++ - 1];
+                        if (!NeedsEvaluation(arg)) {
+                            values.push_back(arg);
+                        } else if (Schedule(arg)) {
+                            return;
+                        }
+                    }
+                    Apply(task.base);
+                    return;
+                }
+                case TaskKind::LIST: {
+                    // A list the resolver left alone. Mirrors FillVectorOfArgs: only nested
+                    // lists among the operands are evaluated.
+                    auto cell = static_cast<const Cell*>(task.node);
+                    switch (task.step) {
+                        case 0:
+                            task.step = 1;
+                            Schedule(cell->GetFirst());
+                            return;
+                        case 1: {
+                            auto symbol = As<Symbol>(values[task.base]);
+                            if (symbol && symbol->GetId() == kQuoteSymbol) {
+                                Finish(QuoteOperands(cell->GetSecond()));
+                                return;
+                            }
+                            const auto& second = cell->GetSecond();
+                            auto node = As<Cell>(second);
+                            task.step = 3;
+                            if (!node) {
+                                if (second && !Is<EmptyList>(second)) {
+                                    values.push_back(second);
+                                }
+                            } else if (!node->GetFirst() && !node->GetSecond()) {
+                                values.push_back(EmptyList::Get());
+                            } else {
+                                task.node = node;
+                                task.step = 2;
+                            }
+                            return;
+                        }
+                        case 2: {
+                            const auto& first = cell->GetFirst();
+                            task.step = 4;
+                            if (Is<Cell>(first)) {
+                                Schedule(first);
+                            } else {
+                                values.push_back(first);
+                            }
+                            return;
+                        }
+                        case 4: {
+                            const auto& second = cell->GetSecond();
+                            if (auto node = As<Cell>(second)) {
+                                task.node = node;
+                                task.step = 2;
+                                return;
+                            }
+                            if (second && !Is<EmptyList>(second)) {
+                                values.push_back(second);
+                            }
+                            task.step = 3;
+                            return;
+                        }
+                        default: {
+                            auto left = values[task.base];
+                            auto symbol = As<Symbol>(left);
+                            if (!symbol) {
+                                throw RuntimeError{"Evaluating Wrong Type"};
+                            }
+                            auto builtin = FindBuiltin(symbol->GetId());
+                            if (!builtin) {
+                                Finish(std::move(left));
+                                return;
+                            }
+                            auto collected = PopArgs(task.base + 1);
+                            auto result = builtin->Apply(collected);
+                            RecycleArgs(std::move(collected));
+                            Finish(std::move(result));
+                            return;
+                        }
+                    }
+                }
+                case TaskKind::MEMO: {
+                    auto memo = static_cast<const Memo*>(task.node);
+                    auto cache = memo->GetCache();
+                    if (task.step == 0) {
+                        Value result;
+                        if (cache->Find(memo->GetSource(), memo->GetHash(), &result)) {
+                            Finish(std::move(result));
+                            return;
+                        }
+                        task.step = 1;
+                        if (Schedule(memo->GetExpression())) {
+                            return;
+                        }
+                    }
+                    auto result = std::move(values.back());
+                    // A result the cache could not keep past the run is not cached.
+                    if (auto promoted = TryPromote(result)) {
+                        cache->Store(Promote(memo->GetSource()), memo->GetHash(),
+                                     std::move(*promoted));
+                    }
+                    Finish(std::move(result));
+                    return;
+                }
+                case TaskKind::RETURN: {
+                    auto result = std::move(values.back());
+                    frames.resize(frame_base);
+                    frame_base = task.step;
+                    current_closure = static_cast<const Closure*>(task.node);
+                    Finish(std::move(result));
+                    return;
+                }
+            }
+        }
+
+        // Applies the operator at values[base] to the values after it.
+        void Apply(size_t base) {
+            size_t count = values.size() - base - 1;
+            auto& op = values[base];
+            if (auto closure = As<Closure>(op)) {
+                auto lambda = closure->GetLambda();
+                CheckArity(lambda, count);
+                auto args = std::make_move_iterator(values.begin() + base + 1);
+                auto& task = tasks.back();
+                bool tail_call = tasks.size() - 1 > task_base_ &&
+                                 tasks[tasks.size() - 2].kind == TaskKind::RETURN;
+                if (tail_call) {
+                    // Nothing is left to do in the calling frame: reuse it, and keep the callee
+                    // alive where the caller was.
+                    auto caller = tasks[tasks.size() - 2].base;
+                    frames.resize(frame_base);
+                    frames.resize(frame_base + lambda->GetFrameSize());
+                    BindArguments(lambda, args, count);
+                    values[caller] = std::move(op);
+                    values.resize(caller + 1);
+                    current_closure = closure;
+                    task = {TaskKind::BODY, lambda, 0, values.size()};
+                    return;
+                }
+                task = {TaskKind::RETURN, current_closure, frame_base, base};
+                frame_base = frames.size();
+                frames.resize(frame_base + lambda->GetFrameSize());
+                BindArguments(lambda, args, count);
+                values.resize(base + 1);
+                current_closure = closure;
+                PushTask(TaskKind::BODY, lambda);
+                return;
+            }
+            auto symbol = As<Symbol>(op);
+            if (!symbol) {
+                throw RuntimeError{"Evaluating Wrong Type"};
+            }
+            auto builtin = FindBuiltin(symbol->GetId());
+            if (!builtin) {
+                Finish(op);
+                return;
+            }
+            auto collected = PopArgs(base + 1);
+            auto result = builtin->Apply(collected);
+            RecycleArgs(std::move(collected));
+            Finish(std::move(result));
+        }
+
+        size_t task_base_;
+        size_t value_base_;
+        size_t frames_size_;
+        size_t frame_base_;
+        const Closure* closure_;
+    };
+}  // namespace
+
+bool Builtin::AcceptsArgs(size_t count) const {
+    return min_args <= count && count <= max_args;
+}
+
+Value Builtin::Apply(const std::vector<Value>& args) const {
+    if (!AcceptsArgs(args.size())) {
+        throw RuntimeError{"Invalid Number of Arguments for : " + GetSymbolName(name)};
+    }
+    return ApplyUnchecked(args);
+}
+
+Value Builtin::ApplyUnchecked(const std::vector<Value>& args) const {
+    RunBudget::ChargeStep();
+    auto stats = StatsCollector::Current();
+    if (!stats) {
+        return function->Apply(args);
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto count = [&] {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        stats->CountBuiltin(
+            name, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    };
+    try {
+        auto result = function->Apply(args);
+        count();
+        return result;
+    } catch (...) {
+        count();
+        throw;
+    }
+}
+
+const Builtin* FindBuiltin(SymbolId id) {
+    return id < builtins.size() && builtins[id].function ? &builtins[id] : nullptr;
+}
+
+const std::vector<Builtin>& GetBuiltins() {
+    return builtins;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Special Forms
+
+namespace {
+    FormStep EvaluateOperand(size_t operand) {
+        return {FormStep::Action::EVALUATE, operand, {}};
+    }
+
+    FormStep TailOperand(size_t operand) {
+        return {FormStep::Action::TAIL, operand, {}};
+    }
+
+    FormStep Result(Value result) {
+        return {FormStep::Action::RESULT, 0, std::move(result)};
+    }
+
+    bool IsFalse(const Value& value) {
+        return Is<Boolean>(value) && !value.GetBoolean();
+    }
+
+    // Evaluates operand next of a sequence of expressions that ends before end, in which the last
+    // one is in tail position.
+    FormStep ContinueSequence(size_t next, size_t end) {
+        return next + 1 == end ? TailOperand(next) : EvaluateOperand(next);
+    }
+
+    FormStep IfNext(const Form& form, size_t evaluated, const Value* value) {
+        if (evaluated == 0) {
+            return EvaluateOperand(0);
+        }
+        if (IsTrue(*value)) {
+            return TailOperand(1);
+        }
+        if (form.GetOperands().size() == 3) {
+            return TailOperand(2);
+        }
+        return Result(EmptyList::Get());
+    }
+
+    // Stops at the first #f, or evaluates to the last value.
+    FormStep AndNext(const Form& form, size_t evaluated, const Value* value) {
+        const auto& operands = form.GetOperands();
+        if (operands.empty()) {
+            return Result(Value::FromBoolean(true));
+        }
+        if (evaluated > 0 && IsFalse(*value)) {
+            return Result(*value);
+        }
+        return ContinueSequence(evaluated, operands.size());
+    }
+
+    // Stops at the first value other than #f and (), or evaluates to #f.
+    FormStep OrNext(const Form& form, size_t evaluated, const Value* value) {
+        if (evaluated > 0 && !IsFalse(*value) && !Is<EmptyList>(*value)) {
+            return Result(*value);
+        }
+        if (evaluated == form.GetOperands().size()) {
+            return Result(Value::FromBoolean(false));
+        }
+        return EvaluateOperand(evaluated);
+    }
+
+    // Like if without an alternative, but with any number of expressions after the test.
+    FormStep WhenNext(const Form& form, size_t evaluated, const Value* value) {
+        if (evaluated == 0) {
+            return EvaluateOperand(0);
+        }
+        if (evaluated == 1 && !IsTrue(*value)) {
+            return Result(EmptyList::Get());
+        }
+        return ContinueSequence(evaluated, form.GetOperands().size());
+    }
+
+    // Tries the test of each clause in turn and runs the expressions of the first true one. A
+    // clause with a test only evaluates to the value of the test. Resolve turns else into #t.
+    FormStep CondNext(const Form& form, size_t evaluated, const Value* value) {
+        const auto& clauses = form.GetClauses();
+        if (evaluated == 0) {
+            return EvaluateOperand(clauses[0]);
+        }
+        auto last = evaluated - 1;
+        auto clause = std::upper_bound(clauses.begin(), clauses.end(), last) - 1;
+        size_t end = clause + 1 == clauses.end() ? form.GetOperands().size() : clause[1];
+        if (last == *clause) {
+            if (!IsTrue(*value)) {
+                return clause + 1 == clauses.end() ? Result(EmptyList::Get())
+                                                   : EvaluateOperand(clause[1]);
+            }
+            if (end == evaluated) {
+                return Result(*value);
+            }
+        }
+        return ContinueSequence(evaluated, end);
+    }
+
+    // Indexed by SymbolId from kIfSymbol on; the names of special forms have the ids after it.
+    const SpecialForm special_forms[] = {{kIfSymbol, IfNext, 2, 3},
+                                         {kAndSymbol, AndNext},
+                                         {kOrSymbol, OrNext},
+                                         {kCondSymbol, CondNext, 1, kVariadic, true},
+                                         {kWhenSymbol, WhenNext, 2}};
+
+    static_assert(std::size(special_forms) == kWhenSymbol - kIfSymbol + 1);
+}  // namespace
+
+const SpecialForm* FindSpecialForm(SymbolId id) {
+    return id >= kIfSymbol && id <= kWhenSymbol ? &special_forms[id - kIfSymbol] : nullptr;
+}
+
+const char* GetTypeName(ObjectType type) {
+    switch (type) {
+        case ObjectType::FUNCTION:
+            return "function";
+        case ObjectType::SYMBOL:
+            return "symbol";
+        case ObjectType::EMPTY_LIST:
+            return "empty-list";
+        case ObjectType::BIG_NUMBER:
+            return "big-number";
+        case ObjectType::VECTOR:
+            return "vector";
+        case ObjectType::CLOSURE:
+            return "closure";
+        case ObjectType::ENVIRONMENT:
+            return "environment";
+        case ObjectType::CELL:
+            return "cell";
+        case ObjectType::CALL:
+            return "call";
+        case ObjectType::VARIABLE:
+            return "variable";
+        case ObjectType::LAMBDA:
+            return "lambda";
+        case ObjectType::FORM:
+            return "form";
+        case ObjectType::DEFINE:
+            return "define";
+        case ObjectType::LET:
+            return "let";
+        case ObjectType::APPLICATION:
+            return "application";
+        case ObjectType::MEMO:
+            return "memo";
+    }
+    return "unknown";
+}
+
+Value Object::Apply(const std::vector<Value>&) {
+    throw NotImplementedError(__PRETTY_FUNCTION__);
+}
+
+Value Value::FromNumber(int64_t value) {
+    Value result;
+    result.tag_ = Tag::NUMBER;
+    result.number_ = value;
+    return result;
+}
+
+Value Value::FromBoolean(bool state) {
+    Value result;
+    result.tag_ = Tag::BOOLEAN;
+    result.state_ = state;
+    return result;
+}
+
+Value Value::Borrow(Object* object) {
+    Value result;
+    result.object_ = object;
+    return result;
+}
+
+std::string Value::Serialize() const {
+    std::string result;
+    SerializeTo(*this, &result);
+    return result;
+}
+
+void SerializeTo(const Value& value, std::string* out) {
+    Printer{out, nullptr}.Print(value);
+}
+
+void SerializeTo(const Value& value, std::ostream* out) {
+    std::string buffer;
+    Printer{&buffer, out}.Print(value);
+}
+
+Symbol::Symbol(SymbolId id) : Object(kType), id_(id), name_(&GetSymbolName(id)) {
+}
+
+Value Symbol::Intern(SymbolId id) {
+    // Symbols never move or die, so each thread can remember the ones it has seen and skip
+    // the shared lock next time.
+    thread_local std::vector<Symbol*> cache;
+    if (id < cache.size() && cache[id]) {
+        return Value::Borrow(cache[id]);
+    }
+
+    static std::shared_mutex mutex;
+    static std::deque<Symbol> symbols;
+    Symbol* symbol = nullptr;
+    {
+        std::shared_lock lock{mutex};
+        if (id < symbols.size()) {
+            symbol = &symbols[id];
+        }
+    }
+    if (!symbol) {
+        std::unique_lock lock{mutex};
+        while (symbols.size() <= id) {
+            symbols.emplace_back(symbols.size());
+        }
+        symbol = &symbols[id];
+    }
+    if (cache.size() <= id) {
+        cache.resize(id + 1);
+    }
+    cache[id] = symbol;
+    return Value::Borrow(symbol);
+}
+
+Value Symbol::Intern(std::string_view name) {
+    return Intern(InternSymbol(name));
+}
+
+SymbolId Symbol::GetId() const {
+    return id_;
+}
+
+const std::string& Symbol::GetName() const {
+    return *name_;
+}
+
+std::string Symbol::Serialize() {
+    return GetName();
+}
+
+Cell::Cell(Value first, Value second)
+        : Object(kType), first_(std::move(first)), second_(std::move(second)) {
+}
+
+const Value& Cell::GetFirst() const {
+    return first_;
+}
+
+const Value& Cell::GetSecond() const {
+    return second_;
+}
+
+void Cell::SetFirst(Value first) {
+    first_ = std::move(first);
+}
+
+void Cell::SetSecond(Value second) {
+    second_ = std::move(second);
+}
+
+std::string Cell::Serialize() {
+    return Value::Borrow(this).Serialize();
+}
+
+void Cell::Trace(Tracer* tracer) const {
+    tracer->Mark(first_);
+    tracer->Mark(second_);
+}
+
+namespace {
+    // Appends each form to list, after a space, and closes it.
+    std::string SerializeForms(std::string list, const std::vector<Value>& forms) {
+        for (const auto& form : forms) {
+            list += ' ';
+            list += form ? form.Serialize() : "()";
+        }
+        return list + ')';
+    }
+}  // namespace
+
+Call::Call(const Builtin* builtin, std::vector<Value> args)
+    : Object(kType),
+      builtin_(builtin),
+      args_(std::move(args)),
+      arity_valid_(builtin->AcceptsArgs(args_.size())) {
 }
 
-std::shared_ptr<Object> CompareOp(const std::vector<std::shared_ptr<Object>>& numbers,
-                                  size_t start_pos,
-std::function<bool(int64_t lhs, int64_t rhs)> op) {
-if (numbers.empty()) {
-return std::make_shared<Boolean>(true);
+const Builtin* Call::GetBuiltin() const {
+    return builtin_;
 }
-if (!Is<Number>(numbers[0])) {
-throw RuntimeError{"Not IntType" + std::string(__PRETTY_FUNCTION__)};
+
+const std::vector<Value>& Call::GetArgs() const {
+    return args_;
+}
+
+bool Call::IsArityValid() const {
+    return arity_valid_;
+}
+
+std::string Call::Serialize() {
+    return SerializeForms("(" + GetSymbolName(builtin_->name), args_);
 }
-return std::make_shared<Boolean>(
-        std::all_of(numbers.begin() + start_pos, numbers.end(), [&](auto arg) {
-    if (!Is<Number>(arg)) {
-        throw RuntimeError{"Not IntType" + std::string(__PRETTY_FUNCTION__)};
+
+void Call::Trace(Tracer* tracer) const {
+    for (const auto& arg : args_) {
+        tracer->Mark(arg);
     }
-    return op(As<Number>(numbers[0])->GetValue(), As<Number>(arg)->GetValue());
-}));
 }
-}  // namespace
 
-Number::Number(int value) : value_(value) {
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Variables
+
+Environment::Environment(size_t size) : Object(kType), slots_(size) {
 }
 
-int Number::GetValue() const {
-    return value_;
+Value& Environment::At(size_t offset) {
+    return slots_[offset];
+}
+
+void Environment::Trace(Tracer* tracer) const {
+    for (const auto& slot : slots_) {
+        tracer->Mark(slot);
+    }
+}
+
+Value* GlobalEnvironment::GetSlot(SymbolId name) {
+    {
+        std::shared_lock lock{mutex_};
+        if (name < index_.size() && index_[name]) {
+            return index_[name];
+        }
+    }
+    std::unique_lock lock{mutex_};
+    if (index_.size() <= name) {
+        index_.resize(name + 1);
+    }
+    if (!index_[name]) {
+        index_[name] = &slots_.emplace_back();
+    }
+    return index_[name];
 }
 
-std::string Number::Serialize() {
-    return std::to_string(value_);
+void GlobalEnvironment::Define(SymbolId name, Value value) {
+    if (!CopyOutOfArena(&value)) {
+        ++definitions_;
+    }
+    *GetSlot(name) = std::move(value);
 }
 
-std::shared_ptr<Object> Number::MakeCopy() {
-    return std::make_shared<Number>(value_);
+size_t GlobalEnvironment::CountDefinitions() const {
+    return definitions_;
 }
 
-Symbol::Symbol(const std::string& name) : name_(name) {
+void GlobalEnvironment::SetReadOnly(bool read_only) {
+    read_only_ = read_only;
 }
 
-const std::string& Symbol::GetName() const {
-    return name_;
+bool GlobalEnvironment::IsReadOnly() const {
+    return read_only_;
 }
 
-std::string Symbol::Serialize() {
+void GlobalEnvironment::Trace(Tracer* tracer) const {
+    std::shared_lock lock{mutex_};
+    for (const auto& slot : slots_) {
+        tracer->Mark(slot);
+    }
+}
+
+Variable::Variable(SymbolId name, Address address)
+    : Object(kType), name_(name), address_(address), global_(nullptr) {
+}
+
+Variable::Variable(SymbolId name, Value* global)
+    : Object(kType), name_(name), global_(global) {
+}
+
+SymbolId Variable::GetName() const {
     return name_;
 }
 
-std::shared_ptr<Object> Symbol::MakeCopy() {
-    return std::make_shared<Symbol>(name_);
+const Address& Variable::GetAddress() const {
+    return address_;
 }
 
-Cell::Cell(std::shared_ptr<Object> first, std::shared_ptr<Object> second)
-        : first_(first), second_(second) {
+Value* Variable::GetGlobal() const {
+    return global_;
 }
 
-Boolean::Boolean(bool state) : state_(state) {
+std::string Variable::Serialize() {
+    return GetSymbolName(name_);
 }
 
-bool Boolean::GetState() const {
-    return state_;
+Lambda::Lambda(uint32_t required_args, bool variadic, uint32_t frame_size,
+               std::vector<Address> captures, Body body)
+    : Object(kType),
+      required_args_(required_args),
+      variadic_(variadic),
+      frame_size_(frame_size),
+      captures_(std::move(captures)),
+      body_(std::move(body)) {
 }
 
-std::string Boolean::Serialize() {
-    return state_ ? "#t" : "#f";
+uint32_t Lambda::GetRequiredArgs() const {
+    return required_args_;
 }
 
-std::shared_ptr<Object> Boolean::MakeCopy() {
-    return std::make_shared<Boolean>(state_);
+bool Lambda::IsVariadic() const {
+    return variadic_;
 }
 
-std::shared_ptr<Object> Cell::GetFirst() const {
-    return first_;
+uint32_t Lambda::GetFrameSize() const {
+    return frame_size_;
 }
 
-std::shared_ptr<Object> Cell::GetSecond() const {
-    return second_;
+const std::vector<Address>& Lambda::GetCaptures() const {
+    return captures_;
 }
 
-void Cell::SetFirst(std::shared_ptr<Object> first) {
-    first_ = first;
+const Body& Lambda::GetBody() const {
+    return body_;
 }
 
-void Cell::SetSecond(std::shared_ptr<Object> second) {
-    second_ = second;
+void Lambda::SetCode(std::shared_ptr<const Program> program, uint32_t entry) {
+    program_ = std::move(program);
+    entry_ = entry;
 }
 
-std::string Cell::Serialize() {
-    if (!first_ && !second_) {
-        return "()";
-    }
-    std::string list = "(" + first_->Serialize();
-    while (second_ && !Is<EmptyList>(second_)) {
-        list += ' ';
-        if (!Is<Cell>(second_) && !Is<EmptyList>(second_)) {
-            list += ". ";
-            list += second_->Serialize();
-            break;
-        }
-        if (!Is<Cell>(second_)) {
-            break;
-        }
-        if (As<Cell>(second_)->GetFirst()) {
-            list += As<Cell>(second_)->GetFirst()->Serialize();
+const Program* Lambda::GetProgram() const {
+    return program_.get();
+}
+
+uint32_t Lambda::GetEntry() const {
+    return entry_;
+}
+
+// Parameters are only known by their slots, so only how many there are is shown.
+std::string Lambda::Serialize() {
+    auto arity = "(lambda #<arity " + std::to_string(required_args_) + (variadic_ ? "+>" : ">");
+    return SerializeForms(std::move(arity), body_.forms);
+}
+
+void Lambda::Trace(Tracer* tracer) const {
+    for (const auto& form : body_.forms) {
+        tracer->Mark(form);
+    }
+    // The bytecode may use constants of its own, made when it was compiled.
+    if (program_) {
+        for (const auto& constant : program_->constants) {
+            tracer->Mark(constant);
         }
-        second_ = As<Cell>(second_)->GetSecond();
     }
-    list += ')';
-    return list;
 }
 
-void FillVectorOfArgs(std::shared_ptr<Object> object, std::vector<std::shared_ptr<Object>>& args) {
-    if (!object) {
-        return;
+Closure::Closure(const Lambda* lambda, std::vector<Value> captured)
+    : Object(kType), lambda_(lambda), captured_(std::move(captured)) {
+}
+
+Value Closure::Apply(const std::vector<Value>& args) {
+    CheckArity(lambda_, args.size());
+    Frame frame{this, lambda_->GetFrameSize()};
+    BindArguments(lambda_, args.data(), args.size());
+    Evaluation evaluation;
+    PushTask(TaskKind::BODY, lambda_);
+    return evaluation.Run();
+}
+
+const Lambda* Closure::GetLambda() const {
+    return lambda_;
+}
+
+const Value& Closure::GetCaptured(size_t index) const {
+    return captured_[index];
+}
+
+std::string Closure::Serialize() {
+    return "#<procedure>";
+}
+
+void Closure::Trace(Tracer* tracer) const {
+    tracer->Mark(lambda_);
+    for (const auto& value : captured_) {
+        tracer->Mark(value);
     }
-    if ((Is<Cell>(object) && !As<Cell>(object)->GetFirst() && !As<Cell>(object)->GetSecond())) {
-        args.push_back(std::make_shared<EmptyList>());
-        return;
+}
+
+Form::Form(const SpecialForm* form, std::vector<Value> operands, std::vector<uint32_t> clauses)
+    : Object(kType), form_(form), operands_(std::move(operands)), clauses_(std::move(clauses)) {
+}
+
+const SpecialForm* Form::GetSpecialForm() const {
+    return form_;
+}
+
+const std::vector<Value>& Form::GetOperands() const {
+    return operands_;
+}
+
+const std::vector<uint32_t>& Form::GetClauses() const {
+    return clauses_;
+}
+
+std::string Form::Serialize() {
+    auto name = "(" + GetSymbolName(form_->name);
+    if (!form_->clauses) {
+        return SerializeForms(std::move(name), operands_);
     }
+    for (size_t i = 0; i < clauses_.size(); ++i) {
+        auto test = operands_.begin() + clauses_[i];
+        auto end = i + 1 < clauses_.size() ? operands_.begin() + clauses_[i + 1] : operands_.end();
+        name += " (" + test->Serialize();
+        name += SerializeForms("", std::vector<Value>(test + 1, end));
+    }
+    return name + ')';
+}
 
-    if (Is<Number>(object) || Is<Boolean>(object) || Is<Symbol>(object)) {
-        args.push_back(object);
-        return;
+void Form::Trace(Tracer* tracer) const {
+    for (const auto& operand : operands_) {
+        tracer->Mark(operand);
     }
-    auto node = object;
-    while (node && !Is<EmptyList>(node)) {
-        if (!Is<Cell>(node)) {
-            args.push_back(node);
-            break;
-        }
-        if (Is<Cell>(As<Cell>(node)->GetFirst())) {
-            args.push_back(Evaluate(As<Cell>(node)->GetFirst()));
-        } else {
-            args.push_back(As<Cell>(node)->GetFirst());
+}
+
+Define::Define(SymbolId name, GlobalEnvironment* globals, Value value)
+    : Object(kType), name_(name), globals_(globals), value_(std::move(value)) {
+}
+
+Define::Define(SymbolId name, Address address, Value value)
+    : Object(kType), name_(name), globals_(nullptr), address_(address), value_(std::move(value)) {
+}
+
+SymbolId Define::GetName() const {
+    return name_;
+}
+
+GlobalEnvironment* Define::GetGlobals() const {
+    return globals_;
+}
+
+const Address& Define::GetAddress() const {
+    return address_;
+}
+
+const Value& Define::GetValue() const {
+    return value_;
+}
+
+std::string Define::Serialize() {
+    return SerializeForms("(define " + GetSymbolName(name_), {value_});
+}
+
+void Define::Trace(Tracer* tracer) const {
+    tracer->Mark(value_);
+}
+
+Let::Let(uint32_t first_slot, std::vector<Value> inits, Body body)
+    : Object(kType), first_slot_(first_slot), inits_(std::move(inits)), body_(std::move(body)) {
+}
+
+uint32_t Let::GetFirstSlot() const {
+    return first_slot_;
+}
+
+const std::vector<Value>& Let::GetInits() const {
+    return inits_;
+}
+
+const Body& Let::GetBody() const {
+    return body_;
+}
+
+// Variables are only known by their slots, so only the values they are bound to are shown.
+std::string Let::Serialize() {
+    std::string let = "(let (";
+    for (size_t i = 0; i < inits_.size(); ++i) {
+        if (i > 0) {
+            let += ' ';
         }
-        node = As<Cell>(node)->GetSecond();
+        let += inits_[i] ? inits_[i].Serialize() : "()";
     }
+    return SerializeForms(let + ')', body_.forms);
 }
-std::shared_ptr<Object> Evaluate(std::shared_ptr<Object> object) {
-    if (!object) {
-        throw RuntimeError{"Evaluating Nothing"};
+
+void Let::Trace(Tracer* tracer) const {
+    for (const auto& init : inits_) {
+        tracer->Mark(init);
     }
-    if (Is<Number>(object) || Is<Boolean>(object) || Is<Symbol>(object)) {
-        return object;
+    for (const auto& form : body_.forms) {
+        tracer->Mark(form);
     }
-    auto left = Evaluate(As<Cell>(object)->GetFirst());
+}
 
-    if (Is<Symbol>(left) && As<Symbol>(left)->GetName() == "quote") {
-        if (!As<Cell>(object)->GetSecond()) {
-            return std::make_shared<EmptyList>();
-        }
-        if ((Is<Cell>(As<Cell>(object)->GetSecond()) &&
-             !As<Cell>(As<Cell>(object)->GetSecond())->GetFirst() &&
-             !As<Cell>(As<Cell>(object)->GetSecond())->GetSecond())) {
-            return std::make_shared<Cell>(std::make_shared<EmptyList>(), nullptr);
-        }
-        return std::shared_ptr<Object>(As<Cell>(object)->GetSecond());
+Application::Application(Value op, std::vector<Value> args, Value operands)
+    : Object(kType), op_(std::move(op)), args_(std::move(args)), operands_(std::move(operands)) {
+}
+
+const Value& Application::GetOperator() const {
+    return op_;
+}
+
+const std::vector<Value>& Application::GetArgs() const {
+    return args_;
+}
+
+const Value& Application::GetOperands() const {
+    return operands_;
+}
+
+std::string Application::Serialize() {
+    return SerializeForms("(" + op_.Serialize(), args_);
+}
+
+void Application::Trace(Tracer* tracer) const {
+    tracer->Mark(op_);
+    for (const auto& arg : args_) {
+        tracer->Mark(arg);
+    }
+    tracer->Mark(operands_);
+}
+
+Memo::Memo(Value expression, Value source, MemoCache* cache, std::optional<size_t> hash)
+    : Object(kType),
+      expression_(std::move(expression)),
+      source_(std::move(source)),
+      cache_(cache),
+      hash_given_(hash.has_value()),
+      hash_(hash.value_or(0)) {
+}
+
+const Value& Memo::GetExpression() const {
+    return expression_;
+}
+
+MemoCache* Memo::GetCache() const {
+    return cache_;
+}
+
+const Value& Memo::GetSource() const {
+    return source_;
+}
+
+size_t Memo::GetHash() const {
+    if (!hash_given_) {
+        // Nodes of a definition are shared by every thread that runs it.
+        std::call_once(hash_made_, [this] { hash_ = HashDatum(source_); });
     }
-    std::vector<std::shared_ptr<Object>> args;
-    FillVectorOfArgs(As<Cell>(object)->GetSecond(), args);
+    return hash_;
+}
+
+std::string Memo::Serialize() {
+    return expression_.Serialize();
+}
+
+void Memo::Trace(Tracer* tracer) const {
+    tracer->Mark(expression_);
+    tracer->Mark(source_);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    if (Is<Symbol>(left) &&
-        string_to_function.find(As<Symbol>(left)->GetName()) != string_to_function.end()) {
-        return string_to_function[As<Symbol>(left)->GetName()]->Apply(args);
+void FillVectorOfArgs(const Value& object, std::vector<Value>& args) {
+    if (!object) {
+        return;
+    }
+    auto node = As<Cell>(object);
+    if (!node) {
+        if (!Is<EmptyList>(object)) {
+            args.push_back(object);
+        }
+        return;
     }
-    if (Is<Symbol>(left)) {
-        return left;
+    if (!node->GetFirst() && !node->GetSecond()) {
+        args.push_back(EmptyList::Get());
+        return;
+    }
+    while (node) {
+        const auto& first = node->GetFirst();
+        if (Is<Cell>(first)) {
+            args.push_back(Evaluate(first));
+        } else {
+            args.push_back(first);
+        }
+        const auto& second = node->GetSecond();
+        node = As<Cell>(second);
+        if (!node && second && !Is<EmptyList>(second)) {
+            args.push_back(second);
+        }
     }
-    throw RuntimeError{"Evaluating Wrong Type"};
+}
+Value Evaluate(const Value& object) {
+    Evaluation evaluation;
+    Schedule(object);
+    return evaluation.Run();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Integer Functions
 
-std::shared_ptr<Object> IsNumberFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value IsNumberFunction::Apply(const std::vector<Value>& args) {
     if (args.size() != 1) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    return std::make_shared<Boolean>(Is<Number>(args[0]));
+    return Value::FromBoolean(IsInteger(args[0]));
 }
 
-std::shared_ptr<Object> IsEqualFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
-    return CompareOp(args, 0, [](auto lhs, auto rhs) { return lhs == rhs; });
+Value IsEqualFunction::Apply(const std::vector<Value>& args) {
+    return CompareOp<Equal>(args, 0);
 }
 
-std::shared_ptr<Object> IsGreaterFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
-    return CompareOp(args, 1, [](auto lhs, auto rhs) { return lhs > rhs; });
+Value IsGreaterFunction::Apply(const std::vector<Value>& args) {
+    return CompareOp<Greater>(args, 1);
 }
 
-std::shared_ptr<Object> IsLessFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
-    return CompareOp(args, 1, [](auto lhs, auto rhs) { return lhs < rhs; });
+Value IsLessFunction::Apply(const std::vector<Value>& args) {
+    return CompareOp<Less>(args, 1);
 }
 
-std::shared_ptr<Object> IsGreaterEqualFunction::Apply(
-        const std::vector<std::shared_ptr<Object>>& args) {
-    return CompareOp(args, 0, [](auto lhs, auto rhs) { return lhs >= rhs; });
+Value IsGreaterEqualFunction::Apply(const std::vector<Value>& args) {
+    return CompareOp<GreaterEqual>(args, 0);
 }
 
-std::shared_ptr<Object> IsLessEqualFunction::Apply(
-        const std::vector<std::shared_ptr<Object>>& args) {
-    return CompareOp(args, 0, [](auto lhs, auto rhs) { return lhs <= rhs; });
+Value IsLessEqualFunction::Apply(const std::vector<Value>& args) {
+    return CompareOp<LessEqual>(args, 0);
 }
 
-std::shared_ptr<Object> AdditionFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
-    return ArithmeticOp(args, 0, std::make_shared<Number>(0),
-                        [](auto lhs, auto rhs) { return lhs + rhs; });
+Value AdditionFunction::Apply(const std::vector<Value>& args) {
+    return ArithmeticOp<Addition>(args, 0, Value::FromNumber(0));
 }
 
-std::shared_ptr<Object> SubtractionFunction::Apply(
-        const std::vector<std::shared_ptr<Object>>& args) {
+Value SubtractionFunction::Apply(const std::vector<Value>& args) {
     if (args.empty()) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    return ArithmeticOp(args, 1, args[0], [](auto lhs, auto rhs) { return lhs - rhs; });
+    return ArithmeticOp<Subtraction>(args, 1, args[0]);
 }
 
-std::shared_ptr<Object> MultiplicationFunction::Apply(
-        const std::vector<std::shared_ptr<Object>>& args) {
-    return ArithmeticOp(args, 0, std::make_shared<Number>(1),
-                        [](auto lhs, auto rhs) { return lhs * rhs; });
+Value MultiplicationFunction::Apply(const std::vector<Value>& args) {
+    return ArithmeticOp<Multiplication>(args, 0, Value::FromNumber(1));
 }
 
-std::shared_ptr<Object> DivisionFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value DivisionFunction::Apply(const std::vector<Value>& args) {
     if (args.empty()) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    return ArithmeticOp(args, 1, args[0], [](auto lhs, auto rhs) { return lhs / rhs; });
+    return ArithmeticOp<Division>(args, 1, args[0]);
 }
 
-std::shared_ptr<Object> MaxFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value MaxFunction::Apply(const std::vector<Value>& args) {
     if (args.empty()) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    if (std::none_of(args.begin(), args.end(), [](auto object) { return Is<Number>(object); })) {
-        throw RuntimeError{"Incorrect Type for :" + std::string(__PRETTY_FUNCTION__)};
-    }
-    return *std::max_element(args.begin(), args.end(), [](auto lhs, auto rhs) {
-        return As<Number>(lhs)->GetValue() < As<Number>(rhs)->GetValue();
-    });
+    return ExtremumOp<Greater>(args);
 }
 
-std::shared_ptr<Object> MinFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value MinFunction::Apply(const std::vector<Value>& args) {
     if (args.empty()) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    if (std::none_of(args.begin(), args.end(), [](auto object) { return Is<Number>(object); })) {
-        throw RuntimeError{"Incorrect Type for :" + std::string(__PRETTY_FUNCTION__)};
-    }
-    return *std::min_element(args.begin(), args.end(), [](auto lhs, auto rhs) {
-        return As<Number>(lhs)->GetValue() < As<Number>(rhs)->GetValue();
-    });
+    return ExtremumOp<Less>(args);
 }
 
-std::shared_ptr<Object> AbsFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value AbsFunction::Apply(const std::vector<Value>& args) {
     if (args.size() != 1) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    if (!Is<Number>(args[0])) {
+    if (!IsInteger(args[0])) {
         throw RuntimeError{"Incorrect Type for :" + std::string(__PRETTY_FUNCTION__)};
     }
-    return std::make_shared<Number>(std::abs(As<Number>(args[0])->GetValue()));
+    if (Is<Number>(args[0]) && args[0].GetNumber() != INT64_MIN) {
+        return Value::FromNumber(std::abs(args[0].GetNumber()));
+    }
+    auto value = ToBigInt(args[0]);
+    return BigNumber::Make(value.IsNegative() ? -value : value);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Boolean Functions
 
-std::shared_ptr<Object> IsBooleanFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value IsBooleanFunction::Apply(const std::vector<Value>& args) {
     if (args.size() != 1) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    return std::make_shared<Boolean>(Is<Boolean>(args[0]));
+    return Value::FromBoolean(Is<Boolean>(args[0]));
 }
-std::shared_ptr<Object> NotFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value NotFunction::Apply(const std::vector<Value>& args) {
     if (args.size() != 1) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
 
-    return Is<Boolean>(args[0]) ? std::make_shared<Boolean>(!As<Boolean>(args[0])->GetState())
-                                : std::make_shared<Boolean>(false);
+    return Is<Boolean>(args[0]) ? Value::FromBoolean(!args[0].GetBoolean())
+                                : Value::FromBoolean(false);
 }
-std::shared_ptr<Object> AndFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value AndFunction::Apply(const std::vector<Value>& args) {
     if (args.empty()) {
-        return std::make_shared<Boolean>(true);
+        return Value::FromBoolean(true);
     }
-    for (auto arg : args) {
-        if (Is<Boolean>(arg) && !As<Boolean>(arg)->GetState()) {
+    for (const auto& arg : args) {
+        if (Is<Boolean>(arg) && !arg.GetBoolean()) {
             return arg;
         }
     }
     return args[args.size() - 1];
 }
-std::shared_ptr<Object> OrFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
-    for (auto arg : args) {
-        if (Is<Boolean>(arg) && !As<Boolean>(arg)->GetState()) {
+Value OrFunction::Apply(const std::vector<Value>& args) {
+    for (const auto& arg : args) {
+        if (Is<Boolean>(arg) && !arg.GetBoolean()) {
             continue;
         }
         if (!Is<EmptyList>(arg)) {
             return arg;
         }
     }
-    return std::make_shared<Boolean>(false);
+    return Value::FromBoolean(false);
+}
+
+Value EmptyList::Get() {
+    // Never destroyed, so borrowing it is always safe.
+    static EmptyList* empty_list = new EmptyList;
+    return Value::Borrow(empty_list);
 }
 
 std::string EmptyList::Serialize() {
     return "()";
 }
 
+Value BigNumber::Make(BigInt value) {
+    if (value.FitsInt64()) {
+        return Value::FromNumber(value.ToInt64());
+    }
+    return New<BigNumber>(std::move(value));
+}
+
+const BigInt& BigNumber::GetValue() const {
+    return value_;
+}
+
+std::string BigNumber::Serialize() {
+    return value_.ToString();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // List Functions
 
-std::shared_ptr<Object> IsPairFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value IsPairFunction::Apply(const std::vector<Value>& args) {
     if (args.size() != 1 || !Is<Cell>(args[0])) {
         if (Is<EmptyList>(args[0])) {
-            return std::make_shared<Boolean>(false);
+            return Value::FromBoolean(false);
         }
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    std::vector<std::shared_ptr<Object>> vector_arg;
+    std::vector<Value> vector_arg;
     FillVectorOfArgs(args[0], vector_arg);
-    return std::make_shared<Boolean>(vector_arg.size() == 2);
+    return Value::FromBoolean(vector_arg.size() == 2);
 }
-std::shared_ptr<Object> IsNullFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value IsNullFunction::Apply(const std::vector<Value>& args) {
     if (args.size() != 1) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    return std::make_shared<Boolean>(Is<EmptyList>(args[0]));
+    return Value::FromBoolean(Is<EmptyList>(args[0]));
 }
-std::shared_ptr<Object> IsListFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value IsListFunction::Apply(const std::vector<Value>& args) {
     if (args.size() != 1 || !Is<Cell>(args[0])) {
         if (Is<EmptyList>(args[0])) {
-            return std::make_shared<Boolean>(true);
+            return Value::FromBoolean(true);
         }
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
 
-    auto object = args[0];
+    Value object = args[0];
 
     while (object) {
         if (!Is<Cell>(object)) {
-            return std::make_shared<Boolean>(false);
+            return Value::FromBoolean(false);
         }
         object = As<Cell>(object)->GetSecond();
     }
-    return std::make_shared<Boolean>(true);
+    return Value::FromBoolean(true);
 }
-std::shared_ptr<Object> ConsFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value ConsFunction::Apply(const std::vector<Value>& args) {
     if (args.size() != 2) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    return std::make_shared<Cell>(args[0], args[1]);
+    return New<Cell>(args[0], args[1]);
 }
-std::shared_ptr<Object> CarFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value CarFunction::Apply(const std::vector<Value>& args) {
     if (args.size() != 1 || !Is<Cell>(args[0]) ||
         (!As<Cell>(args[0])->GetFirst() && !As<Cell>(args[0])->GetSecond())) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    return As<Cell>(args[0])->GetFirst()->MakeCopy();
+    return As<Cell>(args[0])->GetFirst();
 }
-std::shared_ptr<Object> CdrFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value CdrFunction::Apply(const std::vector<Value>& args) {
     if (args.size() != 1 || !Is<Cell>(args[0]) ||
         (!As<Cell>(args[0])->GetFirst() && !As<Cell>(args[0])->GetSecond())) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    auto second = As<Cell>(args[0])->GetSecond();
+    const auto& second = As<Cell>(args[0])->GetSecond();
     if (!second) {
-        return std::make_shared<Cell>();
-    }
-    if (!Is<Cell>(second)) {
-        return second->MakeCopy();
+        return EmptyList::Get();
     }
     return second;
 }
-std::shared_ptr<Object> ListFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
-    if (args.size() == 1 && Is<EmptyList>(args[0])) {
-        return args[0];
+Value ListFunction::Apply(const std::vector<Value>& args) {
+    if (args.empty()) {
+        return EmptyList::Get();
     }
-    auto list = std::make_shared<Cell>();
-    auto curr_node = list;
-    for (auto object : args) {
-        if (!curr_node->GetFirst()) {
-            curr_node->SetFirst(object->MakeCopy());
-        } else {
-            curr_node->SetSecond(std::make_shared<Cell>(object->MakeCopy(), nullptr));
-            curr_node = As<Cell>(curr_node->GetSecond());
-        }
+    // The list refers to the arguments themselves; there is no need to copy them.
+    auto list = New<Cell>(args[0], nullptr);
+    auto curr_node = As<Cell>(list);
+    for (size_t i = 1; i < args.size(); ++i) {
+        curr_node->SetSecond(New<Cell>(args[i], nullptr));
+        curr_node = As<Cell>(curr_node->GetSecond());
     }
     return list;
 }
-std::shared_ptr<Object> ListRefFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value ListRefFunction::Apply(const std::vector<Value>& args) {
     if (args.size() != 2 || !Is<Cell>(args[0]) || !Is<Number>(args[1])) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    std::vector<std::shared_ptr<Object>> vector_args;
-    FillVectorOfArgs(args[0], vector_args);
-    if (As<Number>(args[1])->GetValue() >= vector_args.size()) {
+    // Walks only as far as the index; elements are the same as FillVectorOfArgs would collect.
+    auto index = args[1].GetNumber();
+    auto node = As<Cell>(args[0]);
+    if (index >= 0 && !node->GetFirst() && !node->GetSecond()) {
+        if (index == 0) {
+            return EmptyList::Get();
+        }
+        index = -1;
+    }
+    for (; index > 0; --index) {
+        const auto& second = node->GetSecond();
+        node = As<Cell>(second);
+        if (!node) {
+            // The tail of an improper list counts as one more element.
+            if (index == 1 && second && !Is<EmptyList>(second)) {
+                return second;
+            }
+            index = -1;
+            break;
+        }
+    }
+    if (index < 0) {
         throw RuntimeError{"Incorrect Value for index in :" + std::string(__PRETTY_FUNCTION__)};
     }
-    return vector_args[As<Number>(args[1])->GetValue()];
+    const auto& first = node->GetFirst();
+    return Is<Cell>(first) ? Evaluate(first) : first;
 }
-std::shared_ptr<Object> ListTailFunction::Apply(const std::vector<std::shared_ptr<Object>>& args) {
+Value ListTailFunction::Apply(const std::vector<Value>& args) {
     if (args.size() != 2 || !Is<Cell>(args[0]) || !Is<Number>(args[1])) {
         throw RuntimeError{"Invalid Number of Arguments for : " + std::string(__PRETTY_FUNCTION__)};
     }
-    auto sub_list = As<Cell>(args[0]);
-    size_t index = As<Number>(args[1])->GetValue();
+    const Value* sub_list = &args[0];
+    size_t index = args[1].GetNumber();
     for (size_t i = 0; i < index; ++i) {
-        sub_list = As<Cell>(sub_list->GetSecond());
-        if (!sub_list && i != index - 1) {
+        sub_list = &As<Cell>(*sub_list)->GetSecond();
+        if (!Is<Cell>(*sub_list) && i != index - 1) {
             throw RuntimeError{"Incorrect Value for index in :" + std::string(__PRETTY_FUNCTION__)};
         }
     }
-    if (!sub_list) {
-        return std::make_shared<Cell>();
+    if (!Is<Cell>(*sub_list)) {
+        return EmptyList::Get();
+    }
+    return *sub_list;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Vectors
+
+namespace {
+    void ChargeElements(size_t count, size_t size) {
+        RunBudget::ChargeBytes(count > SIZE_MAX / size ? SIZE_MAX : count * size);
+    }
+}  // namespace
+
+Vector::Vector(size_t size, const Value& fill) : Object(kType), unboxed_(fill.IsNumber()) {
+    // Charged before anything is allocated, so that a huge size fails with a LimitError.
+    ChargeElements(size, unboxed_ ? sizeof(int64_t) : sizeof(Value));
+    if (unboxed_) {
+        numbers_.assign(size, fill.GetNumber());
+    } else {
+        elements_.assign(size, fill);
+    }
+}
+
+Vector::Vector(std::vector<Value> elements)
+    : Object(kType),
+      unboxed_(std::all_of(elements.begin(), elements.end(),
+                           [](const Value& element) { return element.IsNumber(); })) {
+    ChargeElements(elements.size(), unboxed_ ? sizeof(int64_t) : sizeof(Value));
+    if (unboxed_) {
+        numbers_.reserve(elements.size());
+        for (const auto& element : elements) {
+            numbers_.push_back(element.GetNumber());
+        }
+    } else {
+        elements_ = std::move(elements);
+    }
+}
+
+Vector::Vector(std::vector<int64_t> numbers)
+    : Object(kType), numbers_(std::move(numbers)), unboxed_(true) {
+    ChargeElements(numbers_.size(), sizeof(int64_t));
+}
+
+size_t Vector::GetSize() const {
+    return unboxed_ ? numbers_.size() : elements_.size();
+}
+
+Value Vector::Get(size_t index) const {
+    return unboxed_ ? Value::FromNumber(numbers_[index]) : elements_[index];
+}
+
+void Vector::Set(size_t index, Value value) {
+    if (unboxed_ && value.IsNumber()) {
+        numbers_[index] = value.GetNumber();
+        return;
+    }
+    Box();
+    elements_[index] = std::move(value);
+}
+
+const std::vector<int64_t>* Vector::GetNumbers() const {
+    return unboxed_ ? &numbers_ : nullptr;
+}
+
+const std::vector<Value>& Vector::GetElements() const {
+    return elements_;
+}
+
+std::string Vector::Serialize() {
+    return Value::Borrow(this).Serialize();
+}
+
+void Vector::Trace(Tracer* tracer) const {
+    for (const auto& element : elements_) {
+        tracer->Mark(element);
+    }
+}
+
+void Vector::Box() {
+    if (!unboxed_) {
+        return;
+    }
+    ChargeElements(numbers_.size(), sizeof(Value));
+    elements_.reserve(numbers_.size());
+    for (auto number : numbers_) {
+        elements_.push_back(Value::FromNumber(number));
+    }
+    numbers_ = {};
+    unboxed_ = false;
+}
+
+size_t CountStores() {
+    return stores;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Vector Functions
+
+Value IsVectorFunction::Apply(const std::vector<Value>& args) {
+    return Value::FromBoolean(Is<Vector>(args[0]));
+}
+Value MakeVectorFunction::Apply(const std::vector<Value>& args) {
+    if (!Is<Number>(args[0]) || args[0].GetNumber() < 0) {
+        throw RuntimeError{"Incorrect Value for size in :" + std::string(__PRETTY_FUNCTION__)};
+    }
+    return New<Vector>(args[0].GetNumber(), args.size() == 2 ? args[1] : Value::FromNumber(0));
+}
+Value VectorFunction::Apply(const std::vector<Value>& args) {
+    return New<Vector>(args);
+}
+Value VectorRefFunction::Apply(const std::vector<Value>& args) {
+    auto vector = GetVector(args[0]);
+    return vector->Get(GetIndex(args[1], vector->GetSize()));
+}
+Value VectorSetFunction::Apply(const std::vector<Value>& args) {
+    auto vector = GetVector(args[0]);
+    auto index = GetIndex(args[1], vector->GetSize());
+    auto value = args[2];
+    if (!CopyOutOfArena(&value)) {
+        ++stores;
+    }
+    vector->Set(index, std::move(value));
+    return EmptyList::Get();
+}
+Value VectorLengthFunction::Apply(const std::vector<Value>& args) {
+    return Value::FromNumber(GetVector(args[0])->GetSize());
+}
+Value ListToVectorFunction::Apply(const std::vector<Value>& args) {
+    std::vector<Value> elements;
+    if (Is<EmptyList>(args[0])) {
+        return New<Vector>(std::move(elements));
+    }
+    auto node = As<Cell>(args[0]);
+    if (!node) {
+        throw RuntimeError{"Incorrect Type for :" + std::string(__PRETTY_FUNCTION__)};
+    }
+    if (!node->GetFirst() && !node->GetSecond()) {
+        return New<Vector>(std::move(elements));
+    }
+    while (true) {
+        elements.push_back(node->GetFirst());
+        const auto& second = node->GetSecond();
+        if (!second || Is<EmptyList>(second)) {
+            break;
+        }
+        node = As<Cell>(second);
+        if (!node) {
+            throw RuntimeError{"Incorrect Type for :" + std::string(__PRETTY_FUNCTION__)};
+        }
+    }
+    return New<Vector>(std::move(elements));
+}
+Value VectorSumFunction::Apply(const std::vector<Value>& args) {
+    auto vector = GetVector(args[0]);
+    if (auto numbers = vector->GetNumbers()) {
+        int64_t sum;
+        if (SumWithoutOverflow(*numbers, &sum)) {
+            return Value::FromNumber(sum);
+        }
+        BigInt total;
+        for (auto number : *numbers) {
+            total = total + BigInt{number};
+        }
+        return BigNumber::Make(std::move(total));
+    }
+    return ArithmeticOp<Addition>(vector->GetElements(), 0, Value::FromNumber(0));
+}
+Value VectorMapFunction::Apply(const std::vector<Value>& args) {
+    auto vector = GetVector(args[1]);
+    size_t size = vector->GetSize();
+    std::vector<Value> arg(1);
+    // Results stay unboxed until the first one that is not a fixnum.
+    std::vector<int64_t> numbers;
+    std::vector<Value> elements;
+    numbers.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+        arg[0] = vector->Get(i);
+        auto result = ApplyProcedure(args[0], arg);
+        if (result.IsNumber() && elements.empty()) {
+            numbers.push_back(result.GetNumber());
+            continue;
+        }
+        if (elements.empty()) {
+            elements.reserve(size);
+            for (auto number : numbers) {
+                elements.push_back(Value::FromNumber(number));
+            }
+        }
+        elements.push_back(std::move(result));
+    }
+    if (elements.empty()) {
+        return New<Vector>(std::move(numbers));
+    }
+    return New<Vector>(std::move(elements));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Interpreter Functions
+
+namespace {
+    Value MakeList(std::vector<Value> items) {
+        if (items.empty()) {
+            return EmptyList::Get();
+        }
+        Value list;
+        for (auto it = items.rbegin(); it != items.rend(); ++it) {
+            list = New<Cell>(std::move(*it), std::move(list));
+        }
+        return list;
+    }
+
+    Value MakeCount(uint64_t count) {
+        return Value::FromNumber(static_cast<int64_t>(count));
+    }
+}  // namespace
+
+Value InterpreterStatsFunction::Apply(const std::vector<Value>&) {
+    auto collector = StatsCollector::Current();
+    if (!collector) {
+        return EmptyList::Get();
+    }
+    auto stats = collector->Get();
+    std::vector<Value> objects;
+    for (const auto& [type, count] : stats.objects) {
+        objects.push_back(New<Cell>(Symbol::Intern(type), MakeCount(count)));
+    }
+    std::vector<Value> builtins;
+    for (const auto& builtin : stats.builtins) {
+        builtins.push_back(MakeList({Symbol::Intern(builtin.name), MakeCount(builtin.calls),
+                                     MakeCount(builtin.nanoseconds)}));
     }
-    return sub_list;
+    return MakeList({New<Cell>(Symbol::Intern("evaluations"), MakeCount(stats.evaluations)),
+                     New<Cell>(Symbol::Intern("max-depth"), MakeCount(stats.max_depth)),
+                     New<Cell>(Symbol::Intern("folded-calls"), MakeCount(stats.folded_calls)),
+                     New<Cell>(Symbol::Intern("objects"), MakeList(std::move(objects))),
+                     New<Cell>(Symbol::Intern("builtins"), MakeList(std::move(builtins)))});
 }
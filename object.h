@@ -1,231 +1,1050 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iosfwd>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
+#include "bigint.h"
 #include "error.h"
+#include "run_limits.h"
+#include "stats.h"
+#include "symbols.h"
 
-class Object : public std::enable_shared_from_this<Object> {
+class MemoCache;
+class Tracer;
+class Value;
+struct Program;
+
+// Everything from CELL on is code that Evaluate has to run; the rest evaluates to itself.
+enum class ObjectType : uint8_t {
+    FUNCTION,
+    SYMBOL,
+    EMPTY_LIST,
+    BIG_NUMBER,
+    VECTOR,
+    CLOSURE,
+    ENVIRONMENT,
+    CELL,
+    CALL,
+    VARIABLE,
+    LAMBDA,
+    FORM,
+    DEFINE,
+    LET,
+    APPLICATION,
+    MEMO
+};
+
+static_assert(static_cast<size_t>(ObjectType::MEMO) < StatsCollector::kMaxObjectTypes);
+
+// Lower-case name of the type, like "cell".
+const char* GetTypeName(ObjectType type);
+
+// Objects in an arena, interned symbols and the empty list live as long as their owner and are
+// handed out borrowed. Any other object is on the heap and counts the Values and Refs that own
+// it, deleting itself when the last one goes. Counting is not atomic unless the object has been
+// shared across threads, so an object made outside an arena belongs to the thread that made it
+// until then.
+class Object {
 public:
+    explicit Object(ObjectType type) : type_(type) {
+        if (auto stats = StatsCollector::Current()) {
+            stats->CountObject(static_cast<size_t>(type));
+        }
+    }
+
+    Object(const Object&) = delete;
+    Object& operator=(const Object&) = delete;
+
     virtual ~Object() = default;
 
-    virtual std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) {
-        throw NotImplementedError(__PRETTY_FUNCTION__);
+    ObjectType GetType() const {
+        return type_;
     }
+
+    virtual Value Apply(const std::vector<Value>& args);
+
     virtual std::string Serialize() {
         throw NotImplementedError(__PRETTY_FUNCTION__);
     }
-    virtual std::shared_ptr<Object> MakeCopy() {
-        throw NotImplementedError(__PRETTY_FUNCTION__);
+
+    // Passes every value and object this one refers to to tracer.
+    virtual void Trace(Tracer*) const {
+    }
+
+    // Whether the Tracer collecting the heap has reached this object.
+    bool IsMarked() const {
+        return marked_;
+    }
+
+    // Makes counting references to this heap object atomic. Must be called before any other
+    // thread can reach it.
+    void ShareAcrossThreads() const {
+        atomic_refs_ = true;
+    }
+
+private:
+    friend class Tracer;
+    friend class Value;
+    template <class T>
+    friend class Ref;
+
+    void Retain() const {
+        if (atomic_refs_) {
+            refs_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            refs_.store(refs_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+    void Release() const {
+        if (atomic_refs_) {
+            if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete this;
+            }
+            return;
+        }
+        auto refs = refs_.load(std::memory_order_relaxed) - 1;
+        if (refs == 0) {
+            delete this;
+        } else {
+            refs_.store(refs, std::memory_order_relaxed);
+        }
+    }
+
+    // Only used by heap objects. Accessed with relaxed loads and stores unless atomic_refs_,
+    // which compile to plain memory operations.
+    mutable std::atomic<uint32_t> refs_{0};
+    const ObjectType type_;
+    mutable bool marked_ = false;
+    mutable bool atomic_refs_ = false;
+};
+
+// Owning handle to a heap object, for code that needs the object's own type. Converting one
+// to a Value hands its reference over.
+template <class T>
+class Ref {
+public:
+    Ref() = default;
+
+    Ref(const Ref& other) : object_(other.object_) {
+        if (object_) {
+            object_->Retain();
+        }
+    }
+
+    Ref(Ref&& other) noexcept : object_(other.Detach()) {
+    }
+
+    template <class U, class = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    Ref(Ref<U> other) : object_(other.Detach()) {
+    }
+
+    Ref& operator=(Ref other) noexcept {
+        std::swap(object_, other.object_);
+        return *this;
+    }
+
+    ~Ref() {
+        if (object_) {
+            object_->Release();
+        }
+    }
+
+    // Takes the first reference to an object just made with new.
+    static Ref Adopt(T* object) {
+        object->Retain();
+        Ref ref;
+        ref.object_ = object;
+        return ref;
+    }
+
+    T* Get() const {
+        return object_;
+    }
+
+    T* operator->() const {
+        return object_;
+    }
+
+    explicit operator bool() const {
+        return object_;
+    }
+
+    // Gives up the object without releasing the reference, which the caller takes over.
+    T* Detach() {
+        return std::exchange(object_, nullptr);
+    }
+
+private:
+    T* object_ = nullptr;
+};
+
+template <class T, class... Args>
+Ref<T> MakeRef(Args&&... args) {
+    return Ref<T>::Adopt(new T(std::forward<Args>(args)...));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Value
+
+// Numbers that fit in 64 bits and booleans are stored inline in Value and never allocated.
+// These tags only name them for Is<T>. Larger integers are BigNumber objects.
+struct Number {};
+struct Boolean {};
+
+class Value {
+public:
+    Value() = default;
+
+    Value(std::nullptr_t) {
+    }
+
+    template <class T, class = std::enable_if_t<std::is_base_of_v<Object, T>>>
+    Value(Ref<T> object) : owned_(static_cast<bool>(object)), object_(object.Detach()) {
+    }
+
+    Value(const Value& other) : tag_(other.tag_), owned_(other.owned_) {
+        CopyPayload(other);
+        if (owned_) {
+            object_->Retain();
+        }
+    }
+
+    Value(Value&& other) noexcept : tag_(other.tag_), owned_(other.owned_) {
+        CopyPayload(other);
+        other.owned_ = false;
+    }
+
+    Value& operator=(const Value& other) {
+        // Retaining first keeps self-assignment safe.
+        if (other.owned_) {
+            other.object_->Retain();
+        }
+        Drop();
+        tag_ = other.tag_;
+        owned_ = other.owned_;
+        CopyPayload(other);
+        return *this;
+    }
+
+    Value& operator=(Value&& other) noexcept {
+        if (this != &other) {
+            Drop();
+            tag_ = other.tag_;
+            owned_ = other.owned_;
+            CopyPayload(other);
+            other.owned_ = false;
+        }
+        return *this;
+    }
+
+    ~Value() {
+        Drop();
+    }
+
+    static Value FromNumber(int64_t value);
+
+    static Value FromBoolean(bool state);
+
+    // Non-owning handle. The object must outlive it: it lives in an Arena or is interned.
+    static Value Borrow(Object* object);
+
+    bool IsNumber() const {
+        return tag_ == Tag::NUMBER;
+    }
+
+    bool IsBoolean() const {
+        return tag_ == Tag::BOOLEAN;
+    }
+
+    bool IsBorrowed() const {
+        return tag_ == Tag::OBJECT && object_ && !owned_;
+    }
+
+    int64_t GetNumber() const {
+        return number_;
+    }
+
+    bool GetBoolean() const {
+        return state_;
+    }
+
+    Object* Get() const {
+        return tag_ == Tag::OBJECT ? object_ : nullptr;
+    }
+
+    explicit operator bool() const {
+        return tag_ != Tag::OBJECT || object_;
+    }
+
+    std::string Serialize() const;
+
+private:
+    enum class Tag : uint8_t { OBJECT, NUMBER, BOOLEAN };
+
+    // Copies whichever member of the union is in use.
+    void CopyPayload(const Value& other) {
+        std::memcpy(&number_, &other.number_, sizeof(number_));
+    }
+
+    void Drop() {
+        if (owned_) {
+            object_->Release();
+        }
+    }
+
+    Tag tag_ = Tag::OBJECT;
+    // Whether object_ is a heap object this value holds a reference to.
+    bool owned_ = false;
+    union {
+        Object* object_ = nullptr;
+        int64_t number_;
+        bool state_;
+    };
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Functions
+
+class Function : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::FUNCTION;
+
+    Function() : Object(kType) {
     }
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Integer Functions
 
-class IsNumberFunction : public Object {
+class IsNumberFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class IsEqualFunction : public Object {
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+class IsEqualFunction : public Function {
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class IsGreaterFunction : public Object {
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+class IsGreaterFunction : public Function {
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class IsLessFunction : public Object {
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+class IsLessFunction : public Function {
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class IsGreaterEqualFunction : public Object {
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+class IsGreaterEqualFunction : public Function {
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class IsLessEqualFunction : public Object {
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+class IsLessEqualFunction : public Function {
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class AdditionFunction : public Object {
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+class AdditionFunction : public Function {
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class SubtractionFunction : public Object {
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+class SubtractionFunction : public Function {
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class MultiplicationFunction : public Object {
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+class MultiplicationFunction : public Function {
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class DivisionFunction : public Object {
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+class DivisionFunction : public Function {
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class MaxFunction : public Object {
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+class MaxFunction : public Function {
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class MinFunction : public Object {
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+class MinFunction : public Function {
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class AbsFunction : public Object {
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+class AbsFunction : public Function {
+    Value Apply(const std::vector<Value>& args) override;
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Boolean Functions
 
-class IsBooleanFunction : public Object {
+class IsBooleanFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class NotFunction : public Object {
+class NotFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class AndFunction : public Object {
+class AndFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class OrFunction : public Object {
+class OrFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // List Functions
 
-class IsPairFunction : public Object {
+class IsPairFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class IsNullFunction : public Object {
+class IsNullFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class IsListFunction : public Object {
+class IsListFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class ConsFunction : public Object {
+class ConsFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class CarFunction : public Object {
+class CarFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class CdrFunction : public Object {
+class CdrFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class ListFunction : public Object {
+class ListFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class ListRefFunction : public Object {
+class ListRefFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
 };
 
-class ListTailFunction : public Object {
+class ListTailFunction : public Function {
 public:
-    std::shared_ptr<Object> Apply(const std::vector<std::shared_ptr<Object>>& args) override;
+    Value Apply(const std::vector<Value>& args) override;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Vector Functions
+
+class IsVectorFunction : public Function {
+public:
+    Value Apply(const std::vector<Value>& args) override;
+};
+
+class MakeVectorFunction : public Function {
+public:
+    Value Apply(const std::vector<Value>& args) override;
+};
+
+class VectorFunction : public Function {
+public:
+    Value Apply(const std::vector<Value>& args) override;
+};
+
+class VectorRefFunction : public Function {
+public:
+    Value Apply(const std::vector<Value>& args) override;
+};
+
+class VectorSetFunction : public Function {
+public:
+    Value Apply(const std::vector<Value>& args) override;
+};
+
+class VectorLengthFunction : public Function {
+public:
+    Value Apply(const std::vector<Value>& args) override;
+};
+
+class ListToVectorFunction : public Function {
+public:
+    Value Apply(const std::vector<Value>& args) override;
+};
+
+class VectorSumFunction : public Function {
+public:
+    Value Apply(const std::vector<Value>& args) override;
+};
+
+class VectorMapFunction : public Function {
+public:
+    Value Apply(const std::vector<Value>& args) override;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Interpreter Functions
+
+// The stats of the running interpreter as an association list, or () if they are off.
+class InterpreterStatsFunction : public Function {
+public:
+    Value Apply(const std::vector<Value>& args) override;
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Objects
-class Number : public Object {
+class Symbol : public Object {
 public:
-    Number(int value);
+    static constexpr ObjectType kType = ObjectType::SYMBOL;
+
+    // Symbols are interned: there is exactly one object per name, so they compare by pointer.
+    // Use Intern() instead of constructing them directly.
+    explicit Symbol(SymbolId id);
+
+    static Value Intern(SymbolId id);
+
+    static Value Intern(std::string_view name);
 
-    int GetValue() const;
+    SymbolId GetId() const;
+
+    const std::string& GetName() const;
 
     std::string Serialize() override;
 
-    std::shared_ptr<Object> MakeCopy() override;
+private:
+    SymbolId id_;
+    const std::string* name_;
+};
+
+class Cell : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::CELL;
+
+    Cell() : Object(kType) {
+    }
+
+    Cell(Value first, Value second);
+
+    void SetFirst(Value first);
+
+    void SetSecond(Value second);
+
+    const Value& GetFirst() const;
+
+    const Value& GetSecond() const;
+
+    std::string Serialize() override;
+
+    void Trace(Tracer* tracer) const override;
 
 private:
-    int value_;
+    Value first_;
+    Value second_;
 };
 
-class Symbol : public Object {
+// There is only one empty list: use Get() instead of constructing it.
+class EmptyList : public Object {
 public:
-    Symbol(const std::string& name);
+    static constexpr ObjectType kType = ObjectType::EMPTY_LIST;
 
-    const std::string& GetName() const;
+    EmptyList() : Object(kType) {
+    }
+
+    static Value Get();
 
     std::string Serialize() override;
+};
 
-    std::shared_ptr<Object> MakeCopy() override;
+// An integer outside the range of the inline numbers. Arithmetic only produces one when its
+// result does not fit in 64 bits, so equal numbers always have the same representation.
+class BigNumber : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::BIG_NUMBER;
+
+    explicit BigNumber(BigInt value) : Object(kType), value_(std::move(value)) {
+        RunBudget::ChargeBytes(value_.CountBytes());
+    }
+
+    // The inline number if value fits in one, a new BigNumber otherwise.
+    static Value Make(BigInt value);
+
+    const BigInt& GetValue() const;
+
+    std::string Serialize() override;
 
 private:
-    std::string name_;
+    BigInt value_;
 };
 
-class Boolean : public Object {
+// Fixed-size sequence with constant-time access. As long as every element is a fixnum they are
+// stored unboxed, in one contiguous array of int64_t that bulk operations scan directly.
+// Storing anything else boxes the vector into Values for good.
+class Vector : public Object {
 public:
-    Boolean(bool state);
+    static constexpr ObjectType kType = ObjectType::VECTOR;
+
+    Vector(size_t size, const Value& fill);
+
+    explicit Vector(std::vector<Value> elements);
+
+    explicit Vector(std::vector<int64_t> numbers);
+
+    size_t GetSize() const;
+
+    // index must be less than GetSize().
+    Value Get(size_t index) const;
+
+    void Set(size_t index, Value value);
 
-    bool GetState() const;
+    // The elements while they are all fixnums, nullptr otherwise.
+    const std::vector<int64_t>* GetNumbers() const;
+
+    // Only valid when GetNumbers() is nullptr.
+    const std::vector<Value>& GetElements() const;
 
     std::string Serialize() override;
 
-    std::shared_ptr<Object> MakeCopy() override;
+    void Trace(Tracer* tracer) const override;
 
 private:
-    bool state_;
+    void Box();
+
+    std::vector<int64_t> numbers_;
+    std::vector<Value> elements_;
+    bool unboxed_;
 };
 
-class Cell : public Object {
+constexpr size_t kVariadic = SIZE_MAX;
+
+struct Builtin {
+    Ref<Object> function;
+    size_t min_args = 0;
+    size_t max_args = kVariadic;
+    // Whether the result depends on the arguments only and nothing is changed on the way, so
+    // that applying it to the same constants can be memoized.
+    bool pure = true;
+    SymbolId name = 0;
+
+    bool AcceptsArgs(size_t count) const;
+
+    // Checks the argument count, then applies function.
+    Value Apply(const std::vector<Value>& args) const;
+
+    // Applies function to arguments whose count is known to be accepted. Every call of a
+    // builtin goes through here, which keeps its stats.
+    Value ApplyUnchecked(const std::vector<Value>& args) const;
+};
+
+// A builtin application bound ahead of time by Resolve. Evaluating it needs neither the name
+// lookup nor the walk over the argument list.
+class Call : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::CALL;
+
+    Call(const Builtin* builtin, std::vector<Value> args);
+
+    const Builtin* GetBuiltin() const;
+
+    const std::vector<Value>& GetArgs() const;
+
+    // Whether the builtin accepts this many arguments; decided once at construction.
+    bool IsArityValid() const;
+
+    std::string Serialize() override;
+
+    void Trace(Tracer* tracer) const override;
+
+private:
+    const Builtin* builtin_;
+    std::vector<Value> args_;
+    bool arity_valid_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Variables
+
+// Run-time location of a local variable. Parameters and let-bound variables live in a slot of
+// the frame of the current call, or, once captured by a lambda, in a slot of its closure:
+// closures are flat and copy what they capture when they are created. Variables introduced by
+// an internal define may be referred to before they are set, so they are boxed instead: the
+// slot holds the Environment of the body that defines them, and offset selects the variable
+// in it.
+struct Address {
+    enum class Scope : uint8_t { FRAME, CLOSURE };
+
+    Scope scope = Scope::FRAME;
+    uint32_t index = 0;
+    bool boxed = false;
+    uint32_t offset = 0;
+};
+
+// The variables defined inside one activation of a lambda or let body.
+class Environment : public Object {
 public:
-    Cell() = default;
+    static constexpr ObjectType kType = ObjectType::ENVIRONMENT;
 
-    Cell(std::shared_ptr<Object> first, std::shared_ptr<Object> second);
+    explicit Environment(size_t size);
 
-    void SetFirst(std::shared_ptr<Object> first);
+    Value& At(size_t offset);
 
-    void SetSecond(std::shared_ptr<Object> second);
+    void Trace(Tracer* tracer) const override;
+
+private:
+    std::vector<Value> slots_;
+};
+
+// Top-level bindings of one Interpreter. A slot is created the first time a name is resolved
+// and never moves, so resolved code refers to it directly. An empty slot is an unbound name.
+class GlobalEnvironment {
+public:
+    // Safe to call from several threads.
+    Value* GetSlot(SymbolId name);
 
-    std::shared_ptr<Object> GetFirst() const;
+    void Define(SymbolId name, Value value);
 
-    std::shared_ptr<Object> GetSecond() const;
+    // Number of definitions so far whose value was left in an arena rather than copied out.
+    size_t CountDefinitions() const;
+
+    // While read-only, Resolve rejects top-level defines, so the slots can be read from several
+    // threads at once.
+    void SetReadOnly(bool read_only);
+
+    bool IsReadOnly() const;
+
+    // Passes every defined value to tracer.
+    void Trace(Tracer* tracer) const;
+
+private:
+    mutable std::shared_mutex mutex_;
+    std::deque<Value> slots_;
+    // Indexed by SymbolId.
+    std::vector<Value*> index_;
+    size_t definitions_ = 0;
+    bool read_only_ = false;
+};
+
+class Variable : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::VARIABLE;
+
+    Variable(SymbolId name, Address address);
+
+    Variable(SymbolId name, Value* global);
+
+    SymbolId GetName() const;
+
+    const Address& GetAddress() const;
+
+    // The slot of a global variable, nullptr for a local one.
+    Value* GetGlobal() const;
 
     std::string Serialize() override;
 
 private:
-    std::shared_ptr<Object> first_ = nullptr;
-    std::shared_ptr<Object> second_ = nullptr;
+    SymbolId name_;
+    Address address_;
+    Value* global_;
 };
 
-class EmptyList : public Object {
+// Forms of a lambda or let body. If the body has internal defines, entering it puts a new
+// Environment of environment_size variables into frame slot environment_slot.
+struct Body {
+    std::vector<Value> forms;
+    uint32_t environment_slot = 0;
+    uint32_t environment_size = 0;
+};
+
+class Lambda : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::LAMBDA;
+
+    // Parameters take the first frame slots; a variadic lambda gets its remaining arguments as
+    // a list in the slot after them.
+    Lambda(uint32_t required_args, bool variadic, uint32_t frame_size,
+           std::vector<Address> captures, Body body);
+
+    uint32_t GetRequiredArgs() const;
+
+    bool IsVariadic() const;
+
+    uint32_t GetFrameSize() const;
+
+    // Where each captured value lives in the frame of the call creating the closure.
+    const std::vector<Address>& GetCaptures() const;
+
+    const Body& GetBody() const;
+
+    // Sets the bytecode of the body: program holds it from position entry on.
+    void SetCode(std::shared_ptr<const Program> program, uint32_t entry);
+
+    // The program with the bytecode of the body, or nullptr if it was not compiled.
+    const Program* GetProgram() const;
+
+    uint32_t GetEntry() const;
+
+    std::string Serialize() override;
+
+    void Trace(Tracer* tracer) const override;
+
+private:
+    uint32_t required_args_;
+    bool variadic_;
+    uint32_t frame_size_;
+    std::vector<Address> captures_;
+    Body body_;
+    std::shared_ptr<const Program> program_;
+    uint32_t entry_ = 0;
+};
+
+class Closure : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::CLOSURE;
+
+    Closure(const Lambda* lambda, std::vector<Value> captured);
+
+    Value Apply(const std::vector<Value>& args) override;
+
+    const Lambda* GetLambda() const;
+
+    const Value& GetCaptured(size_t index) const;
+
+    std::string Serialize() override;
+
+    void Trace(Tracer* tracer) const override;
+
+private:
+    const Lambda* lambda_;
+    std::vector<Value> captured_;
+};
+
+// What a special form does next: evaluate one of its operands and get its value back, let one
+// take its place, which makes a call there a tail call, or evaluate to result.
+struct FormStep {
+    enum class Action : uint8_t { EVALUATE, TAIL, RESULT };
+
+    Action action;
+    size_t operand = 0;
+    Value result;
+};
+
+class Form;
+
+// Syntax like if, and or cond. Its operands are resolved like any code, but Evaluate does not
+// evaluate them up front: it asks the form what to do, first with no value and then with the
+// value of each operand the form asked for, so operands that are not needed cost nothing.
+struct SpecialForm {
+    // evaluated is 0 at first and 1 + the index of the operand whose value is given after
+    // that.
+    using Next = FormStep (*)(const Form& form, size_t evaluated, const Value* value);
+
+    SymbolId name = 0;
+    Next next = nullptr;
+    size_t min_operands = 0;
+    size_t max_operands = kVariadic;
+    // Whether each operand is a clause, a list of expressions, rather than an expression.
+    bool clauses = false;
+};
+
+// A special form bound by Resolve.
+class Form : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::FORM;
+
+    Form(const SpecialForm* form, std::vector<Value> operands, std::vector<uint32_t> clauses);
+
+    const SpecialForm* GetSpecialForm() const;
+
+    // The expressions of a form with clauses are all in here, one clause after the other.
+    const std::vector<Value>& GetOperands() const;
+
+    // Where each clause starts in the operands; empty for a form without clauses.
+    const std::vector<uint32_t>& GetClauses() const;
+
+    std::string Serialize() override;
+
+    void Trace(Tracer* tracer) const override;
+
+private:
+    const SpecialForm* form_;
+    std::vector<Value> operands_;
+    std::vector<uint32_t> clauses_;
+};
+
+class Define : public Object {
 public:
+    static constexpr ObjectType kType = ObjectType::DEFINE;
+
+    Define(SymbolId name, GlobalEnvironment* globals, Value value);
+
+    // Internal define of the boxed variable at address.
+    Define(SymbolId name, Address address, Value value);
+
+    SymbolId GetName() const;
+
+    // nullptr for an internal define.
+    GlobalEnvironment* GetGlobals() const;
+
+    const Address& GetAddress() const;
+
+    const Value& GetValue() const;
+
     std::string Serialize() override;
+
+    void Trace(Tracer* tracer) const override;
+
+private:
+    SymbolId name_;
+    GlobalEnvironment* globals_;
+    Address address_;
+    Value value_;
 };
 
-std::shared_ptr<Object> Evaluate(std::shared_ptr<Object> ast);
+// let inside a lambda: the variables take consecutive slots of the enclosing frame.
+class Let : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::LET;
+
+    Let(uint32_t first_slot, std::vector<Value> inits, Body body);
+
+    uint32_t GetFirstSlot() const;
+
+    const std::vector<Value>& GetInits() const;
+
+    const Body& GetBody() const;
+
+    std::string Serialize() override;
+
+    void Trace(Tracer* tracer) const override;
+
+private:
+    uint32_t first_slot_;
+    std::vector<Value> inits_;
+    Body body_;
+};
+
+// Application of anything other than a builtin named directly. The operator is only known at
+// run time and, as with an unresolved list, may turn out to be quote, in which case the
+// unevaluated operands are the result.
+class Application : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::APPLICATION;
+
+    Application(Value op, std::vector<Value> args, Value operands);
+
+    const Value& GetOperator() const;
+
+    const std::vector<Value>& GetArgs() const;
+
+    const Value& GetOperands() const;
+
+    std::string Serialize() override;
+
+    void Trace(Tracer* tracer) const override;
+
+private:
+    Value op_;
+    std::vector<Value> args_;
+    Value operands_;
+};
+
+// A pure expression, a builtin call on constants and other such calls, whose result is
+// looked up in a MemoCache before evaluating it and stored there after. The cache knows it by
+// source, the datum it was resolved from: equal sources resolve to equal expressions, since
+// only builtins, which can not be redefined, and constants make up such an expression.
+class Memo : public Object {
+public:
+    static constexpr ObjectType kType = ObjectType::MEMO;
+
+    // hash is the HashDatum of source if the parser has computed it already.
+    Memo(Value expression, Value source, MemoCache* cache, std::optional<size_t> hash);
+
+    const Value& GetExpression() const;
+
+    MemoCache* GetCache() const;
+
+    const Value& GetSource() const;
+
+    // HashDatum of the source, computed the first time it is needed unless it was given.
+    size_t GetHash() const;
+
+    std::string Serialize() override;
+
+    void Trace(Tracer* tracer) const override;
+
+private:
+    Value expression_;
+    Value source_;
+    MemoCache* cache_;
+    bool hash_given_;
+    mutable std::once_flag hash_made_;
+    mutable size_t hash_;
+};
+
+Value Evaluate(const Value& ast);
+
+// Appends the printed form of value to out in a single pass, the same text Serialize returns.
+// Nested lists and vectors do not use native stack.
+void SerializeTo(const Value& value, std::string* out);
+
+void SerializeTo(const Value& value, std::ostream* out);
+
+// Number of values vector-set! has stored on this thread so far without copying them out of
+// their arena. Like a definition, such a store may leave an object allocated earlier pointing
+// into the current arena.
+size_t CountStores();
+
+// The builtin bound to a symbol, or nullptr.
+const Builtin* FindBuiltin(SymbolId id);
+
+// Every builtin by the symbol id of its name; ids that name none have no function.
+const std::vector<Builtin>& GetBuiltins();
+
+// The special form named by a symbol, or nullptr.
+const SpecialForm* FindSpecialForm(SymbolId id);
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 template <class T>
-std::shared_ptr<T> As(const std::shared_ptr<Object>& obj) {
-    return std::dynamic_pointer_cast<T>(obj);
+bool Is(const Value& obj) {
+    return obj.Get() && obj.Get()->GetType() == T::kType;
 }
 
+// Borrowed view of the object held by obj, or nullptr if it is not a T.
+// The caller must keep obj alive while using the pointer.
 template <class T>
-bool Is(const std::shared_ptr<Object>& obj) {
-    return std::dynamic_pointer_cast<T>(obj) != nullptr;
-}
\ No newline at end of file
+T* As(const Value& obj) {
+    return Is<T>(obj) ? static_cast<T*>(obj.Get()) : nullptr;
+}
+
+template <>
+inline bool Is<Number>(const Value& obj) {
+    return obj.IsNumber();
+}
+
+template <>
+inline bool Is<Boolean>(const Value& obj) {
+    return obj.IsBoolean();
+}
+
+// Whether Evaluate does anything other than return value itself.
+inline bool NeedsEvaluation(const Value& value) {
+    auto object = value.Get();
+    return object && object->GetType() >= ObjectType::CELL;
+}
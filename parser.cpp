@@ -1,98 +1,215 @@
-#include <parser.h>
+#include "parser.h"
+#include <unordered_map>
+#include "arena.h"
+#include "memo.h"
+#include "run_limits.h"
 
-std::shared_ptr<Object> Read(Tokenizer* tokenizer) {
-    Token curr_token = tokenizer->GetToken();
+namespace {
+    // A datum that is still waiting for the one after it: the operand of a quote, or the next
+    // element or the tail of a list.
+    struct OpenForm {
+        enum class Kind { QUOTE, LIST };
 
-    if (tokenizer->IsEnd()) {
-        throw SyntaxError{"Invalid input"};
-    }
-    if (std::holds_alternative<BooleanToken>(curr_token)) {
-        tokenizer->Next();
-        return std::make_shared<Boolean>(std::get<BooleanToken>(curr_token).state);
-    }
-    if (std::holds_alternative<QuoteToken>(curr_token)) {
-        tokenizer->Next();
-        if (tokenizer->IsEnd()) {
-            throw SyntaxError{"Invalid Usage of Quote"};
-        }
-        return std::make_shared<Cell>(std::make_shared<Symbol>("quote"), Read(tokenizer));
-    }
-    if (std::holds_alternative<ConstantToken>(curr_token)) {
-        tokenizer->Next();
-        return std::make_shared<Number>(std::get<ConstantToken>(curr_token).value);
-    }
-
-    if (std::holds_alternative<SymbolToken>(curr_token)) {
-        tokenizer->Next();
-        return std::make_shared<Symbol>(std::get<SymbolToken>(curr_token).name);
-    }
+        Kind kind;
+        Value list;
+        Cell* node = nullptr;
+        bool awaiting_tail = false;
+        // HashDatum of the list so far; only kept when subtrees are shared.
+        ListHash hash = {};
+        size_t tail_hash = 0;
+    };
 
-    if (std::holds_alternative<DotToken>(curr_token)) {
-        tokenizer->Next();
-        return std::make_shared<Symbol>(".");
-    }
-
-    if (std::holds_alternative<BracketToken>(curr_token) &&
-        std::get<BracketToken>(curr_token) == BracketToken::OPEN) {
-        tokenizer->Next();
-        if (std::holds_alternative<BracketToken>(tokenizer->GetToken()) &&
-            std::get<BracketToken>(tokenizer->GetToken()) == BracketToken::CLOSE) {
-            tokenizer->Next();
-            return nullptr;
+    // Equal subtrees read so far, by their HashDatum.
+    class SharedData {
+    public:
+        // hashes, if not nullptr, gets the hash of every list kept.
+        explicit SharedData(DatumHashes* hashes) : hashes_(hashes) {
         }
-        if (std::holds_alternative<SymbolToken>(tokenizer->GetToken()) &&
-            std::get<SymbolToken>(tokenizer->GetToken()).name == "quote") {
-            tokenizer->Next();
-            if (tokenizer->IsEnd()) {
-                throw SyntaxError{"Invalid Usage of Quote"};
+
+        // Returns the subtree equal to datum that was read first.
+        Value Share(Value datum, size_t hash) {
+            if (!Is<Cell>(datum) && !Is<BigNumber>(datum)) {
+                return datum;
+            }
+            auto [begin, end] = data_.equal_range(hash);
+            for (auto it = begin; it != end; ++it) {
+                // Subtrees of both are shared already, so this only walks their top lists.
+                if (EqualData(it->second, datum)) {
+                    return it->second;
+                }
+            }
+            if (hashes_ && Is<Cell>(datum)) {
+                hashes_->Add(datum, hash);
             }
-            return std::make_shared<Cell>(std::make_shared<Symbol>("quote"), Read(tokenizer));
+            data_.emplace(hash, datum);
+            return datum;
         }
-        return ReadList(tokenizer);
-    }
-    throw SyntaxError{"Invalid input"};
-}
-
-std::shared_ptr<Object> ReadList(Tokenizer* tokenizer) {
-    auto root = std::make_shared<Cell>();
-    auto curr_node = root;
 
-    Token curr_token = tokenizer->GetToken();
+    private:
+        DatumHashes* hashes_;
+        std::unordered_multimap<size_t, Value> data_;
+    };
 
-    while (true) {
+    bool IsBracket(const Token& token, BracketToken bracket) {
+        return std::holds_alternative<BracketToken>(token) &&
+               std::get<BracketToken>(token) == bracket;
+    }
 
-        if (tokenizer->IsEnd()) {
-            throw SyntaxError{"Invalid input"};
+    // Reads data with an explicit stack of open forms, so nesting costs heap rather than native
+    // stack. Starting with an open list reads the rest of a list whose bracket was consumed.
+    Value ReadDatum(Tokenizer* tokenizer, bool in_list, bool share_subtrees,
+                    DatumHashes* hashes) {
+        std::vector<OpenForm> open;
+        std::optional<SharedData> shared;
+        if (share_subtrees) {
+            shared.emplace(hashes);
         }
-
-        if (std::holds_alternative<BracketToken>(curr_token) &&
-            std::get<BracketToken>(tokenizer->GetToken()) == BracketToken::CLOSE) {
-            break;
+        auto open_list = [&] {
+            auto root = New<Cell>();
+            auto node = As<Cell>(root);
+            open.push_back({OpenForm::Kind::LIST, std::move(root), node});
+            if (shared) {
+                open.back().tail_hash = HashDatum(nullptr);
+            }
+            CheckDepth(open.size());
+        };
+        if (in_list) {
+            open_list();
         }
 
-        auto object = Read(tokenizer);
+        while (true) {
+            Value datum;
+            size_t hash = 0;
+            bool closed = false;
+            if (!open.empty() && open.back().kind == OpenForm::Kind::LIST &&
+                !open.back().awaiting_tail) {
+                if (tokenizer->IsEnd()) {
+                    throw SyntaxError{"Invalid input"};
+                }
+                if (IsBracket(tokenizer->GetToken(), BracketToken::CLOSE)) {
+                    tokenizer->Next();
+                    datum = std::move(open.back().list);
+                    if (shared) {
+                        // A list tail continues the elements, which HashDatum has to walk.
+                        const auto& list = open.back();
+                        hash = list.node->GetFirst() && !Is<Cell>(list.node->GetSecond())
+                                       ? list.hash.Finish(list.tail_hash)
+                                       : HashDatum(datum);
+                        datum = shared->Share(std::move(datum), hash);
+                    }
+                    open.pop_back();
+                    closed = true;
+                }
+            }
 
-        if (Is<Symbol>(object) && As<Symbol>(object)->GetName() == ".") {
-            if (!curr_node->GetFirst()) {
-                throw SyntaxError("Invalid Pair");
+            if (!closed) {
+                const Token& curr_token = tokenizer->GetToken();
+                if (tokenizer->IsEnd()) {
+                    throw SyntaxError{"Invalid input"};
+                }
+                if (std::holds_alternative<BooleanToken>(curr_token)) {
+                    datum = Value::FromBoolean(std::get<BooleanToken>(curr_token).state);
+                    tokenizer->Next();
+                } else if (std::holds_alternative<QuoteToken>(curr_token)) {
+                    tokenizer->Next();
+                    if (tokenizer->IsEnd()) {
+                        throw SyntaxError{"Invalid Usage of Quote"};
+                    }
+                    open.push_back({OpenForm::Kind::QUOTE, nullptr, nullptr});
+                    CheckDepth(open.size());
+                    continue;
+                } else if (std::holds_alternative<ConstantToken>(curr_token)) {
+                    datum = Value::FromNumber(std::get<ConstantToken>(curr_token).value);
+                    tokenizer->Next();
+                } else if (std::holds_alternative<BigConstantToken>(curr_token)) {
+                    datum = New<BigNumber>(
+                            BigInt::Parse(std::get<BigConstantToken>(curr_token).digits));
+                    tokenizer->Next();
+                } else if (std::holds_alternative<SymbolToken>(curr_token)) {
+                    datum = Symbol::Intern(std::get<SymbolToken>(curr_token).id);
+                    tokenizer->Next();
+                } else if (std::holds_alternative<DotToken>(curr_token)) {
+                    tokenizer->Next();
+                    datum = Symbol::Intern(kDotSymbol);
+                } else if (IsBracket(curr_token, BracketToken::OPEN)) {
+                    tokenizer->Next();
+                    if (IsBracket(tokenizer->GetToken(), BracketToken::CLOSE)) {
+                        tokenizer->Next();
+                        datum = nullptr;
+                    } else if (std::holds_alternative<SymbolToken>(tokenizer->GetToken()) &&
+                               std::get<SymbolToken>(tokenizer->GetToken()).id == kQuoteSymbol) {
+                        tokenizer->Next();
+                        if (tokenizer->IsEnd()) {
+                            throw SyntaxError{"Invalid Usage of Quote"};
+                        }
+                        open.push_back({OpenForm::Kind::QUOTE, nullptr, nullptr});
+                        CheckDepth(open.size());
+                        continue;
+                    } else {
+                        open_list();
+                        continue;
+                    }
+                } else {
+                    throw SyntaxError{"Invalid input"};
+                }
+                if (shared) {
+                    hash = HashDatum(datum);
+                    datum = shared->Share(std::move(datum), hash);
+                }
             }
-            curr_node->SetSecond(Read(tokenizer));
-            curr_token = tokenizer->GetToken();
-            continue;
-        }
 
-        if (!curr_node->GetFirst()) {
-            curr_node->SetFirst(object);
-        } else {
-            if (curr_node->GetSecond()) {
-                throw SyntaxError{"Invalid List"};
+            // Hand the datum to the forms waiting for it, closing quotes on the way.
+            while (!open.empty() && open.back().kind == OpenForm::Kind::QUOTE) {
+                datum = New<Cell>(Symbol::Intern(kQuoteSymbol), std::move(datum));
+                if (shared) {
+                    // (quote . datum) continues the elements of datum, so it is hashed anew.
+                    hash = HashDatum(datum);
+                    datum = shared->Share(std::move(datum), hash);
+                }
+                open.pop_back();
+            }
+            if (open.empty()) {
+                return datum;
+            }
+            auto& list = open.back();
+            if (list.awaiting_tail) {
+                list.node->SetSecond(std::move(datum));
+                list.tail_hash = hash;
+                list.awaiting_tail = false;
+                continue;
+            }
+            if (!datum) {
+                // () inside a list is an element of its own.
+                datum = EmptyList::Get();
+            }
+            if (Is<Symbol>(datum) && As<Symbol>(datum)->GetId() == kDotSymbol) {
+                if (!list.node->GetFirst()) {
+                    throw SyntaxError("Invalid Pair");
+                }
+                list.awaiting_tail = true;
+                continue;
+            }
+            if (shared) {
+                list.hash.Add(hash);
+            }
+            if (!list.node->GetFirst()) {
+                list.node->SetFirst(std::move(datum));
+            } else {
+                if (list.node->GetSecond()) {
+                    throw SyntaxError{"Invalid List"};
+                }
+                list.node->SetSecond(New<Cell>());
+                list.node = As<Cell>(list.node->GetSecond());
+                list.node->SetFirst(std::move(datum));
             }
-            curr_node->SetSecond(std::make_shared<Cell>());
-            curr_node = As<Cell>(curr_node->GetSecond());
-            curr_node->SetFirst(object);
         }
-        curr_token = tokenizer->GetToken();
     }
-    tokenizer->Next();
-    return root;
-}
\ No newline at end of file
+}  // namespace
+
+Value Read(Tokenizer* tokenizer, bool share_subtrees, DatumHashes* hashes) {
+    return ReadDatum(tokenizer, false, share_subtrees, hashes);
+}
+
+Value ReadList(Tokenizer* tokenizer, bool share_subtrees, DatumHashes* hashes) {
+    return ReadDatum(tokenizer, true, share_subtrees, hashes);
+}
@@ -3,6 +3,12 @@
 #include "object.h"
 #include "tokenizer.h"
 
-std::shared_ptr<Object> Read(Tokenizer* tokenizer);
+class DatumHashes;
 
-std::shared_ptr<Object> ReadList(Tokenizer* tokenizer);
\ No newline at end of file
+// With share_subtrees, equal lists and big numbers within the datum are read as one object, so
+// repeated subtrees take memory once. Nothing may modify the result then. The HashDatum of
+// every list read that way is added to *hashes, unless hashes is nullptr.
+Value Read(Tokenizer* tokenizer, bool share_subtrees = false, DatumHashes* hashes = nullptr);
+
+Value ReadList(Tokenizer* tokenizer, bool share_subtrees = false,
+               DatumHashes* hashes = nullptr);
\ No newline at end of file
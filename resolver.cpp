@@ -0,0 +1,579 @@
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <optional>
+#include "resolver.h"
+#include "arena.h"
+#include "memo.h"
+#include "run_limits.h"
+
+namespace {
+    struct Binding {
+        SymbolId name;
+        Address address;
+    };
+
+    // Variables visible inside one lambda. Variables of enclosing lambdas are not looked up
+    // through their frames at run time: each lambda lists the slots it captures from the frame
+    // of the call that creates it, and refers to them by their position in the closure.
+    struct FunctionScope {
+        FunctionScope* parent = nullptr;
+        // Innermost last, so a shadowing binding is found first.
+        std::vector<Binding> bindings;
+        std::vector<Address> captures;
+        uint32_t next_slot = 0;
+        uint32_t frame_size = 0;
+
+        uint32_t AllocateSlots(uint32_t count) {
+            auto first = next_slot;
+            next_slot += count;
+            frame_size = std::max(frame_size, next_slot);
+            return first;
+        }
+
+        const Binding* FindBinding(SymbolId name) const {
+            for (auto it = bindings.rbegin(); it != bindings.rend(); ++it) {
+                if (it->name == name) {
+                    return &*it;
+                }
+            }
+            return nullptr;
+        }
+    };
+
+    std::optional<Address> Lookup(FunctionScope* scope, SymbolId name) {
+        // The lambdas between the use and the binding, innermost first.
+        std::vector<FunctionScope*> between;
+        std::optional<Address> address;
+        for (; scope; scope = scope->parent) {
+            if (auto binding = scope->FindBinding(name)) {
+                address = binding->address;
+                break;
+            }
+            between.push_back(scope);
+        }
+        if (!address) {
+            return std::nullopt;
+        }
+        // Each of them captures the variable from the one around it. A boxed variable is
+        // shared by capturing the Environment that holds it.
+        for (auto scope_it = between.rbegin(); scope_it != between.rend(); ++scope_it) {
+            auto& captures = (*scope_it)->captures;
+            auto it = std::find_if(captures.begin(), captures.end(), [&](const Address& capture) {
+                return capture.scope == address->scope && capture.index == address->index;
+            });
+            if (it == captures.end()) {
+                captures.push_back({address->scope, address->index});
+                it = captures.end() - 1;
+            }
+            uint32_t index = it - captures.begin();
+            address = Address{Address::Scope::CLOSURE, index, address->boxed, address->offset};
+        }
+        return address;
+    }
+
+    // Elements of a proper list; () and an empty operand list give none.
+    std::vector<Value> ListToVector(const Value& list) {
+        std::vector<Value> elements;
+        const Value* tail = &list;
+        while (auto node = As<Cell>(*tail)) {
+            elements.push_back(node->GetFirst());
+            tail = &node->GetSecond();
+        }
+        if (*tail && !Is<EmptyList>(*tail)) {
+            throw SyntaxError{"Invalid Syntax"};
+        }
+        return elements;
+    }
+
+    SymbolId GetVariableName(const Value& value) {
+        auto symbol = As<Symbol>(value);
+        if (!symbol) {
+            throw SyntaxError{"Invalid Variable"};
+        }
+        return symbol->GetId();
+    }
+
+    bool IsKeyword(SymbolId id) {
+        return id == kQuoteSymbol || id == kDefineSymbol || id == kLambdaSymbol ||
+               id == kLetSymbol || FindSpecialForm(id);
+    }
+
+    // The name a body-level (define ...) form introduces, if form is one.
+    std::optional<SymbolId> GetDefinedName(const Value& form) {
+        auto cell = As<Cell>(form);
+        auto head = cell ? As<Symbol>(cell->GetFirst()) : nullptr;
+        if (!head || head->GetId() != kDefineSymbol) {
+            return std::nullopt;
+        }
+        auto target = As<Cell>(cell->GetSecond());
+        if (!target) {
+            return std::nullopt;
+        }
+        auto signature = As<Cell>(target->GetFirst());
+        auto name = As<Symbol>(signature ? signature->GetFirst() : target->GetFirst());
+        if (!name) {
+            return std::nullopt;
+        }
+        return name->GetId();
+    }
+
+    // A form whose sub-expressions are being resolved. enter runs once, right before the
+    // sub-expression at enter_at is resolved, and finish builds the node from the results.
+    struct Job {
+        std::vector<Value> forms;
+        std::vector<Value> resolved;
+        std::function<Value(std::vector<Value>&)> finish;
+        size_t enter_at = SIZE_MAX;
+        std::function<void()> enter;
+    };
+
+    // Whether a builtin may come to evaluate datum as code and apply an impure builtin then.
+    // Builtins such as list-ref evaluate the nested lists they return, and those apply any
+    // builtin their symbols name.
+    bool NamesImpureBuiltin(const Value& datum) {
+        std::vector<const Value*> pending{&datum};
+        while (!pending.empty()) {
+            const auto& value = *pending.back();
+            pending.pop_back();
+            if (auto cell = As<Cell>(value)) {
+                pending.push_back(&cell->GetFirst());
+                pending.push_back(&cell->GetSecond());
+            } else if (auto symbol = As<Symbol>(value)) {
+                auto builtin = FindBuiltin(symbol->GetId());
+                if (builtin && !builtin->pure) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Whether a resolved argument has the same value every time it is evaluated, and so does
+    // whatever a pure builtin makes of it.
+    bool IsConstant(const Value& arg) {
+        if (!NeedsEvaluation(arg) || Is<Memo>(arg)) {
+            return true;
+        }
+        auto cell = As<Cell>(arg);
+        auto head = cell ? As<Symbol>(cell->GetFirst()) : nullptr;
+        return head && head->GetId() == kQuoteSymbol && !NamesImpureBuiltin(cell->GetSecond());
+    }
+
+    // Resolves with an explicit stack of jobs rather than by recursion, so deeply nested code
+    // does not exhaust the native stack.
+    class Resolver {
+    public:
+        Resolver(GlobalEnvironment* globals, MemoCache* memo, const DatumHashes* hashes)
+            : globals_(globals), memo_(memo), hashes_(hashes) {
+        }
+
+        Value Run(const Value& ast) {
+            auto value = Start(ast);
+            while (!value) {
+                auto& job = jobs_.back();
+                auto next = job.resolved.size();
+                if (next == job.enter_at) {
+                    job.enter_at = SIZE_MAX;
+                    job.enter();
+                }
+                if (next < job.forms.size()) {
+                    value = Start(Value{job.forms[next]});
+                } else {
+                    auto finish = std::move(job.finish);
+                    auto resolved = std::move(job.resolved);
+                    jobs_.pop_back();
+                    value = finish(resolved);
+                }
+                if (value && !jobs_.empty()) {
+                    jobs_.back().resolved.push_back(std::move(*value));
+                    value.reset();
+                }
+            }
+            return std::move(*value);
+        }
+
+    private:
+        using Finish = std::function<Value(std::vector<Value>&)>;
+
+        // Resolves ast right away when it has no sub-expressions, or pushes the job for it.
+        std::optional<Value> Start(const Value& ast) {
+            if (auto symbol = As<Symbol>(ast)) {
+                return ResolveSymbol(ast, symbol->GetId());
+            }
+            auto cell = As<Cell>(ast);
+            if (!cell) {
+                return ast;
+            }
+            const auto& head = cell->GetFirst();
+            if (auto symbol = As<Symbol>(head)) {
+                switch (symbol->GetId()) {
+                    case kQuoteSymbol:
+                        return ast;
+                    case kDefineSymbol:
+                        StartDefine(cell->GetSecond());
+                        return std::nullopt;
+                    case kLambdaSymbol:
+                        StartLambda(cell->GetSecond());
+                        return std::nullopt;
+                    case kLetSymbol:
+                        StartLet(cell->GetSecond());
+                        return std::nullopt;
+                }
+                // Local variables shadow special forms and builtins.
+                if (!Lookup(scope_, symbol->GetId())) {
+                    if (auto form = FindSpecialForm(symbol->GetId())) {
+                        StartForm(form, cell->GetSecond());
+                        return std::nullopt;
+                    }
+                    if (auto builtin = FindBuiltin(symbol->GetId())) {
+                        Value tail;
+                        auto forms = SplitArgs(cell->GetSecond(), &tail);
+                        Push(std::move(forms),
+                             [this, builtin, tail, ast](std::vector<Value>& args) {
+                                 if (tail) {
+                                     args.push_back(tail);
+                                 }
+                                 return MakeCall(builtin, std::move(args), ast);
+                             });
+                        return std::nullopt;
+                    }
+                }
+            }
+            Value tail;
+            auto forms = SplitArgs(cell->GetSecond(), &tail);
+            forms.insert(forms.begin(), head);
+            Value operands = cell->GetSecond();
+            Push(std::move(forms), [tail, operands](std::vector<Value>& resolved) {
+                std::vector<Value> args{std::make_move_iterator(resolved.begin() + 1),
+                                        std::make_move_iterator(resolved.end())};
+                if (tail) {
+                    args.push_back(tail);
+                }
+                return New<Application>(std::move(resolved[0]), std::move(args), operands);
+            });
+            return std::nullopt;
+        }
+
+        Job& Push(std::vector<Value> forms, Finish finish) {
+            jobs_.push_back({std::move(forms), {}, std::move(finish), SIZE_MAX, nullptr});
+            CheckDepth(jobs_.size());
+            return jobs_.back();
+        }
+
+        // Builtin names and quote still evaluate to themselves.
+        Value ResolveSymbol(const Value& ast, SymbolId id) {
+            if (auto address = Lookup(scope_, id)) {
+                return New<Variable>(id, *address);
+            }
+            if (id == kQuoteSymbol || FindBuiltin(id)) {
+                return ast;
+            }
+            return New<Variable>(id, globals_->GetSlot(id));
+        }
+
+        // Same argument shape FillVectorOfArgs produces: the forms to resolve, and a dotted
+        // tail or a lone () that is passed as it is.
+        static std::vector<Value> SplitArgs(const Value& args, Value* tail) {
+            std::vector<Value> forms;
+            auto node = As<Cell>(args);
+            if (!node) {
+                if (args && !Is<EmptyList>(args)) {
+                    *tail = args;
+                }
+                return forms;
+            }
+            if (!node->GetFirst() && !node->GetSecond()) {
+                *tail = EmptyList::Get();
+                return forms;
+            }
+            while (node) {
+                forms.push_back(node->GetFirst());
+                const auto& second = node->GetSecond();
+                node = As<Cell>(second);
+                if (!node && second && !Is<EmptyList>(second)) {
+                    *tail = second;
+                }
+            }
+            return forms;
+        }
+
+        // (define name value) or (define (name . params) body...).
+        void StartDefine(const Value& operands) {
+            auto parts = ListToVector(operands);
+            if (parts.size() < 2) {
+                throw SyntaxError{"Invalid define"};
+            }
+            SymbolId name;
+            Value value;
+            if (auto signature = As<Cell>(parts[0])) {
+                name = GetVariableName(signature->GetFirst());
+                // Resolved as (lambda params body...).
+                value = New<Cell>(Symbol::Intern(kLambdaSymbol),
+                                  New<Cell>(signature->GetSecond(),
+                                            As<Cell>(operands)->GetSecond()));
+            } else {
+                if (parts.size() != 2) {
+                    throw SyntaxError{"Invalid define"};
+                }
+                name = GetVariableName(parts[0]);
+                value = parts[1];
+            }
+
+            Push({std::move(value)}, [this, name](std::vector<Value>& resolved) {
+                if (!scope_) {
+                    if (IsKeyword(name) || FindBuiltin(name)) {
+                        throw RuntimeError{"Can not redefine " + GetSymbolName(name)};
+                    }
+                    if (globals_->IsReadOnly()) {
+                        throw RuntimeError{"Can not define " + GetSymbolName(name) + " here"};
+                    }
+                    return New<Define>(name, globals_, std::move(resolved[0]));
+                }
+                // Internal defines were declared when their body was entered.
+                auto binding = scope_->FindBinding(name);
+                if (!binding || !binding->address.boxed) {
+                    throw SyntaxError{"Invalid define"};
+                }
+                return New<Define>(name, binding->address, std::move(resolved[0]));
+            });
+        }
+
+        // params is a list of names, optionally dotted with the name for the remaining ones,
+        // or a single name for all of them.
+        void StartLambda(const Value& operands) {
+            auto cell = As<Cell>(operands);
+            if (!cell) {
+                throw SyntaxError{"Invalid lambda"};
+            }
+            std::vector<SymbolId> names;
+            const Value* tail = &cell->GetFirst();
+            while (auto node = As<Cell>(*tail)) {
+                names.push_back(GetVariableName(node->GetFirst()));
+                tail = &node->GetSecond();
+            }
+            uint32_t required_args = names.size();
+            bool variadic = *tail && !Is<EmptyList>(*tail);
+            if (variadic) {
+                names.push_back(GetVariableName(*tail));
+            }
+            PushLambda(names, required_args, variadic, {}, ListToVector(cell->GetSecond()), false);
+        }
+
+        // Resolves the inits in the enclosing scope and forms as the body of a new lambda.
+        // When applied, the result is the lambda applied to the inits.
+        void PushLambda(const std::vector<SymbolId>& names, uint32_t required_args,
+                        bool variadic, std::vector<Value> inits, const std::vector<Value>& forms,
+                        bool applied) {
+            if (forms.empty()) {
+                throw SyntaxError{"Empty body"};
+            }
+            auto scope = std::make_shared<FunctionScope>();
+            scope->parent = scope_;
+            for (auto name : names) {
+                if (scope->FindBinding(name)) {
+                    throw SyntaxError{"Duplicate parameter " + GetSymbolName(name)};
+                }
+                scope->bindings.push_back(
+                        {name, {Address::Scope::FRAME, scope->AllocateSlots(1)}});
+            }
+            auto body = std::make_shared<Body>();
+            size_t init_count = inits.size();
+            inits.insert(inits.end(), forms.begin(), forms.end());
+            auto finish = [this, scope, body, init_count, applied, required_args,
+                           variadic](std::vector<Value>& resolved) {
+                scope_ = scope->parent;
+                body->forms.assign(std::make_move_iterator(resolved.begin() + init_count),
+                                   std::make_move_iterator(resolved.end()));
+                auto lambda = New<Lambda>(required_args, variadic, scope->frame_size,
+                                          std::move(scope->captures), std::move(*body));
+                if (!applied) {
+                    return lambda;
+                }
+                resolved.resize(init_count);
+                return New<Application>(std::move(lambda), std::move(resolved), nullptr);
+            };
+            auto& job = Push(std::move(inits), std::move(finish));
+            job.enter_at = init_count;
+            job.enter = [this, scope, body, forms] {
+                scope_ = scope.get();
+                EnterBody(forms, body.get());
+            };
+        }
+
+        // (let ((name init)...) body...)
+        void StartLet(const Value& operands) {
+            auto parts = ListToVector(operands);
+            if (parts.size() < 2) {
+                throw SyntaxError{"Invalid let"};
+            }
+            std::vector<SymbolId> names;
+            std::vector<Value> inits;
+            for (const auto& binding : ListToVector(parts[0])) {
+                auto pair = ListToVector(binding);
+                if (pair.size() != 2) {
+                    throw SyntaxError{"Invalid let"};
+                }
+                names.push_back(GetVariableName(pair[0]));
+                inits.push_back(pair[1]);
+            }
+            std::vector<Value> forms{parts.begin() + 1, parts.end()};
+
+            if (!scope_) {
+                // There is no frame at top level, so the let runs as an applied lambda.
+                PushLambda(names, names.size(), false, std::move(inits), forms, true);
+                return;
+            }
+            if (forms.empty()) {
+                throw SyntaxError{"Empty body"};
+            }
+            for (size_t i = 0; i < names.size(); ++i) {
+                if (std::find(names.begin(), names.begin() + i, names[i]) != names.begin() + i) {
+                    throw SyntaxError{"Duplicate variable " + GetSymbolName(names[i])};
+                }
+            }
+
+            // The slots are taken before resolving the inits, so lets nested in them can not
+            // reuse the slots while they are being filled.
+            auto scope = scope_;
+            auto saved_bindings = scope->bindings.size();
+            auto first_slot = scope->AllocateSlots(names.size());
+            auto body = std::make_shared<Body>();
+            size_t init_count = inits.size();
+            inits.insert(inits.end(), forms.begin(), forms.end());
+            auto finish = [scope, body, saved_bindings, first_slot,
+                           init_count](std::vector<Value>& resolved) {
+                body->forms.assign(std::make_move_iterator(resolved.begin() + init_count),
+                                   std::make_move_iterator(resolved.end()));
+                resolved.resize(init_count);
+                scope->bindings.resize(saved_bindings);
+                scope->next_slot = first_slot;
+                return New<Let>(first_slot, std::move(resolved), std::move(*body));
+            };
+            auto& job = Push(std::move(inits), std::move(finish));
+            job.enter_at = init_count;
+            job.enter = [this, scope, body, names, first_slot, forms] {
+                for (size_t i = 0; i < names.size(); ++i) {
+                    scope->bindings.push_back(
+                            {names[i],
+                             {Address::Scope::FRAME, static_cast<uint32_t>(first_slot + i)}});
+                }
+                EnterBody(forms, body.get());
+            };
+        }
+
+        // (if test consequent [alternative])
+        // The expressions of a form with clauses are resolved as one list, and the clauses are
+        // told apart by where they start in it.
+        void StartForm(const SpecialForm* form, const Value& operands) {
+            auto parts = ListToVector(operands);
+            if (parts.size() < form->min_operands || parts.size() > form->max_operands) {
+                throw SyntaxError{"Invalid " + GetSymbolName(form->name)};
+            }
+            std::vector<uint32_t> clauses;
+            if (form->clauses) {
+                std::vector<Value> expressions;
+                for (size_t i = 0; i < parts.size(); ++i) {
+                    auto clause = ListToVector(parts[i]);
+                    if (clause.empty()) {
+                        throw SyntaxError{"Invalid " + GetSymbolName(form->name)};
+                    }
+                    auto test = As<Symbol>(clause[0]);
+                    if (test && test->GetId() == kElseSymbol && !Lookup(scope_, kElseSymbol)) {
+                        if (i + 1 < parts.size()) {
+                            throw SyntaxError{"Invalid " + GetSymbolName(form->name)};
+                        }
+                        clause[0] = Value::FromBoolean(true);
+                    }
+                    clauses.push_back(expressions.size());
+                    expressions.insert(expressions.end(), clause.begin(), clause.end());
+                }
+                parts = std::move(expressions);
+            }
+            Push(std::move(parts), [form, clauses](std::vector<Value>& resolved) {
+                return New<Form>(form, std::move(resolved), clauses);
+            });
+        }
+
+        // Names defined anywhere in the body are visible in all of it, so the body can refer
+        // to functions defined further down.
+        void EnterBody(const std::vector<Value>& forms, Body* body) {
+            std::vector<SymbolId> defined;
+            for (const auto& form : forms) {
+                auto name = GetDefinedName(form);
+                if (name && std::find(defined.begin(), defined.end(), *name) == defined.end()) {
+                    defined.push_back(*name);
+                }
+            }
+            if (!defined.empty()) {
+                body->environment_slot = scope_->AllocateSlots(1);
+                body->environment_size = defined.size();
+                for (uint32_t i = 0; i < defined.size(); ++i) {
+                    scope_->bindings.push_back(
+                            {defined[i],
+                             {Address::Scope::FRAME, body->environment_slot, true, i}});
+                }
+            }
+        }
+
+        // source is the list the call was resolved from.
+        Value MakeCall(const Builtin* builtin, std::vector<Value> args,
+                       const Value& source) const {
+            if (!builtin->pure || !std::all_of(args.begin(), args.end(), IsConstant)) {
+                return New<Call>(builtin, std::move(args));
+            }
+            if (!memo_) {
+                return Fold(New<Call>(builtin, std::move(args)));
+            }
+            // The outermost call looks up the whole expression, so inner ones need no memo.
+            for (auto& arg : args) {
+                if (auto memo = As<Memo>(arg)) {
+                    arg = memo->GetExpression();
+                }
+            }
+            auto hash = hashes_ ? hashes_->Find(source) : std::nullopt;
+            return New<Memo>(New<Call>(builtin, std::move(args)), source, memo_, hash);
+        }
+
+        // Evaluates a pure call on literals right away and returns its result in place of it.
+        // A call that fails is left as it is, so the error is raised when, and only if, it is
+        // evaluated.
+        static Value Fold(Value call) {
+            Value result;
+            try {
+                result = Evaluate(call);
+            } catch (const RuntimeError&) {
+                return call;
+            }
+            if (Is<EmptyList>(result)) {
+                // Evaluating () is an error, but quoting nothing gives it back.
+                result = New<Cell>(Symbol::Intern(kQuoteSymbol), Value{});
+            } else if (NeedsEvaluation(result)) {
+                // A list has to be quoted again. Quoting an empty cell would not give it back.
+                auto cell = As<Cell>(result);
+                if (!cell || (!cell->GetFirst() && !cell->GetSecond())) {
+                    return call;
+                }
+                result = New<Cell>(Symbol::Intern(kQuoteSymbol), std::move(result));
+            } else if (!result || Is<Vector>(result)) {
+                // A vector is mutable, so every evaluation has to make a new one.
+                return call;
+            }
+            if (auto collector = StatsCollector::Current()) {
+                collector->CountFoldedCall();
+            }
+            return result;
+        }
+
+        GlobalEnvironment* globals_;
+        MemoCache* memo_;
+        const DatumHashes* hashes_;
+        FunctionScope* scope_ = nullptr;
+        std::vector<Job> jobs_;
+    };
+}  // namespace
+
+Value Resolve(const Value& ast, GlobalEnvironment* globals, MemoCache* memo,
+              const DatumHashes* hashes) {
+    return Resolver{globals, memo, hashes}.Run(ast);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "object.h"
+
+class DatumHashes;
+
+// Prepares ast for Evaluate. Applications of builtins become Call nodes, define, lambda and let
+// become their syntax nodes, special forms such as if and cond become Form nodes, and every
+// variable is bound to its lexical address, or to its slot in globals when no enclosing lambda
+// or let binds it. Quoted data is left as it is. The result borrows from ast.
+//
+// A call of a pure builtin whose arguments are all literals, or are such calls themselves, is
+// folded: it is evaluated here and replaced with its result, quoted if it is a list. If that
+// fails, the call is kept, so the error is raised when it is evaluated. With a memo cache, such
+// calls are wrapped in a Memo node that looks their result up in the cache instead, keyed on
+// the list they were read from. hashes, if given, has the HashDatum of such lists, as Read
+// computes them, so they need not be hashed again.
+Value Resolve(const Value& ast, GlobalEnvironment* globals, MemoCache* memo = nullptr,
+              const DatumHashes* hashes = nullptr);
@@ -0,0 +1,100 @@
+#include <algorithm>
+#include "run_limits.h"
+#include "error.h"
+
+namespace {
+    thread_local size_t max_depth = kDefaultMaxDepth;
+}  // namespace
+
+DepthLimitScope::DepthLimitScope(size_t depth) : previous_(max_depth) {
+    max_depth = depth;
+}
+
+DepthLimitScope::~DepthLimitScope() {
+    max_depth = previous_;
+}
+
+size_t GetMaxDepth() {
+    return max_depth;
+}
+
+void CheckDepth(size_t depth) {
+    if (depth > max_depth) {
+        throw RuntimeError{"Maximum nesting depth exceeded"};
+    }
+}
+
+namespace {
+    // Steps and bytes a thread takes from its budget at a time.
+    constexpr int64_t kStepChunk = 4096;
+    constexpr int64_t kByteChunk = 64 * 1024;
+
+    int64_t ToLimit(uint64_t limit) {
+        return static_cast<int64_t>(std::min<uint64_t>(limit, INT64_MAX));
+    }
+}  // namespace
+
+RunBudget::RunBudget(const RunLimits& limits, const CancellationToken* token)
+    : steps_left_(ToLimit(limits.max_steps)),
+      bytes_left_(ToLimit(limits.max_bytes)),
+      limits_steps_(limits.max_steps > 0),
+      limits_bytes_(limits.max_bytes > 0),
+      has_deadline_(limits.timeout.count() > 0),
+      token_(token) {
+    if (has_deadline_) {
+        deadline_ = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(limits.timeout);
+    }
+}
+
+void RunBudget::Refill() {
+    if (!current) {
+        credit = {kUnlimited, kUnlimited};
+        return;
+    }
+    current->Check();
+    if (credit.steps < 0) {
+        int64_t grant = kStepChunk;
+        if (current->limits_steps_) {
+            auto left = current->steps_left_.fetch_sub(kStepChunk, std::memory_order_relaxed);
+            if (left <= 0) {
+                throw LimitError{"Step limit exceeded"};
+            }
+            grant = std::min(grant, left);
+        }
+        credit.steps += grant;
+    }
+    if (credit.bytes < 0) {
+        int64_t needed = -credit.bytes;
+        int64_t grant = std::max(kByteChunk, needed);
+        if (current->limits_bytes_) {
+            auto left = current->bytes_left_.fetch_sub(grant, std::memory_order_relaxed);
+            if (left < needed) {
+                throw LimitError{"Memory limit exceeded"};
+            }
+            grant = std::min(grant, left);
+        }
+        credit.bytes += grant;
+    }
+}
+
+void RunBudget::Check() const {
+    if (token_ && token_->IsCancelled()) {
+        throw LimitError{"Run cancelled"};
+    }
+    if (has_deadline_ && std::chrono::steady_clock::now() > deadline_) {
+        throw LimitError{"Time limit exceeded"};
+    }
+}
+
+BudgetScope::BudgetScope(RunBudget* budget)
+    : previous_(RunBudget::current), previous_credit_(RunBudget::credit) {
+    RunBudget::current = budget;
+    RunBudget::credit = budget ? RunBudget::Credit{0, 0}
+                               : RunBudget::Credit{RunBudget::kUnlimited, RunBudget::kUnlimited};
+}
+
+BudgetScope::~BudgetScope() {
+    RunBudget::current = previous_;
+    RunBudget::credit = previous_credit_;
+}
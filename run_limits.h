@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Deepest nesting that reading, resolving, evaluating and serializing accept unless told
+// otherwise. None of them recurse on the native stack, so the limit bounds the memory a run
+// may spend on pending work rather than protecting the stack.
+constexpr size_t kDefaultMaxDepth = 1000000;
+
+// Sets the depth limit of the current thread while it is alive.
+class DepthLimitScope {
+public:
+    explicit DepthLimitScope(size_t max_depth);
+
+    ~DepthLimitScope();
+
+    DepthLimitScope(const DepthLimitScope&) = delete;
+    DepthLimitScope& operator=(const DepthLimitScope&) = delete;
+
+private:
+    size_t previous_;
+};
+
+size_t GetMaxDepth();
+
+// Throws a RuntimeError if depth is beyond the current limit.
+void CheckDepth(size_t depth);
+
+// What one run may use up; a limit of zero is no limit.
+struct RunLimits {
+    // Expressions the evaluator schedules plus builtin calls.
+    uint64_t max_steps = 0;
+    // Bytes of objects, vector elements and bignum digits made, including those freed since.
+    uint64_t max_bytes = 0;
+    std::chrono::nanoseconds timeout{0};
+};
+
+// Stops the runs that watch it from any thread. Once cancelled it stays so until Reset.
+class CancellationToken {
+public:
+    void Cancel() {
+        cancelled_.store(true, std::memory_order_relaxed);
+    }
+
+    void Reset() {
+        cancelled_.store(false, std::memory_order_relaxed);
+    }
+
+    bool IsCancelled() const {
+        return cancelled_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<bool> cancelled_{false};
+};
+
+// What is left of the limits of one run, shared by the threads working on it. Each thread
+// takes steps and bytes in chunks and only comes back for more once it has used them up,
+// which is also when the deadline and the cancellation token are checked. Charging thus costs
+// a thread-local decrement and a branch, and a run may overrun its deadline or notice
+// cancellation by up to one chunk of steps. Running out throws a LimitError, and so does
+// every later charge on the run.
+class RunBudget {
+public:
+    // token may be nullptr.
+    RunBudget(const RunLimits& limits, const CancellationToken* token);
+
+    RunBudget(const RunBudget&) = delete;
+    RunBudget& operator=(const RunBudget&) = delete;
+
+    // Charges one step to the current budget, if there is one.
+    static void ChargeStep() {
+        if (--credit.steps < 0) {
+            Refill();
+        }
+    }
+
+    // Charges bytes to the current budget, if there is one.
+    static void ChargeBytes(size_t bytes) {
+        credit.bytes -= static_cast<int64_t>(bytes < kMaxCharge ? bytes : kMaxCharge);
+        if (credit.bytes < 0) {
+            Refill();
+        }
+    }
+
+private:
+    friend class BudgetScope;
+
+    struct Credit {
+        int64_t steps;
+        int64_t bytes;
+    };
+
+    // Credit of a thread without a budget, which is never used up in practice.
+    static constexpr int64_t kUnlimited = INT64_MAX / 2;
+    // A single charge beyond this is more than any limit could allow anyway.
+    static constexpr size_t kMaxCharge = kUnlimited / 2;
+
+    inline static thread_local RunBudget* current = nullptr;
+    inline static thread_local Credit credit = {kUnlimited, kUnlimited};
+
+    // Tops the negative credits of this thread up from the current budget, or throws.
+    static void Refill();
+
+    void Check() const;
+
+    std::atomic<int64_t> steps_left_;
+    std::atomic<int64_t> bytes_left_;
+    bool limits_steps_;
+    bool limits_bytes_;
+    bool has_deadline_;
+    std::chrono::steady_clock::time_point deadline_;
+    const CancellationToken* token_;
+};
+
+// Charges this thread's work to budget while it is alive; nullptr charges nothing.
+class BudgetScope {
+public:
+    explicit BudgetScope(RunBudget* budget);
+
+    ~BudgetScope();
+
+    BudgetScope(const BudgetScope&) = delete;
+    BudgetScope& operator=(const BudgetScope&) = delete;
+
+private:
+    RunBudget* previous_;
+    RunBudget::Credit previous_credit_;
+};
@@ -1,13 +1,424 @@
-#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
 #include "scheme.h"
 #include "tokenizer.h"
 #include "parser.h"
+#include "resolver.h"
+#include "arena.h"
+#include "gc.h"
+#include "image.h"
+#include "memo.h"
+#include "mapped_file.h"
+#include "vm.h"
+#include "run_limits.h"
+
+namespace {
+    // Forms are handed from the reader to the evaluator in batches, so the threads
+    // synchronize once per batch rather than once per form. The reader may run at most
+    // kMaxPendingBatches batches ahead.
+    constexpr size_t kBatchSize = 64;
+    constexpr size_t kMaxPendingBatches = 4;
+
+    // Consecutive top-level forms together with the arena holding them. If error is set,
+    // reading failed right after the last form.
+    struct FormBatch {
+        std::unique_ptr<Arena> arena;
+        std::vector<Value> forms;
+        DatumHashes hashes;
+        std::exception_ptr error;
+    };
+
+    class FormQueue {
+    public:
+        // Returns false once the queue has been closed by the consumer.
+        bool Push(FormBatch batch) {
+            std::unique_lock lock{mutex_};
+            not_full_.wait(lock,
+                           [this] { return batches_.size() < kMaxPendingBatches || closed_; });
+            if (closed_) {
+                return false;
+            }
+            batches_.push_back(std::move(batch));
+            not_empty_.notify_one();
+            return true;
+        }
+
+        // Blocks until a batch is available. Returns false at the end of the input.
+        bool Pop(FormBatch* batch) {
+            std::unique_lock lock{mutex_};
+            not_empty_.wait(lock, [this] { return !batches_.empty() || finished_; });
+            if (batches_.empty()) {
+                return false;
+            }
+            *batch = std::move(batches_.front());
+            batches_.pop_front();
+            not_full_.notify_one();
+            return true;
+        }
+
+        void Finish() {
+            std::lock_guard lock{mutex_};
+            finished_ = true;
+            not_empty_.notify_one();
+        }
+
+        void Close() {
+            std::lock_guard lock{mutex_};
+            closed_ = true;
+            not_full_.notify_one();
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable not_empty_;
+        std::condition_variable not_full_;
+        std::deque<FormBatch> batches_;
+        bool finished_ = false;
+        bool closed_ = false;
+    };
+
+    void ReadForms(Tokenizer* tokenizer, FormQueue* queue, size_t max_depth,
+                   bool share_subtrees, StatsCollector* stats, RunBudget* budget) {
+        DepthLimitScope limit{max_depth};
+        StatsScope stats_scope{stats};
+        BudgetScope budget_scope{budget};
+        while (!tokenizer->IsEnd()) {
+            FormBatch batch;
+            batch.arena = std::make_unique<Arena>();
+            try {
+                Arena::Scope scope{batch.arena.get()};
+                while (!tokenizer->IsEnd() && batch.forms.size() < kBatchSize) {
+                    batch.forms.push_back(Read(tokenizer, share_subtrees, &batch.hashes));
+                }
+            } catch (...) {
+                batch.error = std::current_exception();
+            }
+            bool failed = static_cast<bool>(batch.error);
+            if (!queue->Push(std::move(batch)) || failed) {
+                break;
+            }
+        }
+        queue->Finish();
+    }
+}  // namespace
+
+Interpreter::Interpreter(ExecutionMode mode)
+    : mode_(mode),
+      max_depth_(kDefaultMaxDepth),
+      globals_(std::make_unique<GlobalEnvironment>()),
+      heap_(std::make_unique<Heap>()) {
+    heap_->AddRoots([this](Tracer* tracer) { globals_->Trace(tracer); });
+}
+
+Interpreter::~Interpreter() = default;
 
 std::string Interpreter::Run(const std::string& string) {
-    std::stringstream ss{string};
-    Tokenizer tokenizer{&ss};
+    std::string result;
+    RunSource(string, &result);
+    return result;
+}
+
+void Interpreter::Run(const std::string& source, std::string* result) {
+    RunSource(source, result);
+}
+
+std::string Interpreter::RunFile(const std::string& path) {
+    MappedFile file{path};
+    std::string result;
+    RunSource(file.View(), &result);
+    return result;
+}
+
+void Interpreter::RunStream(std::istream* in, const ResultSink& sink) {
+    Tokenizer tokenizer{in};
+    RunForms(&tokenizer, sink);
+}
+
+void Interpreter::RunFileStream(const std::string& path, const ResultSink& sink) {
+    MappedFile file{path};
+    Tokenizer tokenizer{file.View()};
+    RunForms(&tokenizer, sink);
+}
+
+void Interpreter::SaveImage(const std::string& source_path,
+                            const std::string& image_path) const {
+    MappedFile file{source_path};
+    DepthLimitScope limit{max_depth_};
+    std::string image;
+    {
+        Arena arena;
+        Arena::Scope scope{&arena};
+        Tokenizer tokenizer{file.View()};
+        std::vector<Value> forms;
+        while (!tokenizer.IsEnd()) {
+            forms.push_back(Read(&tokenizer, true));
+        }
+        image = MakeImage(forms);
+    }
+
+    std::ofstream out{image_path, std::ios::binary | std::ios::trunc};
+    out.write(image.data(), image.size());
+    out.close();
+    if (!out) {
+        throw RuntimeError{"Can not write file: " + image_path};
+    }
+}
+
+void Interpreter::RunImage(const std::string& path, const ResultSink& sink) {
+    Heap::RunScope heap_scope{heap_.get()};
+    MappedFile file{path};
+    DepthLimitScope limit{max_depth_};
+    StatsScope stats_scope{GetStats()};
+    RunBudget budget{limits_, token_.get()};
+    BudgetScope budget_scope{&budget};
+    auto arena = std::make_unique<Arena>();
+    auto changes = CountChanges();
+    try {
+        Arena::Scope scope{arena.get()};
+        Image image{file.View()};
+        std::string result;
+        for (size_t i = 0; i < image.CountForms(); ++i) {
+            result.clear();
+            EvaluateForm(image.GetForm(i), &result);
+            sink(result);
+        }
+    } catch (...) {
+        ReleaseArena(std::move(arena), changes);
+        throw;
+    }
+    ReleaseArena(std::move(arena), changes);
+}
+
+std::vector<std::string> Interpreter::RunBatch(const std::vector<std::string>& sources,
+                                               size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min(threads, sources.size());
+
+    // Nothing writes the globals while the workers run.
+    globals_->SetReadOnly(true);
+    struct ReadOnlyGuard {
+        GlobalEnvironment* globals;
+        ~ReadOnlyGuard() {
+            globals->SetReadOnly(false);
+        }
+    } guard{globals_.get()};
+
+    std::vector<std::string> results(sources.size());
+    std::vector<std::exception_ptr> errors(sources.size());
+    std::atomic<size_t> next{0};
+
+    // Workers claim small chunks of consecutive inputs; each Run uses its own arena, so the
+    // only state they share is the read-mostly symbol table.
+    auto work = [&] {
+        while (true) {
+            size_t begin = next.fetch_add(kBatchSize, std::memory_order_relaxed);
+            if (begin >= sources.size()) {
+                return;
+            }
+            size_t end = std::min(begin + kBatchSize, sources.size());
+            for (size_t i = begin; i < end; ++i) {
+                try {
+                    RunSource(sources[i], &results[i]);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; ++i) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    return results;
+}
+
+void Interpreter::SetMaxDepth(size_t max_depth) {
+    max_depth_ = max_depth;
+}
+
+void Interpreter::SetRunLimits(const RunLimits& limits) {
+    limits_ = limits;
+}
+
+void Interpreter::SetCancellationToken(std::shared_ptr<const CancellationToken> token) {
+    token_ = std::move(token);
+}
+
+void Interpreter::SetMemoCapacity(size_t capacity) {
+    if (memo_) {
+        memo_->SetCapacity(capacity);
+    } else if (capacity > 0) {
+        memo_ = std::make_unique<MemoCache>(capacity);
+    }
+}
+
+size_t Interpreter::CountMemoHits() const {
+    return memo_ ? memo_->CountHits() : 0;
+}
+
+size_t Interpreter::CountMemoMisses() const {
+    return memo_ ? memo_->CountMisses() : 0;
+}
+
+void Interpreter::SetStatsEnabled(bool enabled) {
+    if (enabled && !stats_) {
+        stats_ = std::make_unique<StatsCollector>(GetBuiltins().size());
+    }
+    stats_enabled_ = enabled;
+}
+
+InterpreterStats Interpreter::Stats() const {
+    return stats_ ? stats_->Get() : InterpreterStats{};
+}
+
+void Interpreter::ResetStats() {
+    if (stats_) {
+        stats_->Reset();
+    }
+}
+
+HeapStats Interpreter::GetHeapStats() const {
+    return heap_->GetStats();
+}
+
+void Interpreter::CollectGarbage() {
+    heap_->Collect();
+}
+
+std::string Interpreter::DumpResolved(const std::string& source) {
+    // Folding evaluates builtin calls, so it needs everything a run does.
+    Heap::RunScope heap_scope{heap_.get()};
+    DepthLimitScope limit{max_depth_};
+    StatsScope stats_scope{GetStats()};
+    RunBudget budget{limits_, token_.get()};
+    BudgetScope budget_scope{&budget};
+    auto arena = std::make_unique<Arena>();
+    auto changes = CountChanges();
+    std::string result;
+    try {
+        Arena::Scope scope{arena.get()};
+        Tokenizer tokenizer{source};
+        DatumHashes hashes;
+        auto obj = Read(&tokenizer, GetMemo() != nullptr, &hashes);
+        result = Resolve(obj, globals_.get(), GetMemo(), &hashes).Serialize();
+    } catch (...) {
+        ReleaseArena(std::move(arena), changes);
+        throw;
+    }
+    ReleaseArena(std::move(arena), changes);
+    return result;
+}
+
+void Interpreter::RunSource(std::string_view source, std::string* result) {
+    Heap::RunScope heap_scope{heap_.get()};
+    DepthLimitScope limit{max_depth_};
+    StatsScope stats_scope{GetStats()};
+    RunBudget budget{limits_, token_.get()};
+    BudgetScope budget_scope{&budget};
+    auto arena = std::make_unique<Arena>();
+    auto changes = CountChanges();
+    try {
+        Arena::Scope scope{arena.get()};
+
+        Tokenizer tokenizer{source};
+
+        DatumHashes hashes;
+        auto obj = Read(&tokenizer, GetMemo() != nullptr, &hashes);
+
+        EvaluateForm(obj, result, &hashes);
+    } catch (...) {
+        ReleaseArena(std::move(arena), changes);
+        throw;
+    }
+    ReleaseArena(std::move(arena), changes);
+}
+
+void Interpreter::RunForms(Tokenizer* tokenizer, const ResultSink& sink) {
+    Heap::RunScope heap_scope{heap_.get()};
+    FormQueue queue;
+    RunBudget budget{limits_, token_.get()};
+    std::thread reader{ReadForms, tokenizer, &queue, max_depth_, GetMemo() != nullptr,
+                       GetStats(), &budget};
+    DepthLimitScope limit{max_depth_};
+    StatsScope stats_scope{GetStats()};
+    BudgetScope budget_scope{&budget};
+    FormBatch batch;
+    // Reused for every result.
+    std::string result;
+    size_t changes = 0;
+    try {
+        while (queue.Pop(&batch)) {
+            changes = CountChanges();
+            for (auto& form : batch.forms) {
+                result.clear();
+                {
+                    Arena::Scope scope{batch.arena.get()};
+                    EvaluateForm(form, &result, &batch.hashes);
+                }
+                sink(result);
+            }
+            if (batch.error) {
+                std::rethrow_exception(batch.error);
+            }
+            batch.forms.clear();
+            batch.hashes = {};
+            ReleaseArena(std::move(batch.arena), changes);
+        }
+    } catch (...) {
+        batch.forms.clear();
+        ReleaseArena(std::move(batch.arena), changes);
+        queue.Close();
+        reader.join();
+        throw;
+    }
+    reader.join();
+}
+
+void Interpreter::EvaluateForm(const Value& ast, std::string* result,
+                               const DatumHashes* hashes) const {
+    if (mode_ == ExecutionMode::BYTECODE) {
+        VirtualMachine vm;
+        SerializeTo(vm.Execute(*Compile(ast, globals_.get())), result);
+        return;
+    }
+    SerializeTo(Evaluate(Resolve(ast, globals_.get(), GetMemo(), hashes)), result);
+}
+
+MemoCache* Interpreter::GetMemo() const {
+    if (!memo_ || memo_->GetCapacity() == 0) {
+        return nullptr;
+    }
+    return memo_.get();
+}
+
+StatsCollector* Interpreter::GetStats() const {
+    return stats_enabled_ ? stats_.get() : nullptr;
+}
 
-    auto obj = Read(&tokenizer);
+size_t Interpreter::CountChanges() const {
+    return globals_->CountDefinitions() + CountStores();
+}
 
-    return Evaluate(obj)->Serialize();
-}
\ No newline at end of file
+void Interpreter::ReleaseArena(std::unique_ptr<Arena> arena, size_t changes) {
+    if (arena && CountChanges() != changes) {
+        heap_->Adopt(std::move(arena));
+    }
+}
@@ -1,8 +1,157 @@
 #pragma once
 
+#include <functional>
+#include <istream>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
+#include "run_limits.h"
+#include "stats.h"
 
+// TREE_WALK resolves each expression and evaluates the result with Evaluate. BYTECODE resolves
+// it the same way, then compiles it and the body of every lambda in it for a stack machine:
+// variables, closures, calls with proper tail calls, define, let and the special forms all run
+// as bytecode. Only closures that builtins such as vector-map apply run on the tree walker.
+// Both give the same results.
+enum class ExecutionMode { TREE_WALK, BYTECODE };
+
+class Arena;
+class DatumHashes;
+class GlobalEnvironment;
+class Heap;
+class MemoCache;
+class Tokenizer;
+class Value;
+
+// Top-level definitions made by any of the Run methods stay visible to later calls.
 class Interpreter {
 public:
+    using ResultSink = std::function<void(const std::string&)>;
+
+    explicit Interpreter(ExecutionMode mode = ExecutionMode::TREE_WALK);
+
+    ~Interpreter();
+
     std::string Run(const std::string&);
+
+    // Like Run, but appends the result to *result instead of returning it, so a caller running
+    // many expressions can reuse one buffer. If printing the result fails, part of it may
+    // already have been appended.
+    void Run(const std::string& source, std::string* result);
+
+    // Prepares the expression the way Run does, without evaluating it, and returns what the
+    // evaluator would get, printed: builtin calls on literals are folded to their results and
+    // variables are shown by name. Folding is counted and limited like a run. For debugging the
+    // resolver.
+    std::string DumpResolved(const std::string& source);
+
+    // Runs the expression in a script file, reading it through a memory mapping.
+    std::string RunFile(const std::string& path);
+
+    // Evaluates every top-level form in the input, in order, and passes each result to sink as
+    // soon as it is ready. Later forms are parsed on a separate thread while earlier ones are
+    // evaluated, and only a bounded number of parsed forms is held at a time. The first error
+    // stops the stream and is rethrown after the results of the forms before it.
+    void RunStream(std::istream* in, const ResultSink& sink);
+
+    void RunFileStream(const std::string& path, const ResultSink& sink);
+
+    // Parses every top-level form of the script file at source_path and writes them to
+    // image_path as a program image (see image.h), which RunImage runs without tokenizing or
+    // parsing them again. Forms are stored parsed rather than resolved, since resolving binds
+    // them to the globals of one interpreter.
+    void SaveImage(const std::string& source_path, const std::string& image_path) const;
+
+    // Evaluates the forms of a program image in order, passing each result to sink, like
+    // RunFileStream does for a script. The image is read through a memory mapping, and if it is
+    // corrupt or of another format version, a RuntimeError is thrown before anything runs.
+    void RunImage(const std::string& path, const ResultSink& sink);
+
+    // Evaluates independent expressions concurrently on `threads` workers (all hardware
+    // threads if 0) and returns their results in input order. If any expression fails, the
+    // error of the first failing one in input order is rethrown once all workers are done.
+    // The expressions may use earlier definitions but can not define anything themselves, and
+    // must not vector-set! a vector that another one of them uses.
+    std::vector<std::string> RunBatch(const std::vector<std::string>& sources,
+                                      size_t threads = 0);
+
+    // Input nested deeper than max_depth, or evaluation that would have more than max_depth
+    // calls and subexpressions pending at once, fails with a RuntimeError. Tail calls do not
+    // count towards it.
+    void SetMaxDepth(size_t max_depth);
+
+    // Limits every later Run call, and each expression of RunBatch, to limits; a run that
+    // takes more steps, allocates more or lasts longer stops with a LimitError. No limits are
+    // set by default.
+    void SetRunLimits(const RunLimits& limits);
+
+    // Later runs stop with a LimitError soon after token is cancelled, from any thread.
+    // nullptr, the default, leaves them uncancellable.
+    void SetCancellationToken(std::shared_ptr<const CancellationToken> token);
+
+    // Caches the results of up to `capacity` distinct expressions that only apply pure builtins
+    // to constants, such as arithmetic on literals or list operations on quoted tables, across
+    // all later Run calls. Equal subtrees of each input are then also shared in memory. The
+    // least recently used result is evicted first; 0, the default, turns the cache off. Only
+    // used in the tree-walking mode.
+    void SetMemoCapacity(size_t capacity);
+
+    size_t CountMemoHits() const;
+
+    size_t CountMemoMisses() const;
+
+    // Turns counting of builtin calls and their time, evaluation steps, evaluation depth, folded
+    // calls and objects made on or off for later Run calls. Counts carry over when stats are
+    // turned off and back on; the bytecode mode counts no evaluation steps for what it compiles.
+    void SetStatsEnabled(bool enabled);
+
+    // What was counted so far, also available to running code as (interpreter-stats).
+    InterpreterStats Stats() const;
+
+    void ResetStats();
+
+    // Objects that outlive their run, because a definition or a vector-set! refers to them, are
+    // kept in a heap and garbage-collected between runs. This says how big it is and what
+    // collecting it has cost.
+    HeapStats GetHeapStats() const;
+
+    // Collects garbage now rather than once the heap has doubled. Waits for the runs going on
+    // to end, so it must not be called from a result sink.
+    void CollectGarbage();
+
+private:
+    void RunSource(std::string_view source, std::string* result);
+
+    void RunForms(Tokenizer* tokenizer, const ResultSink& sink);
+
+    // The memo cache if it is on, else nullptr.
+    MemoCache* GetMemo() const;
+
+    // The stats collector if stats are on, else nullptr.
+    StatsCollector* GetStats() const;
+
+    // Appends the printed result of ast to *result. hashes, if not nullptr, has the hashes
+    // Read computed for the lists of ast.
+    void EvaluateForm(const Value& ast, std::string* result,
+                      const DatumHashes* hashes = nullptr) const;
+
+    // Definitions and vector-set! stores made on this thread so far that kept their value in
+    // an arena. Either may leave an older object pointing into the current arena.
+    size_t CountChanges() const;
+
+    // Frees arena, unless a definition or store made since there were `changes` may have left
+    // something older pointing into it, in which case the heap adopts it.
+    void ReleaseArena(std::unique_ptr<Arena> arena, size_t changes);
+
+    ExecutionMode mode_;
+    size_t max_depth_;
+    RunLimits limits_;
+    std::shared_ptr<const CancellationToken> token_;
+    std::unique_ptr<GlobalEnvironment> globals_;
+    // Once made, lives as long as the interpreter, since definitions may refer to it.
+    std::unique_ptr<MemoCache> memo_;
+    std::unique_ptr<StatsCollector> stats_;
+    bool stats_enabled_ = false;
+    std::unique_ptr<Heap> heap_;
 };
@@ -0,0 +1,56 @@
+#include "stats.h"
+#include "object.h"
+
+StatsCollector::StatsCollector(size_t builtin_slots)
+    : builtins_(std::make_unique<BuiltinCounters[]>(builtin_slots)),
+      builtin_slots_(builtin_slots) {
+}
+
+void StatsCollector::CountBuiltin(size_t slot, uint64_t nanoseconds) {
+    if (slot < builtin_slots_) {
+        builtins_[slot].calls.fetch_add(1, std::memory_order_relaxed);
+        builtins_[slot].nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    }
+}
+
+InterpreterStats StatsCollector::Get() const {
+    InterpreterStats stats;
+    const auto& builtins = GetBuiltins();
+    for (size_t slot = 0; slot < builtins.size() && slot < builtin_slots_; ++slot) {
+        if (builtins[slot].function) {
+            stats.builtins.push_back({GetSymbolName(slot),
+                                      builtins_[slot].calls.load(std::memory_order_relaxed),
+                                      builtins_[slot].nanoseconds.load(std::memory_order_relaxed)});
+        }
+    }
+    stats.evaluations = evaluations_.load(std::memory_order_relaxed);
+    stats.max_depth = max_depth_.load(std::memory_order_relaxed);
+    stats.folded_calls = folded_calls_.load(std::memory_order_relaxed);
+    for (size_t type = 0; type < kMaxObjectTypes; ++type) {
+        if (auto count = objects_[type].load(std::memory_order_relaxed)) {
+            stats.objects.emplace_back(GetTypeName(static_cast<ObjectType>(type)), count);
+        }
+    }
+    return stats;
+}
+
+void StatsCollector::Reset() {
+    for (size_t slot = 0; slot < builtin_slots_; ++slot) {
+        builtins_[slot].calls.store(0, std::memory_order_relaxed);
+        builtins_[slot].nanoseconds.store(0, std::memory_order_relaxed);
+    }
+    evaluations_.store(0, std::memory_order_relaxed);
+    max_depth_.store(0, std::memory_order_relaxed);
+    folded_calls_.store(0, std::memory_order_relaxed);
+    for (auto& count : objects_) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+StatsScope::StatsScope(StatsCollector* collector) : previous_(StatsCollector::current) {
+    StatsCollector::current = collector;
+}
+
+StatsScope::~StatsScope() {
+    StatsCollector::current = previous_;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct BuiltinStats {
+    std::string name;
+    uint64_t calls = 0;
+    // Spent inside the builtin, including code it evaluates, such as the procedure of
+    // vector-map.
+    uint64_t nanoseconds = 0;
+};
+
+// What an interpreter has done since its stats were turned on or last reset.
+struct InterpreterStats {
+    // Every builtin, in the order of their names' symbol ids.
+    std::vector<BuiltinStats> builtins;
+    // Expressions the tree-walking evaluator scheduled, which is every Evaluate call and every
+    // subexpression it needed a step for. Constant arguments of builtin calls take none.
+    uint64_t evaluations = 0;
+    // Most evaluation tasks pending at once, the depth the depth limit applies to.
+    uint64_t max_depth = 0;
+    // Calls of pure builtins on literals that Resolve replaced with their result.
+    uint64_t folded_calls = 0;
+    // Objects made, by type; types of which none were made are left out. Numbers and booleans
+    // are stored inline in values and never take an object.
+    std::vector<std::pair<std::string, uint64_t>> objects;
+};
+
+// What a Heap holds and what collecting it has cost so far.
+struct HeapStats {
+    // Arenas adopted and still held, the bytes of the objects allocated in them and how many
+    // of those objects are still alive.
+    size_t arenas = 0;
+    size_t bytes = 0;
+    size_t objects = 0;
+    uint64_t collections = 0;
+    uint64_t freed_arenas = 0;
+    uint64_t freed_objects = 0;
+    uint64_t last_pause_nanoseconds = 0;
+    uint64_t max_pause_nanoseconds = 0;
+    uint64_t total_pause_nanoseconds = 0;
+};
+
+// Counters behind InterpreterStats. A thread running code for an interpreter with stats on has
+// its collector current; everywhere else, counting costs a thread-local load and a branch. The
+// counters are relaxed atomics, so any number of threads may share one collector.
+class StatsCollector {
+public:
+    static constexpr size_t kMaxObjectTypes = 32;
+
+    // builtin_slots is the size of the builtin table.
+    explicit StatsCollector(size_t builtin_slots);
+
+    static StatsCollector* Current() {
+        return current;
+    }
+
+    void CountBuiltin(size_t slot, uint64_t nanoseconds);
+
+    void CountEvaluation() {
+        evaluations_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void CountDepth(size_t depth) {
+        auto max_depth = max_depth_.load(std::memory_order_relaxed);
+        while (depth > max_depth &&
+               !max_depth_.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+    void CountFoldedCall() {
+        folded_calls_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void CountObject(size_t type) {
+        objects_[type].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    InterpreterStats Get() const;
+
+    void Reset();
+
+private:
+    struct BuiltinCounters {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> nanoseconds{0};
+    };
+
+    friend class StatsScope;
+
+    inline static thread_local StatsCollector* current = nullptr;
+
+    std::unique_ptr<BuiltinCounters[]> builtins_;
+    size_t builtin_slots_;
+    std::atomic<uint64_t> evaluations_{0};
+    std::atomic<uint64_t> max_depth_{0};
+    std::atomic<uint64_t> folded_calls_{0};
+    std::atomic<uint64_t> objects_[kMaxObjectTypes] = {};
+};
+
+// Makes collector current on this thread while it is alive; nullptr counts nothing.
+class StatsScope {
+public:
+    explicit StatsScope(StatsCollector* collector);
+
+    ~StatsScope();
+
+    StatsScope(const StatsScope&) = delete;
+    StatsScope& operator=(const StatsScope&) = delete;
+
+private:
+    StatsCollector* previous_;
+};
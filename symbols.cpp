@@ -0,0 +1,76 @@
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include "symbols.h"
+
+namespace {
+    class SymbolTable {
+    public:
+        SymbolTable() {
+            Intern("quote");
+            Intern(".");
+            Intern("define");
+            Intern("lambda");
+            Intern("let");
+            Intern("if");
+            Intern("and");
+            Intern("or");
+            Intern("cond");
+            Intern("when");
+            Intern("else");
+        }
+
+        SymbolId Intern(std::string_view name) {
+            {
+                std::shared_lock lock{mutex_};
+                auto it = ids_.find(name);
+                if (it != ids_.end()) {
+                    return it->second;
+                }
+            }
+            std::unique_lock lock{mutex_};
+            auto it = ids_.find(name);
+            if (it != ids_.end()) {
+                return it->second;
+            }
+            SymbolId id = names_.size();
+            // Keys view into names_, which never relocates its elements.
+            const auto& stored = names_.emplace_back(name);
+            ids_.emplace(stored, id);
+            return id;
+        }
+
+        const std::string& GetName(SymbolId id) const {
+            std::shared_lock lock{mutex_};
+            return names_[id];
+        }
+
+    private:
+        mutable std::shared_mutex mutex_;
+        std::deque<std::string> names_;
+        std::unordered_map<std::string_view, SymbolId> ids_;
+    };
+
+    SymbolTable& GetSymbolTable() {
+        static SymbolTable table;
+        return table;
+    }
+}  // namespace
+
+SymbolId InternSymbol(std::string_view name) {
+    // Names are never removed, so a per-thread cache keyed by views of the stored names stays
+    // valid and lets repeated names skip the shared lock.
+    thread_local std::unordered_map<std::string_view, SymbolId> cache;
+    auto it = cache.find(name);
+    if (it != cache.end()) {
+        return it->second;
+    }
+    auto id = GetSymbolTable().Intern(name);
+    cache.emplace(GetSymbolTable().GetName(id), id);
+    return id;
+}
+
+const std::string& GetSymbolName(SymbolId id) {
+    return GetSymbolTable().GetName(id);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+using SymbolId = uint32_t;
+
+// Every table starts with these names, so their ids are known without a lookup.
+constexpr SymbolId kQuoteSymbol = 0;
+constexpr SymbolId kDotSymbol = 1;
+constexpr SymbolId kDefineSymbol = 2;
+constexpr SymbolId kLambdaSymbol = 3;
+constexpr SymbolId kLetSymbol = 4;
+constexpr SymbolId kIfSymbol = 5;
+constexpr SymbolId kAndSymbol = 6;
+constexpr SymbolId kOrSymbol = 7;
+constexpr SymbolId kCondSymbol = 8;
+constexpr SymbolId kWhenSymbol = 9;
+constexpr SymbolId kElseSymbol = 10;
+
+// Process-wide intern table: each distinct name is stored once under a dense id.
+// Safe to use from several threads.
+SymbolId InternSymbol(std::string_view name);
+
+const std::string& GetSymbolName(SymbolId id);
@@ -0,0 +1,692 @@
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "error.h"
+#include "run_limits.h"
+#include "scheme.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+    size_t failures = 0;
+
+    void Fail(const std::string& what) {
+        ++failures;
+        std::cerr << "FAILED: " << what << '\n';
+    }
+
+    void Check(bool condition, const std::string& what) {
+        if (!condition) {
+            Fail(what);
+        }
+    }
+
+    void CheckRun(Interpreter* interpreter, const std::string& source,
+                  const std::string& expected) {
+        try {
+            auto result = interpreter->Run(source);
+            if (result != expected) {
+                Fail(source + " gave " + result + ", expected " + expected);
+            }
+        } catch (const std::exception& error) {
+            Fail(source + " threw " + error.what() + ", expected " + expected);
+        }
+    }
+
+    // Passes if run throws an E.
+    template <class E>
+    void CheckThrows(const std::function<void()>& run, const std::string& what) {
+        try {
+            run();
+        } catch (const E&) {
+            return;
+        } catch (const std::exception& error) {
+            Fail(what + " threw the wrong error: " + error.what());
+            return;
+        }
+        Fail(what + " did not throw");
+    }
+
+    template <class E>
+    void CheckRunThrows(Interpreter* interpreter, const std::string& source) {
+        CheckThrows<E>([&] { interpreter->Run(source); }, source);
+    }
+
+    // What a run gave, or the error it failed with.
+    std::string Outcome(Interpreter* interpreter, const std::string& source) {
+        try {
+            return interpreter->Run(source);
+        } catch (const SyntaxError& error) {
+            return std::string{"syntax error: "} + error.what();
+        } catch (const NameError& error) {
+            return std::string{"name error: "} + error.what();
+        } catch (const RuntimeError& error) {
+            return std::string{"runtime error: "} + error.what();
+        }
+    }
+
+    // A file in the temporary directory that is removed again when this goes away.
+    class TemporaryFile {
+    public:
+        TemporaryFile(const std::string& name, const std::string& contents)
+            : path_(std::filesystem::temp_directory_path() /
+                    ("scheme-test-" + std::to_string(std::hash<std::thread::id>{}(
+                                              std::this_thread::get_id())) +
+                     "-" + name)) {
+            std::ofstream out{path_, std::ios::binary | std::ios::trunc};
+            out << contents;
+        }
+
+        ~TemporaryFile() {
+            std::error_code error;
+            std::filesystem::remove(path_, error);
+        }
+
+        TemporaryFile(const TemporaryFile&) = delete;
+        TemporaryFile& operator=(const TemporaryFile&) = delete;
+
+        std::string GetPath() const {
+            return path_.string();
+        }
+
+    private:
+        std::filesystem::path path_;
+    };
+
+    std::vector<std::string> RunStream(Interpreter* interpreter, const std::string& source) {
+        std::vector<std::string> results;
+        std::stringstream in{source};
+        interpreter->RunStream(&in, [&](const std::string& result) { results.push_back(result); });
+        return results;
+    }
+
+    void TestValues() {
+        Interpreter interpreter;
+        CheckRun(&interpreter, "42", "42");
+        CheckRun(&interpreter, "-7", "-7");
+        CheckRun(&interpreter, "#t", "#t");
+        CheckRun(&interpreter, "(number? #f)", "#f");
+        CheckRun(&interpreter, "(boolean? #f)", "#t");
+        CheckRun(&interpreter, "(+ 1 (* 2 3) (- 10 4))", "13");
+        CheckRun(&interpreter, "'(1 #f . 2)", "(1 #f . 2)");
+        CheckRun(&interpreter, "(list 1 2 3)", "(1 2 3)");
+        CheckRun(&interpreter, "(cons 1 '(2))", "(1 2)");
+        CheckRunThrows<RuntimeError>(&interpreter, "(+ 1 #t)");
+        CheckRunThrows<SyntaxError>(&interpreter, "(+ 1 2");
+    }
+
+    void TestPredicates() {
+        Interpreter interpreter;
+        CheckRun(&interpreter, "(pair? '(1 . 2))", "#t");
+        CheckRun(&interpreter, "(pair? '())", "#f");
+        CheckRun(&interpreter, "(null? '())", "#t");
+        CheckRun(&interpreter, "(null? '(1))", "#f");
+        CheckRun(&interpreter, "(list? '(1 2))", "#t");
+        CheckRun(&interpreter, "(list? '(1 . 2))", "#f");
+        CheckRun(&interpreter, "(number? '(1))", "#f");
+        CheckRunThrows<RuntimeError>(&interpreter, "(car 1)");
+    }
+
+    void TestSymbols() {
+        Interpreter interpreter;
+        CheckRun(&interpreter, "'foo", "foo");
+        CheckRun(&interpreter, "(car '(a b))", "a");
+        CheckRun(&interpreter, "(cons 'a '(b . c))", "(a b . c)");
+        CheckRun(&interpreter, "'(list car abs)", "(list car abs)");
+    }
+
+    void TestExecutionModes() {
+        // Each program runs in order on a fresh interpreter of either mode.
+        const std::vector<std::vector<std::string>> programs = {
+                {"1", "-5", "#t", "'(1 2 . 3)", "(quote)", "'()", "(())", "(1 2)", "foo"},
+                {"(+ 1 (* 2 3) (- 10 4))", "(/ 10 3)", "(- 5)", "(+ 1 #t)", "(max 1 5 3)"},
+                {"(car '())", "(cdr '(1))", "(list-tail '(1 2 3) 4)", "(list 1 . 2)",
+                 "(+ 1 . 2)", "(cons 1)", "(abs)", "(car 1 2)", "(#t 1)", "(foo 1 2)"},
+                {"((car '(+)) 1 2)", "((car '(quote)) 1 2)", "((car '(foo)) 1 2)",
+                 "((car '(1)) 1 2)", "((car '(car)) '(1 2) 3)"},
+                {"(+ 9223372036854775807 1)", "(* -9223372036854775808 -1)", "(/ 1 0)"},
+                {"(define x 10)", "(define (add y) (+ x y))", "(add 5)", "(define x 20)",
+                 "(add 5)", "((lambda (a . b) (list a b)) 1 2 3)", "(let ((a 1) (b 2)) (+ a b))"},
+                {"(define (fact n) (if (= n 0) 1 (* n (fact (- n 1)))))", "(fact 30)",
+                 "(define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1))))",
+                 "(loop 100000 0)", "(fact 'a)"},
+                {"(if #f 1)", "(and 1 #f (car '()))", "(or #f '() 3)", "(and)", "(or)",
+                 "(cond (#f 1) ((= 1 1) 'a 'b) (else 'c))", "(cond (#f 1))", "(cond (7))",
+                 "(when (> 2 1) 1 2)", "(when #f 1)", "(if)", "(cond (else 1) (#t 2))"},
+                {"(define (make-counter) (let ((n 0)) (lambda () (define m (+ n 1)) m)))",
+                 "((make-counter))", "(define v (make-vector 3 0))", "(vector-set! v 1 5)", "v",
+                 "(vector-sum (vector-map (lambda (x) (* x x)) (vector 1 2 3)))",
+                 "(list->vector '(1 2))", "(vector-ref v 3)"},
+                {"(define (if x) x)", "(define (f if) (if 1))", "(f (lambda (x) (+ x 1)))",
+                 "(define (g list) (list 1 2))", "(g +)", "(let ((car cdr)) (car '(1 2)))"},
+                {"(define (count n) (cond ((= n 0) 'done) (else (count (- n 1)))))",
+                 "(count 100000)",
+                 "(define (even? n) (if (= n 0) #t (odd? (- n 1))))",
+                 "(define (odd? n) (and (not (= n 0)) (even? (- n 1))))", "(even? 100001)",
+                 "(define (spin n) (when (> n 0) (spin (- n 1))))", "(spin 100000)",
+                 "(define (walk n) (or (= n 0) (walk (- n 1))))", "(walk 100000)"},
+                {"(define (adder a) (lambda (b) (lambda (c) (+ a b c))))", "(((adder 1) 2) 3)",
+                 "(define (counter) (define n 0) (define (next) (define m (+ n 1)) m) next)",
+                 "((counter))", "(define (f . xs) xs)", "(f)", "(f 1 2)",
+                 "(define (g a . xs) (list a xs))", "(g 1)", "(g 1 2 3)", "(g)",
+                 "((lambda (x) x))", "(define h (lambda (x) (let ((y (* x 2))) (+ x y))))",
+                 "(h 5)", "(vector-map (lambda (x) (h x)) (vector 1 2))", "(undefined-name)",
+                 "((lambda (x) y) 1)", "(let ((x 1)) (let ((y (+ x 1))) (list x y)))"},
+                {"(define (classify n) (cond ((< n 0) 'negative) ((= n 0)) ((> n 5) 'big 'x)))",
+                 "(classify -1)", "(classify 0)", "(classify 3)", "(classify 9)",
+                 "(define (pick x) (or (and x '()) 'none))", "(pick #t)", "(pick #f)",
+                 "(define q 'quote)", "(q 1 2)", "(define (tail-quote) (q a b))", "(tail-quote)",
+                 "(define (n-args . xs) (if (null? xs) 0 (+ 1 (apply-rest xs))))",
+                 "(define (apply-rest xs) (n-args))", "(n-args 1 2)",
+                 "(define (bad) (car '()))", "(bad)", "(define (deep n) (if (= n 0) 0 "
+                 "(+ 1 (deep (- n 1)))))", "(deep 10000)"}};
+        for (const auto& program : programs) {
+            Interpreter tree_walker{ExecutionMode::TREE_WALK};
+            Interpreter bytecode{ExecutionMode::BYTECODE};
+            for (const auto& source : program) {
+                auto expected = Outcome(&tree_walker, source);
+                auto result = Outcome(&bytecode, source);
+                if (result != expected) {
+                    Fail(source + " gave " + result + " in bytecode, " + expected +
+                         " walking the tree");
+                }
+            }
+        }
+
+        // Compiled closures run without the tree walker, and tail calls take no depth.
+        Interpreter bytecode{ExecutionMode::BYTECODE};
+        bytecode.Run("(define (loop n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1))))");
+        bytecode.SetStatsEnabled(true);
+        bytecode.SetMaxDepth(10);
+        CheckRun(&bytecode, "(loop 1000 0)", "1000");
+        Check(bytecode.Stats().evaluations == 0, "the bytecode mode compiles closure calls");
+    }
+
+    void TestBuiltinOperators() {
+        Interpreter interpreter;
+        CheckRun(&interpreter, "((car '(+)) 1 2)", "3");
+        CheckRun(&interpreter, "(list 'car (car '(1)))", "(car 1)");
+        CheckRun(&interpreter, "'(+ 1 2)", "(+ 1 2)");
+        CheckRunThrows<RuntimeError>(&interpreter, "(list-tail '(1 2 3) 4)");
+        CheckRunThrows<RuntimeError>(&interpreter, "(cons 1)");
+    }
+
+    void TestRunFile() {
+        TemporaryFile script{"script.scm", "(+ 1\n 2 3)"};
+        Interpreter interpreter;
+        Check(interpreter.Run("(+ 1 2 3)") == interpreter.RunFile(script.GetPath()),
+              "RunFile runs the expression in the file");
+        CheckThrows<RuntimeError>([&] { interpreter.RunFile(script.GetPath() + ".missing"); },
+                                  "RunFile of a missing file");
+    }
+
+    void TestRunStream() {
+        Interpreter interpreter;
+        auto results = RunStream(&interpreter, "(+ 1 1) (* 2 3) '(a b) #t");
+        Check(results == std::vector<std::string>{"2", "6", "(a b)", "#t"},
+              "RunStream passes every result in order");
+
+        std::string many;
+        for (size_t i = 0; i < 1000; ++i) {
+            many += "(+ " + std::to_string(i) + " 1) ";
+        }
+        results = RunStream(&interpreter, many);
+        Check(results.size() == 1000 && results.back() == "1000",
+              "RunStream runs more forms than a batch holds");
+
+        results.clear();
+        std::stringstream in{"(+ 1 2) (car '()) (+ 3 4)"};
+        CheckThrows<RuntimeError>(
+                [&] {
+                    interpreter.RunStream(&in, [&](const std::string& result) {
+                        results.push_back(result);
+                    });
+                },
+                "RunStream with a failing form");
+        Check(results == std::vector<std::string>{"3"}, "RunStream stops at the first error");
+
+        TemporaryFile script{"stream.scm", "(+ 2 3)\n(car '(6))\n"};
+        results.clear();
+        interpreter.RunFileStream(script.GetPath(),
+                                  [&](const std::string& result) { results.push_back(result); });
+        Check(results == std::vector<std::string>{"5", "6"}, "RunFileStream runs the file");
+    }
+
+    void TestRunBatch() {
+        Interpreter interpreter;
+        std::vector<std::string> sources;
+        for (size_t i = 0; i < 500; ++i) {
+            sources.push_back("(* " + std::to_string(i) + " " + std::to_string(i) + ")");
+        }
+        auto results = interpreter.RunBatch(sources, 4);
+        bool ordered = results.size() == sources.size();
+        for (size_t i = 0; ordered && i < results.size(); ++i) {
+            ordered = results[i] == std::to_string(i * i);
+        }
+        Check(ordered, "RunBatch returns the results in input order");
+        Check(interpreter.RunBatch({}).empty(), "RunBatch of nothing");
+
+        sources[100] = "(car '())";
+        sources[300] = "(+ 1 #t)";
+        std::string first_error;
+        try {
+            interpreter.Run(sources[100]);
+        } catch (const RuntimeError& error) {
+            first_error = error.what();
+        }
+        try {
+            interpreter.RunBatch(sources, 4);
+            Fail("RunBatch with failing expressions did not throw");
+        } catch (const RuntimeError& error) {
+            Check(error.what() == first_error, "RunBatch rethrows the first error in input order");
+        }
+    }
+
+    void TestDefinitions() {
+        Interpreter interpreter;
+        CheckRun(&interpreter, "(define (fact n) (if (= n 0) 1 (* n (fact (- n 1)))))", "fact");
+        CheckRun(&interpreter, "(fact 12)", "479001600");
+        CheckRun(&interpreter, "(define x 10)", "x");
+        CheckRun(&interpreter, "(define (add y) (+ x y))", "add");
+        CheckRun(&interpreter, "(define x 20)", "x");
+        CheckRun(&interpreter, "(add 5)", "25");
+        CheckRun(&interpreter, "(let ((x 2) (y 3)) (* x y))", "6");
+        CheckRun(&interpreter, "((lambda (x . rest) rest) 1 2 3)", "(2 3)");
+        CheckRunThrows<NameError>(&interpreter, "undefined-variable");
+        CheckRunThrows<RuntimeError>(&interpreter, "(define car 1)");
+        CheckThrows<RuntimeError>([&] { interpreter.RunBatch({"(define z 1)"}); },
+                                  "RunBatch can not define");
+        Check(interpreter.RunBatch({"(add 1)", "(fact 3)"}) == std::vector<std::string>{"21", "6"},
+              "RunBatch uses earlier definitions");
+    }
+
+    void TestMaxDepth() {
+        Interpreter interpreter;
+        interpreter.SetMaxDepth(100);
+        std::string deep;
+        for (size_t i = 0; i < 200; ++i) {
+            deep += "(+ 1 ";
+        }
+        deep += "0" + std::string(200, ')');
+        CheckRunThrows<RuntimeError>(&interpreter, deep);
+        interpreter.Run("(define (down n) (if (= n 0) 0 (+ 1 (down (- n 1)))))");
+        CheckRunThrows<RuntimeError>(&interpreter, "(down 1000)");
+        interpreter.Run("(define (loop n) (if (= n 0) 0 (loop (- n 1))))");
+        CheckRun(&interpreter, "(loop 10000)", "0");
+        interpreter.SetMaxDepth(kDefaultMaxDepth);
+        CheckRun(&interpreter, deep, "200");
+        CheckRun(&interpreter, "(loop 1000000)", "0");
+    }
+
+    void TestOverflow() {
+        Interpreter interpreter;
+        CheckRun(&interpreter, "(+ 9223372036854775807 1)", "9223372036854775808");
+        CheckRun(&interpreter, "(- -9223372036854775808 1)", "-9223372036854775809");
+        CheckRun(&interpreter, "(* 4294967296 4294967296)", "18446744073709551616");
+        CheckRun(&interpreter, "(- (+ 9223372036854775807 1) 1)", "9223372036854775807");
+        CheckRun(&interpreter, "(abs -9223372036854775808)", "9223372036854775808");
+        CheckRun(&interpreter, "(< 9223372036854775807 9223372036854775808)", "#t");
+        CheckRunThrows<RuntimeError>(&interpreter, "(/ 1 0)");
+        CheckRun(&interpreter, "(define (fact n) (if (= n 0) 1 (* n (fact (- n 1)))))", "fact");
+        CheckRun(&interpreter, "(fact 25)", "15511210043330985984000000");
+    }
+
+    void TestKernels() {
+        Interpreter interpreter;
+        std::string sum = "(+";
+        for (size_t i = 1; i <= 100; ++i) {
+            sum += " " + std::to_string(i);
+        }
+        CheckRun(&interpreter, sum + ")", "5050");
+        CheckRun(&interpreter, "(* 2 3 4)", "24");
+        CheckRun(&interpreter, "(- 10 1 2)", "7");
+        CheckRun(&interpreter, "(+ 1 2 9223372036854775807)", "9223372036854775810");
+        CheckRun(&interpreter, "(max 1 5 3)", "5");
+        CheckRun(&interpreter, "(min 4 2 8)", "2");
+        CheckRun(&interpreter, "(< 1 2 3)", "#t");
+        CheckRun(&interpreter, "(< 3 2)", "#f");
+        CheckRun(&interpreter, "(= 1 1 1)", "#t");
+        CheckRun(&interpreter, "(>= 3 3 2)", "#t");
+        CheckRunThrows<RuntimeError>(&interpreter, "(< 1 #t)");
+    }
+
+    void TestVectors() {
+        Interpreter interpreter;
+        CheckRun(&interpreter, "(define v (make-vector 3 0))", "v");
+        CheckRun(&interpreter, "(vector-set! v 1 5)", "()");
+        CheckRun(&interpreter, "v", "#(0 5 0)");
+        CheckRun(&interpreter, "(vector-ref v 1)", "5");
+        CheckRun(&interpreter, "(vector-length v)", "3");
+        CheckRun(&interpreter, "(vector? v)", "#t");
+        CheckRun(&interpreter, "(vector-sum (vector 1 2 3))", "6");
+        CheckRun(&interpreter, "(vector-map (lambda (x) (* x x)) (vector 1 2 3))", "#(1 4 9)");
+        CheckRun(&interpreter, "(list->vector '(1 (2) 3))", "#(1 (2) 3)");
+        CheckRun(&interpreter, "(list-ref '(1 2 3) 2)", "3");
+        CheckRunThrows<RuntimeError>(&interpreter, "(vector-ref v 3)");
+        CheckRunThrows<RuntimeError>(&interpreter, "(list-ref '(1 2 3) 3)");
+    }
+
+    void TestRunAppends() {
+        Interpreter interpreter;
+        std::string result = "> ";
+        interpreter.Run("(+ 1 2)", &result);
+        interpreter.Run("'(4 5)", &result);
+        Check(result == "> 3(4 5)", "Run appends its results");
+    }
+
+    void TestSharedValues() {
+        Interpreter interpreter;
+        CheckRun(&interpreter, "(define l '(1 2 3))", "l");
+        CheckRun(&interpreter, "(cdr l)", "(2 3)");
+        CheckRun(&interpreter, "(cons 0 l)", "(0 1 2 3)");
+        CheckRun(&interpreter, "(list l l)", "((1 2 3) (1 2 3))");
+        CheckRun(&interpreter, "(list 1 (list) '(2 3))", "(1 () (2 3))");
+        CheckRun(&interpreter, "l", "(1 2 3)");
+    }
+
+    void TestMemo() {
+        Interpreter interpreter;
+        interpreter.SetMemoCapacity(16);
+        CheckRun(&interpreter, "(list-tail '(1 2 3 4) 2)", "(3 4)");
+        CheckRun(&interpreter, "(list-tail '(1 2 3 4) 2)", "(3 4)");
+        CheckRun(&interpreter, "(+ 99999999999999999999 (* 2 3))", "100000000000000000005");
+        CheckRun(&interpreter, "(+ 99999999999999999999 (* 2 3))", "100000000000000000005");
+        Check(interpreter.CountMemoHits() == 2, "memo hits");
+        Check(interpreter.CountMemoMisses() == 2, "memo misses");
+        CheckRunThrows<RuntimeError>(&interpreter, "(car '())");
+        CheckRunThrows<RuntimeError>(&interpreter, "(car '())");
+        interpreter.SetMemoCapacity(0);
+        CheckRun(&interpreter, "(list-tail '(1 2 3 4) 2)", "(3 4)");
+        Check(interpreter.CountMemoHits() == 2, "no memo hits once the cache is off");
+
+        interpreter.SetMemoCapacity(16);
+        CheckRun(&interpreter, "(define v1 (list-ref '((vector 1 2)) 0))", "v1");
+        CheckRun(&interpreter, "(vector-set! v1 0 99)", "()");
+        CheckRun(&interpreter, "(list-ref '((vector 1 2)) 0)", "#(1 2)");
+
+        // Forms of an image are hashed when they are first looked up rather than while read,
+        // and have to find the same entries.
+        auto hits = interpreter.CountMemoHits();
+        TemporaryFile script{"memo.scm", "(list-tail '(1 2 3 4) 2) (list-tail '(1 2 3 4) 2)"};
+        TemporaryFile image{"memo.img", ""};
+        interpreter.SaveImage(script.GetPath(), image.GetPath());
+        std::vector<std::string> results;
+        interpreter.RunImage(image.GetPath(),
+                             [&](const std::string& result) { results.push_back(result); });
+        interpreter.RunFileStream(script.GetPath(),
+                                  [&](const std::string& result) { results.push_back(result); });
+        Check(results == std::vector<std::string>(4, "(3 4)"), "memoized results of images");
+        Check(interpreter.CountMemoHits() == hits + 3, "images and streams share the cache");
+    }
+
+    void TestImages() {
+        TemporaryFile script{"image.scm",
+                             "(define (square x) (* x x)) (square 12) '(1 (2 3) (2 3)) "
+                             "(+ 99999999999999999999 1)"};
+        TemporaryFile image{"image.img", ""};
+        Interpreter interpreter;
+        interpreter.SaveImage(script.GetPath(), image.GetPath());
+
+        std::vector<std::string> results;
+        Interpreter other;
+        other.RunImage(image.GetPath(),
+                       [&](const std::string& result) { results.push_back(result); });
+        Check(results == std::vector<std::string>{"square", "144", "(1 (2 3) (2 3))",
+                                                  "100000000000000000000"},
+              "RunImage runs the saved forms");
+        CheckRun(&other, "(square 3)", "9");
+
+        std::string bytes;
+        {
+            std::ifstream in{image.GetPath(), std::ios::binary};
+            bytes.assign(std::istreambuf_iterator<char>{in}, {});
+        }
+        TemporaryFile truncated{"truncated.img", bytes.substr(0, bytes.size() / 2)};
+        TemporaryFile garbage{"garbage.img", std::string(bytes.size(), '\x5a')};
+        auto flipped = bytes;
+        flipped[4] = static_cast<char>(flipped[4] ^ 0x7f);
+        TemporaryFile version{"version.img", flipped};
+        flipped = bytes;
+        flipped[52] = static_cast<char>(flipped[52] ^ 1);
+        TemporaryFile reserved{"reserved.img", flipped};
+        for (const auto* file : {&truncated, &garbage, &version, &reserved}) {
+            bool ran = false;
+            CheckThrows<RuntimeError>(
+                    [&] {
+                        Interpreter fresh;
+                        fresh.RunImage(file->GetPath(), [&](const std::string&) { ran = true; });
+                    },
+                    "RunImage of a corrupt image " + file->GetPath());
+            Check(!ran, "nothing of a corrupt image runs");
+        }
+
+        std::string numbers;
+        for (size_t i = 0; i < 100000; ++i) {
+            numbers += " " + std::to_string(i);
+        }
+        TemporaryFile long_script{"long.scm", "(list-ref '(" + numbers + ") 99999)"};
+        TemporaryFile long_image{"long.img", ""};
+        interpreter.SaveImage(long_script.GetPath(), long_image.GetPath());
+        results.clear();
+        other.RunImage(long_image.GetPath(),
+                       [&](const std::string& result) { results.push_back(result); });
+        Check(results == std::vector<std::string>{"99999"}, "RunImage builds long lists");
+    }
+
+    void TestStats() {
+        Interpreter interpreter;
+        interpreter.Run("(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))");
+        interpreter.SetStatsEnabled(true);
+        CheckRun(&interpreter, "(fib 10)", "55");
+        auto stats = interpreter.Stats();
+        uint64_t additions = 0;
+        for (const auto& builtin : stats.builtins) {
+            if (builtin.name == "+") {
+                additions = builtin.calls;
+            }
+        }
+        Check(additions == 88, "stats count builtin calls");
+        Check(stats.evaluations > 0 && stats.max_depth > 0, "stats count evaluation");
+        auto shown = interpreter.Run("(interpreter-stats)");
+        Check(shown.find("(evaluations . ") != std::string::npos,
+              "interpreter-stats shows the stats");
+
+        interpreter.ResetStats();
+        Check(interpreter.Stats().evaluations == 0, "ResetStats clears the counts");
+        interpreter.SetStatsEnabled(false);
+        interpreter.Run("(fib 5)");
+        Check(interpreter.Stats().evaluations == 0, "nothing is counted with stats off");
+        CheckRun(&interpreter, "(interpreter-stats)", "()");
+    }
+
+    void TestRunLimits() {
+        Interpreter interpreter;
+        interpreter.Run("(define (loop n) (if (= n 0) 0 (loop (- n 1))))");
+        interpreter.Run("(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))");
+
+        RunLimits limits;
+        limits.max_steps = 10000;
+        interpreter.SetRunLimits(limits);
+        CheckRun(&interpreter, "(loop 100)", "0");
+        CheckRunThrows<LimitError>(&interpreter, "(loop 1000000)");
+        CheckThrows<LimitError>([&] { interpreter.RunBatch({"(+ 1 2)", "(loop 1000000)"}); },
+                                "RunBatch with a step limit");
+
+        limits = {};
+        limits.max_bytes = 1 << 20;
+        interpreter.SetRunLimits(limits);
+        CheckRun(&interpreter, "(car (build 10 '()))", "1");
+        CheckRunThrows<LimitError>(&interpreter, "(car (build 1000000 '()))");
+        CheckRunThrows<LimitError>(&interpreter, "(make-vector 1000000000)");
+
+        limits = {};
+        limits.timeout = std::chrono::milliseconds{20};
+        interpreter.SetRunLimits(limits);
+        CheckRunThrows<LimitError>(&interpreter, "(loop 1000000000000)");
+
+        interpreter.SetRunLimits({});
+        CheckRun(&interpreter, "(loop 100000)", "0");
+    }
+
+    void TestCancellation() {
+        Interpreter interpreter;
+        interpreter.Run("(define (loop n) (if (= n 0) 0 (loop (- n 1))))");
+        auto token = std::make_shared<CancellationToken>();
+        interpreter.SetCancellationToken(token);
+        std::thread canceller{[&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds{20});
+            token->Cancel();
+        }};
+        CheckRunThrows<LimitError>(&interpreter, "(loop 1000000000000)");
+        canceller.join();
+        CheckRunThrows<LimitError>(&interpreter, "(+ 1 2)");
+        token->Reset();
+        CheckRun(&interpreter, "(+ 1 2)", "3");
+        interpreter.SetCancellationToken(nullptr);
+    }
+
+    void TestHeap() {
+        Interpreter interpreter;
+        for (size_t i = 0; i < 100; ++i) {
+            interpreter.Run("(define table (vector " + std::to_string(i) + " 2 3))");
+        }
+        auto before = interpreter.GetHeapStats();
+        Check(before.arenas > 0, "definitions leave arenas in the heap");
+        interpreter.CollectGarbage();
+        auto after = interpreter.GetHeapStats();
+        Check(after.collections == before.collections + 1, "CollectGarbage collects");
+        Check(after.arenas < before.arenas && after.freed_objects > 0,
+              "collecting frees what was redefined");
+        CheckRun(&interpreter, "table", "#(99 2 3)");
+
+        // One cell out of each run's large list is defined; the lists themselves are not kept.
+        Interpreter lists;
+        lists.Run("(define table (vector 0 2 3))");
+        std::string numbers;
+        for (size_t i = 0; i < 2000; ++i) {
+            numbers += " " + std::to_string(i);
+        }
+        for (size_t i = 0; i < 300; ++i) {
+            lists.Run("(define x" + std::to_string(i) + " (list-tail (list" + numbers + ") 1999))");
+            lists.Run("(vector-set! table 0 (list-tail (list" + numbers + ") 1998))");
+        }
+        lists.CollectGarbage();
+        auto stats = lists.GetHeapStats();
+        Check(stats.arenas == 1 && stats.bytes < 16384, "defined cells do not keep their arenas");
+        CheckRun(&lists, "x299", "(1999)");
+        CheckRun(&lists, "table", "#((1998 1999) 2 3)");
+    }
+
+    void TestSharedAcrossThreads() {
+        // Every worker counts references to the same definitions.
+        Interpreter interpreter;
+        interpreter.Run("(define table (list 1 (list 2 3) 99999999999999999999))");
+        interpreter.Run("(define (second l) (car (cdr l)))");
+        std::vector<std::string> sources(1000, "(list (second table) (car (cdr (cdr table))))");
+        auto results = interpreter.RunBatch(sources, 4);
+        Check(results == std::vector<std::string>(1000, "((2 3) 99999999999999999999)"),
+              "RunBatch shares definitions between workers");
+        CheckRun(&interpreter, "table", "(1 (2 3) 99999999999999999999)");
+    }
+
+    void TestDumpResolved() {
+        Interpreter interpreter;
+        Check(interpreter.DumpResolved("(+ 1 2 (* 3 4))") == "15", "constant calls are folded");
+        Check(interpreter.DumpResolved("(lambda (x) (+ x (max 5 7)))") ==
+                      "(lambda #<arity 1> (+ x 7))",
+              "folding inside a lambda");
+        Check(interpreter.DumpResolved("(if #f (/ 1 0) 2)") == "(if #f (/ 1 0) 2)",
+              "calls that fail are kept");
+        CheckRun(&interpreter, "(if #t 1 (/ 1 0))", "1");
+
+        interpreter.SetStatsEnabled(true);
+        CheckRun(&interpreter, "(+ 1 (* 2 3))", "7");
+        Check(interpreter.Stats().folded_calls == 2, "stats count folded calls");
+        auto shown = interpreter.Run("(interpreter-stats)");
+        Check(shown.find("(folded-calls . 2)") != std::string::npos,
+              "interpreter-stats shows folded calls");
+
+        interpreter.ResetStats();
+        interpreter.DumpResolved("(* 2 3)");
+        Check(interpreter.Stats().folded_calls == 1, "DumpResolved counts what it folds");
+        auto token = std::make_shared<CancellationToken>();
+        token->Cancel();
+        interpreter.SetCancellationToken(token);
+        CheckThrows<LimitError>([&] { interpreter.DumpResolved("(* 2 3)"); },
+                                "DumpResolved after cancellation");
+    }
+
+    void TestImpureQuotedCode() {
+        // list-ref evaluates the list it picks, so the quoted vector call runs on every call.
+        Interpreter interpreter;
+        interpreter.SetStatsEnabled(true);
+        interpreter.Run("(define (f) (list-ref '((vector 1 2)) 0))");
+        interpreter.Run("(define v1 (f))");
+        interpreter.Run("(vector-set! v1 0 99)");
+        CheckRun(&interpreter, "v1", "#(99 2)");
+        CheckRun(&interpreter, "(f)", "#(1 2)");
+        Check(interpreter.DumpResolved("(list-ref '((interpreter-stats)) 0)") ==
+                      "(list-ref (quote (interpreter-stats)) 0)",
+              "calls that may reach impure builtins are kept");
+        Check(interpreter.Stats().folded_calls == 0, "nothing impure is folded");
+    }
+
+    void TestSpecialForms() {
+        Interpreter interpreter;
+        CheckRun(&interpreter, "(and 1 #f (car '()))", "#f");
+        CheckRun(&interpreter, "(or #f '() 3 (car '()))", "3");
+        CheckRun(&interpreter, "(if #f (car '()))", "()");
+        CheckRun(&interpreter, "(cond (#f (car '())) ((= 1 1) 1 2) (else 3))", "2");
+        CheckRun(&interpreter, "(cond (#f 1) (5))", "5");
+        CheckRun(&interpreter, "(when #f (car '()))", "()");
+        CheckRun(&interpreter, "(when #t 1 2)", "2");
+        CheckRun(&interpreter, "(define (loop n) (cond ((= n 0) 'done) (else (loop (- n 1)))))",
+                 "loop");
+        CheckRun(&interpreter, "(loop 1000000)", "done");
+        CheckRun(&interpreter, "(define (f and) (and 1 2))", "f");
+        CheckRun(&interpreter, "(f +)", "3");
+        CheckRunThrows<SyntaxError>(&interpreter, "(cond (else 1) (#t 2))");
+        CheckRunThrows<SyntaxError>(&interpreter, "(if)");
+    }
+}  // namespace
+
+int main() {
+    TestValues();
+    TestPredicates();
+    TestSymbols();
+    TestExecutionModes();
+    TestBuiltinOperators();
+    TestRunFile();
+    TestRunStream();
+    TestRunBatch();
+    TestDefinitions();
+    TestMaxDepth();
+    TestOverflow();
+    TestKernels();
+    TestVectors();
+    TestRunAppends();
+    TestSharedValues();
+    TestMemo();
+    TestImages();
+    TestStats();
+    TestRunLimits();
+    TestCancellation();
+    TestHeap();
+    TestSharedAcrossThreads();
+    TestDumpResolved();
+    TestImpureQuotedCode();
+    TestSpecialForms();
+    if (failures > 0) {
+        std::cerr << failures << " checks failed\n";
+        return EXIT_FAILURE;
+    }
+    std::cout << "All checks passed\n";
+    return EXIT_SUCCESS;
+}
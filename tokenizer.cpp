@@ -1,19 +1,41 @@
+#include <charconv>
 #include "error.h"
 #include "tokenizer.h"
 
 namespace {
-    bool IsSymbol(char c) {
+    bool IsSymbol(int c) {
         return !std::isspace(c) && c != '(' && c != ')' && c != '\'' && c != '.' &&
                c != std::istream::traits_type::eof();
     }
 
-    bool IsValidASCIISymbol(char c) {
+    bool IsValidASCIISymbol(int c) {
         return std::isalnum(c) || std::isdigit(c) || c == '<' || c == '=' || c == '>' || c == '*' ||
                c == '/' || c == '#' || c == '?' || c == '!' || c == '-' || c == '+';
     }
+
+    // A ConstantToken, or a BigConstantToken if the literal does not fit in 64 bits.
+    Token ParseNumber(std::string_view text) {
+        auto digits = text;
+        if (digits.front() == '+') {
+            digits.remove_prefix(1);
+        }
+        int64_t value = 0;
+        auto [end, error] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+        if (error == std::errc::result_out_of_range) {
+            return BigConstantToken{std::string(text)};
+        }
+        if (error != std::errc{} || end != digits.data() + digits.size()) {
+            throw SyntaxError{"Invalid Number"};
+        }
+        return ConstantToken{value};
+    }
 }  // namespace
 
-Tokenizer::Tokenizer(std::istream *in) : stream_(in), curr_token_(SymbolToken({})) {
+Tokenizer::Tokenizer(std::istream *in) : stream_(in), curr_token_(SymbolToken{}) {
+    Next();
+}
+
+Tokenizer::Tokenizer(std::string_view source) : source_(source), curr_token_(SymbolToken{}) {
     Next();
 }
 
@@ -21,11 +43,50 @@ bool Tokenizer::IsEnd() {
     return is_end_;
 }
 
+int Tokenizer::Peek() {
+    if (stream_) {
+        return stream_->peek();
+    }
+    return position_ < source_.size() ? static_cast<unsigned char>(source_[position_])
+                                      : std::istream::traits_type::eof();
+}
+
+int Tokenizer::Get() {
+    if (stream_) {
+        return stream_->get();
+    }
+    return position_ < source_.size() ? static_cast<unsigned char>(source_[position_++])
+                                      : std::istream::traits_type::eof();
+}
+
+void Tokenizer::StartLexeme(char first) {
+    if (stream_) {
+        buffer_.assign(1, first);
+    } else {
+        lexeme_start_ = position_ - 1;
+    }
+}
+
+void Tokenizer::ExtendLexeme() {
+    if (stream_) {
+        buffer_ += stream_->get();
+    } else {
+        ++position_;
+    }
+}
+
+std::string_view Tokenizer::GetLexeme() const {
+    if (stream_) {
+        return buffer_;
+    }
+    return source_.substr(lexeme_start_, position_ - lexeme_start_);
+}
+
 void Tokenizer::Next() {
-    char current = stream_->get();
+    int current = Get();
 
     while (std::isspace(current)) {
-        current = stream_->get();
+        current = Get();
     }
 
     if (current == std::istream::traits_type::eof()) {
@@ -53,65 +114,43 @@ void Tokenizer::Next() {
         return;
     }
 
-    if (std::isdigit(current)) {
-        std::string value;
-        value += current;
-        while (std::isdigit(stream_->peek())) {
-            value += stream_->get();
+    StartLexeme(current);
+
+    if (std::isdigit(current) ||
+        ((current == '-' || current == '+') && std::isdigit(Peek()))) {
+        while (std::isdigit(Peek())) {
+            ExtendLexeme();
         }
-        curr_token_ = ConstantToken{stoi(value)};
+        curr_token_ = ParseNumber(GetLexeme());
         return;
     }
 
     if (IsValidASCIISymbol(current)) {
-        if (current == '-' && std::isdigit(stream_->peek())) {
-            std::string value = "-";
-            value += stream_->get();
-            while (std::isdigit(stream_->peek())) {
-                value += stream_->get();
-            }
-            curr_token_ = ConstantToken{stoi(value)};
-            return;
-        }
-        if (current == '+' && std::isdigit(stream_->peek())) {
-            std::string value;
-            value += stream_->get();
-            while (std::isdigit(stream_->peek())) {
-                value += stream_->get();
-            }
-            curr_token_ = ConstantToken{stoi(value)};
-            return;
-        }
-        if (current == '#' && stream_->peek() == 't') {
-            stream_->get();
+        if (current == '#' && Peek() == 't') {
+            Get();
             curr_token_ = BooleanToken{true};
             return;
         }
-        if (current == '#' && stream_->peek() == 'f') {
-            stream_->get();
+        if (current == '#' && Peek() == 'f') {
+            Get();
             curr_token_ = BooleanToken{false};
             return;
         }
-        std::string value;
-        value += current;
-        while (IsSymbol(stream_->peek())) {
-            value += stream_->get();
-            if (stream_->peek() == std::istream::traits_type::eof()) {
-                break;
-            }
+        while (IsSymbol(Peek())) {
+            ExtendLexeme();
         }
-        curr_token_ = SymbolToken{value};
+        curr_token_ = SymbolToken{InternSymbol(GetLexeme())};
         return;
     }
     throw SyntaxError{"Invalid Symbol"};
 }
 
-Token Tokenizer::GetToken() {
+const Token& Tokenizer::GetToken() {
     return curr_token_;
 }
 
 bool SymbolToken::operator==(const SymbolToken &other) const {
-    return name == other.name;
+    return id == other.id;
 }
 
 bool QuoteToken::operator==(const QuoteToken &) const {
@@ -128,4 +167,8 @@ bool ConstantToken::operator==(const ConstantToken &other) const {
 
 bool BooleanToken::operator==(const BooleanToken &other) const {
     return state == other.state;
+}
+
+bool BigConstantToken::operator==(const BigConstantToken &other) const {
+    return digits == other.digits;
 }
\ No newline at end of file
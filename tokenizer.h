@@ -3,9 +3,12 @@
 #include <variant>
 #include <optional>
 #include <istream>
+#include <string>
+#include <string_view>
+#include "symbols.h"
 
 struct SymbolToken {
-    std::string name;
+    SymbolId id;
 
     bool operator==(const SymbolToken& other) const;
 };
@@ -21,11 +24,18 @@ struct DotToken {
 enum class BracketToken { OPEN, CLOSE };
 
 struct ConstantToken {
-    int value;
+    int64_t value;
 
     bool operator==(const ConstantToken& other) const;
 };
 
+// An integer literal too large for ConstantToken.
+struct BigConstantToken {
+    std::string digits;
+
+    bool operator==(const BigConstantToken& other) const;
+};
+
 struct BooleanToken {
     bool state;
 
@@ -33,20 +43,42 @@ struct BooleanToken {
 };
 
 using Token =
-        std::variant<ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken, BooleanToken>;
+        std::variant<ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken, BooleanToken,
+                     BigConstantToken>;
 
 class Tokenizer {
 public:
     Tokenizer(std::istream* in);
 
+    // Reads straight from a contiguous buffer, which must outlive the tokenizer. Lexemes are
+    // taken as views into it, so no characters are copied.
+    explicit Tokenizer(std::string_view source);
+
     bool IsEnd();
 
     void Next();
 
-    Token GetToken();
+    const Token& GetToken();
 
 private:
-    std::istream* stream_;
+    int Peek();
+
+    int Get();
+
+    // The current lexeme starts with the character just returned by Get().
+    void StartLexeme(char first);
+
+    // Appends the next character to the current lexeme.
+    void ExtendLexeme();
+
+    std::string_view GetLexeme() const;
+
+    std::istream* stream_ = nullptr;
+    std::string_view source_;
+    size_t position_ = 0;
+    size_t lexeme_start_ = 0;
+    // Holds the current lexeme when reading from a stream.
+    std::string buffer_;
     Token curr_token_;
     bool is_end_ = false;
 };
\ No newline at end of file
@@ -0,0 +1,309 @@
+#include <iterator>
+#include "vm.h"
+#include "arena.h"
+#include "run_limits.h"
+
+#if defined(__GNUC__)
+#define SCHEME_THREADED_DISPATCH 1
+#endif
+
+namespace {
+    [[noreturn]] void ThrowUnbound(SymbolId name) {
+        throw NameError{"Unbound variable: " + GetSymbolName(name)};
+    }
+
+    bool IsFalse(const Value& value) {
+        return value.IsBoolean() && !value.GetBoolean();
+    }
+}  // namespace
+
+Value VirtualMachine::Execute(const Program& entry) {
+    const Program* program = &entry;
+    const uint32_t* pc = program->code.data();
+    // Where the frame of the running closure starts on the stack, and the closure itself.
+    size_t frame = 0;
+    const Closure* closure = nullptr;
+    stack_.clear();
+    returns_.clear();
+
+    auto pop_args = [this](uint32_t argc) -> const std::vector<Value>& {
+        args_.assign(std::make_move_iterator(stack_.end() - argc),
+                     std::make_move_iterator(stack_.end()));
+        stack_.resize(stack_.size() - argc);
+        return args_;
+    };
+
+    auto load_slot = [&](const Address& address) -> const Value& {
+        if (address.scope == Address::Scope::FRAME) {
+            return stack_[frame + address.index];
+        }
+        return closure->GetCaptured(address.index);
+    };
+
+    auto load_boxed = [&](const Address& address) -> Value& {
+        return static_cast<Environment*>(load_slot(address).Get())->At(address.offset);
+    };
+
+    // Starts running the compiled closure at stack_[base] on the argc values above it, which
+    // become the first slots of its frame. A variadic closure gets the extra ones as a list.
+    auto enter = [&](const Closure* callee, size_t base, size_t argc) {
+        auto lambda = callee->GetLambda();
+        size_t required = lambda->GetRequiredArgs();
+        if (argc < required || (!lambda->IsVariadic() && argc > required)) {
+            throw RuntimeError{"Invalid Number of Arguments for : #<procedure>"};
+        }
+        RunBudget::ChargeStep();
+        frame = base + 1;
+        if (lambda->IsVariadic()) {
+            Value rest;
+            for (size_t i = argc; i > required; --i) {
+                rest = New<Cell>(std::move(stack_[frame + i - 1]), std::move(rest));
+            }
+            stack_.resize(frame + required);
+            stack_.push_back(rest ? std::move(rest) : EmptyList::Get());
+        }
+        stack_.resize(frame + lambda->GetFrameSize());
+        closure = callee;
+        program = lambda->GetProgram();
+        pc = program->code.data() + lambda->GetEntry();
+    };
+
+    // Applies the value at stack_[base], anything but a compiled closure, to the argc values
+    // above it, and leaves the result in its place.
+    auto apply = [&](size_t base, uint32_t argc) {
+        const auto& op = stack_[base];
+        if (auto callee = As<Closure>(op)) {
+            auto result = callee->Apply(pop_args(argc));
+            stack_.back() = std::move(result);
+            return;
+        }
+        auto symbol = As<Symbol>(op);
+        if (!symbol) {
+            throw RuntimeError{"Evaluating Wrong Type"};
+        }
+        if (auto builtin = FindBuiltin(symbol->GetId())) {
+            auto result = builtin->Apply(pop_args(argc));
+            stack_.back() = std::move(result);
+        } else {
+            stack_.resize(stack_.size() - argc);
+        }
+    };
+
+    // Ends the running closure: its frame and the closure itself make way for the result.
+    auto leave = [&] {
+        auto result = std::move(stack_.back());
+        stack_.resize(frame - 1);
+        stack_.push_back(std::move(result));
+        const auto& caller = returns_.back();
+        program = caller.program;
+        pc = caller.pc;
+        frame = caller.frame;
+        closure = caller.closure;
+        returns_.pop_back();
+    };
+
+    auto is_compiled = [](const Closure* callee) {
+        return callee && callee->GetLambda()->GetProgram();
+    };
+
+#ifdef SCHEME_THREADED_DISPATCH
+    // Indexed by OpCode.
+    static const void* const kLabels[] = {
+            &&PUSH,         &&POP,           &&LOAD_FRAME,          &&LOAD_CLOSURE,
+            &&LOAD_GLOBAL,  &&LOAD_BOXED,    &&STORE_FRAME,         &&DEFINE_GLOBAL,
+            &&DEFINE_BOXED, &&MAKE_ENVIRONMENT,                     &&MAKE_CLOSURE,
+            &&CALL_BUILTIN, &&CALL,          &&TAIL_CALL,           &&RETURN,
+            &&JUMP,         &&JUMP_IF_FALSE, &&JUMP_IF_FALSE_OR_POP, &&JUMP_IF_TRUE_OR_POP,
+            &&QUOTE_BRANCH, &&EVALUATE,      &&RAISE_NOTHING,       &&RAISE_WRONG_TYPE,
+            &&HALT};
+    static_assert(std::size(kLabels) == static_cast<size_t>(OpCode::HALT) + 1);
+#define DISPATCH() goto* kLabels[*pc++]
+#define CASE(op) op:
+    DISPATCH();
+#else
+#define DISPATCH() continue
+#define CASE(op) case OpCode::op:
+    while (true) {
+        switch (static_cast<OpCode>(*pc++)) {
+#endif
+
+    CASE(PUSH) {
+        stack_.push_back(program->constants[*pc++]);
+        DISPATCH();
+    }
+    CASE(POP) {
+        stack_.pop_back();
+        DISPATCH();
+    }
+    CASE(LOAD_FRAME) {
+        Value value = stack_[frame + pc[0]];
+        if (!value) {
+            ThrowUnbound(pc[1]);
+        }
+        stack_.push_back(std::move(value));
+        pc += 2;
+        DISPATCH();
+    }
+    CASE(LOAD_CLOSURE) {
+        const auto& value = closure->GetCaptured(pc[0]);
+        if (!value) {
+            ThrowUnbound(pc[1]);
+        }
+        stack_.push_back(value);
+        pc += 2;
+        DISPATCH();
+    }
+    CASE(LOAD_GLOBAL) {
+        const auto& value = *program->global_slots[pc[0]];
+        if (!value) {
+            ThrowUnbound(pc[1]);
+        }
+        stack_.push_back(value);
+        pc += 2;
+        DISPATCH();
+    }
+    CASE(LOAD_BOXED) {
+        Value value = load_boxed(program->addresses[pc[0]]);
+        if (!value) {
+            ThrowUnbound(pc[1]);
+        }
+        stack_.push_back(std::move(value));
+        pc += 2;
+        DISPATCH();
+    }
+    CASE(STORE_FRAME) {
+        stack_[frame + *pc++] = std::move(stack_.back());
+        stack_.pop_back();
+        DISPATCH();
+    }
+    CASE(DEFINE_GLOBAL) {
+        program->globals->Define(pc[0], std::move(stack_.back()));
+        stack_.back() = program->constants[pc[1]];
+        pc += 2;
+        DISPATCH();
+    }
+    CASE(DEFINE_BOXED) {
+        load_boxed(program->addresses[pc[0]]) = std::move(stack_.back());
+        stack_.back() = program->constants[pc[1]];
+        pc += 2;
+        DISPATCH();
+    }
+    CASE(MAKE_ENVIRONMENT) {
+        stack_[frame + pc[0]] = New<Environment>(pc[1]);
+        pc += 2;
+        DISPATCH();
+    }
+    CASE(MAKE_CLOSURE) {
+        auto lambda = static_cast<const Lambda*>(program->constants[*pc++].Get());
+        std::vector<Value> captured;
+        captured.reserve(lambda->GetCaptures().size());
+        for (const auto& address : lambda->GetCaptures()) {
+            captured.push_back(load_slot(address));
+        }
+        stack_.push_back(New<Closure>(lambda, std::move(captured)));
+        DISPATCH();
+    }
+    CASE(CALL_BUILTIN) {
+        auto function = program->functions[pc[0]];
+        auto argc = pc[1];
+        pc += 2;
+        auto result = function->ApplyUnchecked(pop_args(argc));
+        stack_.push_back(std::move(result));
+        DISPATCH();
+    }
+    CASE(CALL) {
+        auto argc = *pc++;
+        auto base = stack_.size() - argc - 1;
+        auto callee = As<Closure>(stack_[base]);
+        if (is_compiled(callee)) {
+            returns_.push_back({program, pc, frame, closure});
+            CheckDepth(returns_.size());
+            enter(callee, base, argc);
+        } else {
+            apply(base, argc);
+        }
+        DISPATCH();
+    }
+    CASE(TAIL_CALL) {
+        auto argc = *pc++;
+        auto base = stack_.size() - argc - 1;
+        auto callee = As<Closure>(stack_[base]);
+        if (is_compiled(callee)) {
+            // Nothing is left to do in the running frame: the callee and its arguments take
+            // the place of the running closure and its frame.
+            std::move(stack_.begin() + base, stack_.end(), stack_.begin() + frame - 1);
+            stack_.resize(frame + argc);
+            enter(callee, frame - 1, argc);
+        } else {
+            apply(base, argc);
+            leave();
+        }
+        DISPATCH();
+    }
+    CASE(RETURN) {
+        leave();
+        DISPATCH();
+    }
+    CASE(JUMP) {
+        pc = program->code.data() + *pc;
+        DISPATCH();
+    }
+    CASE(JUMP_IF_FALSE) {
+        bool jump = IsFalse(stack_.back());
+        stack_.pop_back();
+        pc = jump ? program->code.data() + *pc : pc + 1;
+        DISPATCH();
+    }
+    CASE(JUMP_IF_FALSE_OR_POP) {
+        if (IsFalse(stack_.back())) {
+            pc = program->code.data() + *pc;
+        } else {
+            stack_.pop_back();
+            ++pc;
+        }
+        DISPATCH();
+    }
+    CASE(JUMP_IF_TRUE_OR_POP) {
+        const auto& top = stack_.back();
+        if (!IsFalse(top) && !(pc[1] && Is<EmptyList>(top))) {
+            pc = program->code.data() + pc[0];
+        } else {
+            stack_.pop_back();
+            pc += 2;
+        }
+        DISPATCH();
+    }
+    CASE(QUOTE_BRANCH) {
+        auto symbol = As<Symbol>(stack_.back());
+        if (symbol && symbol->GetId() == kQuoteSymbol) {
+            stack_.back() = program->constants[pc[1]];
+            pc = program->code.data() + pc[0];
+        } else {
+            pc += 2;
+        }
+        DISPATCH();
+    }
+    CASE(EVALUATE) {
+        stack_.push_back(Evaluate(program->constants[*pc++]));
+        DISPATCH();
+    }
+    CASE(RAISE_NOTHING) {
+        throw RuntimeError{"Evaluating Nothing"};
+    }
+    CASE(RAISE_WRONG_TYPE) {
+        throw RuntimeError{"Evaluating Wrong Type"};
+    }
+    CASE(HALT) {
+        auto result = std::move(stack_.back());
+        stack_.clear();
+        args_.clear();
+        return result;
+    }
+
+#ifndef SCHEME_THREADED_DISPATCH
+        }
+    }
+#endif
+#undef DISPATCH
+#undef CASE
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include "compiler.h"
+
+// Stack machine executing Programs produced by Compile. Keeps its stacks between runs so
+// steady-state execution does not allocate.
+//
+// A compiled closure runs in a frame on the value stack, right above the closure itself: its
+// arguments first, then the rest of its slots. Closures that were not compiled, and closures
+// applied by builtins such as vector-map, are run by Evaluate.
+class VirtualMachine {
+public:
+    Value Execute(const Program& program);
+
+private:
+    // Where a closure call returns to.
+    struct Return {
+        const Program* program;
+        const uint32_t* pc;
+        size_t frame;
+        const Closure* closure;
+    };
+
+    std::vector<Value> stack_;
+    std::vector<Value> args_;
+    std::vector<Return> returns_;
+};